@@ -0,0 +1,890 @@
+// Microbenchmarks for the chat server's shared data structures.
+//
+//   ./bench_grp [registry|fanout|members|limits|compress|parser|ring|alloc|pool|timers]
+//
+// Each benchmark prints one line per configuration so runs can be diffed.
+// alloc is also a check: it exits non-zero if the message path allocates.
+// pool is only a check: it exits non-zero if a thread cache loses count of
+// its blocks or two owners get the same block.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <new>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cluster.h"
+#include "command.h"
+#include "framing.h"
+#include "lz.h"
+#include "mpsc.h"
+#include "outbound.h"
+#include "payload.h"
+#include "pool.h"
+#include "ratelimit.h"
+#include "registry.h"
+#include "timerwheel.h"
+
+using Clock = std::chrono::steady_clock;
+
+#define BENCH_SECONDS 0.5
+
+// Results fold in here so the optimizer cannot drop the measured work.
+std::atomic<size_t> sink_total{0};
+
+// Heap allocations made by the current thread, for benchmarks that claim
+// to allocate nothing. Kept out of line so GCC does not pair the inlined
+// malloc/free with the new/delete expressions and warn.
+thread_local size_t allocations = 0;
+
+[[gnu::noinline]] void* operator new(size_t n) {
+    ++allocations;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// ----------------- Baseline --------------------------
+// The original server layout: one mutex in front of plain hash maps.
+class LockedRegistry {
+public:
+    void insert(const std::string& u, int fd) {
+        std::lock_guard<std::mutex> lock(mu_);
+        usernames_[u] = fd;
+    }
+    void erase(const std::string& u, int fd) {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = usernames_.find(u);
+        if (it != usernames_.end() && it->second == fd) usernames_.erase(it);
+    }
+    bool find(const std::string& u) const {
+        std::lock_guard<std::mutex> lock(mu_);
+        return usernames_.count(u) > 0;
+    }
+    size_t fan_out(const std::string& g, int sender) const {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = groups_.find(g);
+        size_t n = 0;
+        if (it == groups_.end() || !it->second.count(sender)) return 0;
+        for (int m : it->second) n += (m != sender);
+        return n;
+    }
+    void add_member(const std::string& g, int fd) {
+        std::lock_guard<std::mutex> lock(mu_);
+        groups_[g].insert(fd);
+    }
+
+private:
+    mutable std::mutex mu_;
+    std::unordered_map<std::string, int> usernames_;
+    std::unordered_map<std::string, std::unordered_set<int>> groups_;
+};
+
+class ShardedRegistry {
+public:
+    void insert(const std::string& u, int fd) { users_.insert(u, fd); }
+    void erase(const std::string& u, int fd) { users_.erase(u, fd); }
+    bool find(const std::string& u) const { return users_.find(u).has_value(); }
+    size_t fan_out(const std::string& g, int sender) const {
+        auto grp = groups_.find(g);
+        size_t n = 0;
+        if (grp) {
+            GroupTable<int>::for_each_member(*grp, sender, [&](int m) { n += (m != sender); });
+        }
+        return n;
+    }
+    void add_member(const std::string& g, int fd) {
+        auto grp = groups_.find(g);
+        if (!grp) grp = groups_.create(g, fd);
+        GroupTable<int>::join(*grp, fd);
+    }
+
+private:
+    UserRegistry<int> users_;
+    GroupTable<int> groups_;
+};
+
+// ----------------- Registry Contention ---------------
+// Every thread runs the server's lookup-heavy mix: 80% private-message
+// lookups, 10% group fan-out reads (64 members), 5% logins, 5% logouts.
+template <typename Registry>
+double run_registry(Registry& reg, const std::vector<std::string>& names,
+                    const std::vector<std::string>& group_names, int threads) {
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> total{0};
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(t * 7919 + 1);
+            uint64_t ops = 0;
+            size_t sink = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int k = 0; k < 256; ++k, ++ops) {
+                    uint32_t r = rng();
+                    const std::string& u = names[r % names.size()];
+                    int fd = static_cast<int>(r % names.size());
+                    switch ((r >> 24) % 20) {
+                        case 0:  reg.insert(u, fd); break;
+                        case 1:  reg.erase(u, fd); break;
+                        case 2:
+                        case 3:  sink += reg.fan_out(group_names[r % group_names.size()], 0); break;
+                        default: sink += reg.find(u); break;
+                    }
+                }
+            }
+            total += ops;
+            sink_total += sink;
+        });
+    }
+
+    auto start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(BENCH_SECONDS));
+    stop = true;
+    for (auto& w : workers) w.join();
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    return total / secs;
+}
+
+template <typename Registry>
+void fill(Registry& reg, const std::vector<std::string>& names, const std::vector<std::string>& group_names) {
+    for (size_t i = 0; i < names.size(); ++i) {
+        reg.insert(names[i], static_cast<int>(i));
+    }
+    for (const auto& g : group_names) {
+        for (int m = 0; m < 64; ++m) reg.add_member(g, m);
+    }
+}
+
+void bench_registry() {
+    std::vector<std::string> names;
+    for (int i = 0; i < 100000; ++i) names.push_back("user" + std::to_string(i));
+    std::vector<std::string> group_names;
+    for (int i = 0; i < 256; ++i) group_names.push_back("group" + std::to_string(i));
+
+    int max_threads = std::max(2u, std::thread::hardware_concurrency());
+    std::cout << "registry contention (" << std::thread::hardware_concurrency() << " cores)\n";
+    std::cout << std::setw(8) << "threads" << std::setw(16) << "mutex ops/s"
+              << std::setw(16) << "sharded ops/s" << std::setw(10) << "speedup" << "\n";
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        LockedRegistry locked;
+        ShardedRegistry sharded;
+        fill(locked, names, group_names);
+        fill(sharded, names, group_names);
+        double a = run_registry(locked, names, group_names, threads);
+        double b = run_registry(sharded, names, group_names, threads);
+        std::cout << std::setw(8) << threads << std::setw(16) << std::fixed << std::setprecision(0) << a
+                  << std::setw(16) << b << std::setw(9) << std::setprecision(2) << b / a << "x\n";
+    }
+}
+
+// ----------------- Group Fan-out ---------------------
+// One group message delivered to every member's queue: the old path formats
+// a std::string and copies it into each queue, the new one formats a shared
+// Payload once and queues a reference.
+template <typename Queue, typename Deliver>
+double run_fanout(std::vector<Queue>& queues, Deliver deliver) {
+    size_t rounds = 0;
+    auto start = Clock::now();
+    double secs = 0;
+    do {
+        for (int k = 0; k < 8; ++k, ++rounds) {
+            deliver(queues);
+            for (auto& q : queues) q.clear();
+        }
+        secs = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (secs < BENCH_SECONDS);
+    return secs * 1e9 / rounds;
+}
+
+void bench_fanout() {
+    const std::string group = "CS425";
+    std::cout << "group fan-out (ns per message)\n";
+    std::cout << std::setw(8) << "members" << std::setw(8) << "bytes" << std::setw(14) << "copy"
+              << std::setw(14) << "shared" << std::setw(10) << "speedup" << "\n";
+
+    for (size_t body : {64, 1024}) {
+        const std::string message(body, 'm');
+        for (size_t members : {10, 1000, 10000}) {
+            std::vector<std::vector<std::string>> copies(members);
+            std::vector<std::vector<Payload>> shared(members);
+
+            double a = run_fanout(copies, [&](auto& queues) {
+                std::string formatted = "[ Group " + group + " ]: " + message + "\n";
+                for (auto& q : queues) q.push_back(formatted);
+            });
+            double b = run_fanout(shared, [&](auto& queues) {
+                Payload formatted = concat_payload({"[ Group ", group, " ]: ", message, "\n"});
+                for (auto& q : queues) q.push_back(formatted);
+            });
+            std::cout << std::setw(8) << members << std::setw(8) << body
+                      << std::setw(14) << std::fixed << std::setprecision(0) << a
+                      << std::setw(14) << b << std::setw(9) << std::setprecision(2) << a / b << "x\n";
+        }
+    }
+}
+
+// ----------------- Group Members ---------------------
+// The member storage a group message scans: the old std::unordered_set of
+// handles against GroupTable's sorted flat vector. scan visits every member
+// once; churn is one join and one leave by a new session.
+template <typename F>
+double time_per_op(size_t ops_per_round, F&& round) {
+    size_t rounds = 0;
+    auto start = Clock::now();
+    double secs = 0;
+    do {
+        for (int k = 0; k < 8; ++k, ++rounds) round();
+        secs = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (secs < BENCH_SECONDS);
+    return secs * 1e9 / (rounds * ops_per_round);
+}
+
+void bench_members() {
+    using Members = GroupTable<uint64_t>::Members;
+    std::cout << "group members (ns per member scanned, ns per join+leave)\n";
+    std::cout << std::setw(8) << "members" << std::setw(12) << "set scan" << std::setw(12) << "flat scan"
+              << std::setw(12) << "set churn" << std::setw(12) << "flat churn" << "\n";
+
+    for (size_t members : {10, 1000, 10000, 100000}) {
+        // Session ids as the server makes them: one of 8 workers in the top
+        // bits and that worker's login sequence below, so a new session
+        // sorts after the older ones of its worker
+        std::mt19937 rng(members);
+        uint64_t seq[8] = {};
+        auto session_id = [&] {
+            uint64_t w = rng() % 8;
+            return w << 48 | ++seq[w];
+        };
+        std::vector<uint64_t> ids(members);
+        for (auto& id : ids) id = session_id();
+        std::unordered_set<uint64_t> set(ids.begin(), ids.end());
+        Members flat;
+        for (uint64_t id : ids) GroupTable<uint64_t>::insert(flat, id);
+
+        size_t sink = 0;
+        double set_scan = time_per_op(members, [&] {
+            for (uint64_t id : set) sink += id;
+        });
+        double flat_scan = time_per_op(members, [&] {
+            for (uint64_t id : flat) sink += id;
+        });
+        double set_churn = time_per_op(1, [&] {
+            uint64_t id = session_id();
+            set.insert(id);
+            set.erase(id);
+        });
+        double flat_churn = time_per_op(1, [&] {
+            uint64_t id = session_id();
+            GroupTable<uint64_t>::insert(flat, id);
+            GroupTable<uint64_t>::erase(flat, id);
+        });
+        sink_total += sink;
+        std::cout << std::setw(8) << members << std::setw(12) << std::fixed << std::setprecision(2) << set_scan
+                  << std::setw(12) << flat_scan << std::setw(12) << std::setprecision(1) << set_churn
+                  << std::setw(12) << flat_churn << "\n";
+    }
+}
+
+// ----------------- Rate Limits -----------------------
+// The per-command check: admit and charge a bucket that lives in the
+// session, against the same buckets in a table shared by all workers
+// behind one mutex, keyed by username.
+void bench_limits() {
+    std::cout << "rate limit check (ns per command)\n";
+    std::cout << std::setw(10) << "sessions" << std::setw(14) << "shared table" << std::setw(14) << "per session"
+              << std::setw(10) << "speedup" << "\n";
+
+    for (size_t sessions : {100, 10000, 1000000}) {
+        std::vector<TokenBucket> buckets(sessions);
+        std::vector<std::string> names(sessions);
+        std::unordered_map<std::string, TokenBucket> table;
+        for (size_t i = 0; i < sessions; ++i) {
+            names[i] = "user" + std::to_string(i);
+            table[names[i]];
+        }
+        std::mutex mu;
+        std::mt19937 rng(7);
+        std::vector<uint32_t> order(4096);
+        for (auto& i : order) i = rng() % sessions;
+
+        uint64_t now = 1;
+        size_t admitted = 0;
+        double shared = time_per_op(order.size(), [&] {
+            for (uint32_t i : order) {
+                std::lock_guard<std::mutex> lock(mu);
+                TokenBucket& b = table.find(names[i])->second;
+                if (b.admit(now += 1000, 2000, 20000)) {
+                    b.charge(3);
+                    ++admitted;
+                }
+            }
+        });
+        double local = time_per_op(order.size(), [&] {
+            for (uint32_t i : order) {
+                TokenBucket& b = buckets[i];
+                if (b.admit(now += 1000, 2000, 20000)) {
+                    b.charge(3);
+                    ++admitted;
+                }
+            }
+        });
+        sink_total += admitted;
+        std::cout << std::setw(10) << sessions << std::setw(14) << std::fixed << std::setprecision(1) << shared
+                  << std::setw(14) << local << std::setw(9) << std::setprecision(1) << shared / local << "x\n";
+    }
+}
+
+// ----------------- Compression -----------------------
+// Ratio and CPU cost of the LZ codec on what the server sends: chat lines
+// made of common words, broadcasts of a few KiB, a /history replay of 100
+// group messages joined into one payload, and random bytes as the worst
+// case. fan-out is the compression cost per recipient when one payload
+// goes to 1000 clients that asked for compression: the frame is built once.
+std::string chat_text(std::mt19937& rng, size_t bytes, const std::string& prefix) {
+    static const char* const WORDS[] = {
+        "the", "a", "to", "and", "of", "is", "in", "it", "you", "that", "we", "for", "on", "this",
+        "be", "with", "are", "have", "not", "at", "can", "will", "what", "so", "do", "if", "just",
+        "group", "server", "message", "meeting", "tomorrow", "assignment", "deadline", "please",
+        "thanks", "lecture", "socket", "thread", "lock", "queue", "client", "today", "anyone",
+        "know", "how", "works", "fixed", "bug", "push", "commit", "review", "test", "build"};
+    std::string out;
+    while (out.size() < bytes) {
+        out += prefix;
+        size_t words = 4 + rng() % 16;
+        for (size_t w = 0; w < words; ++w) {
+            out += WORDS[rng() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+            out += w + 1 < words ? ' ' : '\n';
+        }
+    }
+    out.resize(bytes);
+    return out;
+}
+
+void bench_compress() {
+    std::mt19937 rng(42);
+    std::string noise(4096, '\0');
+    for (char& c : noise) c = static_cast<char>(rng());
+    struct Sample {
+        const char* name;
+        std::string bytes;
+    };
+    const Sample samples[] = {
+        {"chat line", chat_text(rng, 120, "[ alice ]: ")},
+        {"broadcast 1K", chat_text(rng, 1024, "Broadcast: ")},
+        {"broadcast 4K", chat_text(rng, 4096, "Broadcast: ")},
+        {"history x100", chat_text(rng, 100 * 90, "[ Group CS425 ]: ")},
+        {"broadcast 64K", chat_text(rng, 65536, "Broadcast: ")},
+        {"random 4K", noise},
+    };
+    constexpr size_t RECIPIENTS = 1000;
+
+    std::cout << "compression (ns per payload; fan-out: ns per recipient of " << RECIPIENTS << ")\n";
+    std::cout << std::setw(14) << "payload" << std::setw(8) << "bytes" << std::setw(8) << "ratio"
+              << std::setw(12) << "compress" << std::setw(10) << "MB/s" << std::setw(12) << "decompress"
+              << std::setw(10) << "MB/s" << std::setw(10) << "fan-out" << "\n";
+    for (const Sample& sample : samples) {
+        const std::string& in = sample.bytes;
+        std::vector<char> packed(lz_bound(in.size()));
+        std::vector<char> back(in.size());
+        size_t block = 0;
+        double comp = time_per_op(1, [&] { block = lz_compress(in.data(), in.size(), packed.data()); });
+        bool ok = true;
+        double decomp = time_per_op(1, [&] { ok &= lz_decompress(packed.data(), block, back.data(), back.size()); });
+        if (!ok || std::string(back.begin(), back.end()) != in) {
+            std::cout << sample.name << ": round trip failed\n";
+            continue;
+        }
+        // Every recipient asks the shared payload for its packed form
+        double fanout = time_per_op(RECIPIENTS, [&] {
+            Payload p = make_payload(in);
+            for (size_t r = 0; r < RECIPIENTS; ++r) {
+                sink_total += p->packed([](const PayloadBuffer& b) {
+                    std::vector<char> out(lz_bound(b.size()));
+                    size_t n = lz_compress(b.data(), b.size(), out.data());
+                    return make_payload(std::string(out.data(), n));
+                })->size();
+            }
+        });
+        std::cout << std::setw(14) << sample.name << std::setw(8) << in.size()
+                  << std::setw(8) << std::fixed << std::setprecision(2) << double(in.size()) / block
+                  << std::setw(12) << std::setprecision(0) << comp << std::setw(10) << in.size() / comp * 1e3
+                  << std::setw(12) << decomp << std::setw(10) << in.size() / decomp * 1e3
+                  << std::setw(10) << std::setprecision(1) << fanout << "\n";
+    }
+}
+
+// ----------------- Command Parsing -------------------
+// The old handle_command front end: copy the frame into a std::string, trim
+// it, try each prefix with rfind and substr every argument.
+struct LegacyCommand {
+    Command command = Command::Unknown;
+    std::string target;
+    std::string body;
+};
+
+std::string legacy_trim(const std::string& str) {
+    size_t start = str.find_first_not_of(" \n\r\t");
+    size_t end = str.find_last_not_of(" \n\r\t");
+    if (start == std::string::npos || end == std::string::npos) {
+        return "";
+    }
+    return str.substr(start, end - start + 1);
+}
+
+LegacyCommand legacy_parse(std::string_view frame) {
+    LegacyCommand c;
+    std::string input(frame);
+    std::string msg = legacy_trim(input);
+    if (msg.rfind("/broadcast ", 0) == 0) {
+        c.command = Command::Broadcast;
+        c.body = legacy_trim(msg.substr(11));
+    } else if (msg.rfind("/msg ", 0) == 0) {
+        c.command = Command::Msg;
+        size_t sp = msg.find(' ', 5);
+        if (sp != std::string::npos) {
+            c.target = legacy_trim(msg.substr(5, sp - 5));
+            c.body = legacy_trim(msg.substr(sp + 1));
+        }
+    } else if (msg.rfind("/create_group ", 0) == 0) {
+        c.command = Command::CreateGroup;
+        c.target = legacy_trim(msg.substr(14));
+    } else if (msg.rfind("/join_group ", 0) == 0) {
+        c.command = Command::JoinGroup;
+        c.target = legacy_trim(msg.substr(12));
+    } else if (msg.rfind("/leave_group ", 0) == 0) {
+        c.command = Command::LeaveGroup;
+        c.target = legacy_trim(msg.substr(13));
+    } else if (msg.rfind("/group_msg ", 0) == 0) {
+        c.command = Command::GroupMsg;
+        size_t sp = msg.find(' ', 11);
+        if (sp != std::string::npos) {
+            c.target = legacy_trim(msg.substr(11, sp - 11));
+            c.body = legacy_trim(msg.substr(sp + 1));
+        }
+    }
+    return c;
+}
+
+template <typename Parse>
+void run_parser(const char* name, const std::vector<std::string>& lines, Parse parse) {
+    size_t commands = 0;
+    size_t sink = 0;
+    size_t before = allocations;
+    auto start = Clock::now();
+    double secs = 0;
+    do {
+        for (const auto& line : lines) {
+            sink += parse(std::string_view(line));
+        }
+        commands += lines.size();
+        secs = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (secs < BENCH_SECONDS);
+    double allocs = static_cast<double>(allocations - before) / commands;
+    sink_total += sink;
+    std::cout << std::setw(10) << name << std::setw(16) << std::fixed << std::setprecision(0) << commands / secs
+              << std::setw(14) << std::setprecision(2) << allocs << "\n";
+}
+
+void bench_parser() {
+    // The load generator's mix, with realistic message lengths
+    const std::string text(80, 't');
+    std::vector<std::string> lines;
+    for (int i = 0; i < 90; ++i) lines.push_back("/msg user" + std::to_string(i) + " " + text + "\n");
+    for (int i = 0; i < 9; ++i) lines.push_back("/group_msg CS425 " + text + "\n");
+    lines.push_back("/broadcast " + text + "\n");
+    lines.push_back("/join_group CS425\n");
+    lines.push_back("/nonsense here\n");
+
+    std::cout << "command parsing\n";
+    std::cout << std::setw(10) << "parser" << std::setw(16) << "commands/s" << std::setw(14) << "allocs/cmd" << "\n";
+    run_parser("legacy", lines, [](std::string_view l) {
+        LegacyCommand c = legacy_parse(l);
+        return static_cast<size_t>(c.command) + c.target.size() + c.body.size();
+    });
+    run_parser("view", lines, [](std::string_view l) {
+        ParsedCommand c = parse_command(l);
+        return static_cast<size_t>(c.command) + c.target.size() + c.body.size();
+    });
+}
+
+// ----------------- Cluster Placement -----------------
+// How evenly the hash ring spreads users, and how many change node when one
+// node is added, next to plain hash-mod-N placement.
+#define RING_USERS 200000
+
+std::vector<ClusterNode> ring_nodes(size_t n) {
+    std::vector<ClusterNode> nodes(n);
+    for (size_t i = 0; i < n; ++i) {
+        nodes[i].name = "node" + std::to_string(i);
+    }
+    return nodes;
+}
+
+void bench_ring() {
+    std::vector<std::string> users;
+    for (size_t i = 0; i < RING_USERS; ++i) {
+        users.push_back("load" + std::to_string(i));
+    }
+
+    std::cout << "cluster placement (" << RING_USERS << " users)\n";
+    std::cout << std::setw(6) << "nodes" << std::setw(12) << "max/mean" << std::setw(14) << "moved n->n+1"
+              << std::setw(10) << "ideal" << std::setw(12) << "mod-N moved" << std::setw(14) << "lookups/s" << "\n";
+    for (size_t n : {2, 3, 4, 8, 16, 32}) {
+        HashRing ring(ring_nodes(n));
+        HashRing grown(ring_nodes(n + 1));
+        std::vector<size_t> load(n);
+        size_t moved = 0, mod_moved = 0;
+        for (const std::string& u : users) {
+            size_t owner = ring.owner(u);
+            ++load[owner];
+            moved += grown.owner(u) != owner;
+            uint64_t h = ring_hash(u);
+            mod_moved += h % n != h % (n + 1);
+        }
+        double mean = static_cast<double>(RING_USERS) / n;
+        double max_load = *std::max_element(load.begin(), load.end());
+
+        size_t sink = 0;
+        auto start = Clock::now();
+        for (const std::string& u : users) {
+            sink += ring.owner(u);
+        }
+        double secs = std::chrono::duration<double>(Clock::now() - start).count();
+        sink_total += sink;
+
+        std::cout << std::setw(6) << n << std::setw(12) << std::fixed << std::setprecision(3) << max_load / mean
+                  << std::setw(13) << std::setprecision(1) << 100.0 * moved / RING_USERS << "%"
+                  << std::setw(9) << 100.0 / (n + 1) << "%"
+                  << std::setw(11) << 100.0 * mod_moved / RING_USERS << "%"
+                  << std::setw(14) << std::setprecision(0) << RING_USERS / secs << "\n";
+    }
+}
+
+// ----------------- Steady-State Allocations ----------
+// The server's per-message path end to end: frame commands out of a receive
+// ring, parse them, format each delivery once, queue it for local
+// recipients and post the rest to a second worker through its mailbox,
+// which queues them in turn; both sides then writev their queues to
+// /dev/null. Heap calls are counted on both threads once the pools are warm.
+#define ALLOC_WARMUP_ROUNDS 20000
+#define ALLOC_ROUNDS 200000
+#define ALLOC_QUEUES 16
+#define ALLOC_MAX_BACKLOG 64   // deliveries the second worker may lag by
+
+using BenchTargets = std::vector<uint64_t, PoolAllocator<uint64_t>>;
+
+struct BenchDelivery {
+    BenchTargets targets;
+    Payload payload;
+};
+
+struct BenchWorker {
+    OutboundQueue queues[ALLOC_QUEUES];
+    void flush(int fd) {
+        for (OutboundQueue& q : queues) q.flush(fd);
+    }
+};
+
+bool bench_alloc() {
+    const std::string text(80, 't');
+    std::string batch;
+    for (int i = 0; i < 12; ++i) batch += "/msg user" + std::to_string(i) + " " + text + "\n";
+    for (int i = 0; i < 3; ++i) batch += "/group_msg CS425 " + text + "\n";
+    batch += "/broadcast " + text + "\n";
+
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    MpscQueue<BenchDelivery> mailbox;
+    std::atomic<uint64_t> posted{0}, handled{0};
+    std::atomic<int> phase{0};   // 1: measuring, 2: done
+    std::atomic<size_t> remote_allocs{0};
+
+    std::thread remote([&] {
+        BenchWorker w;
+        BenchDelivery d;
+        size_t before = 0;
+        int seen = 0;
+        while (true) {
+            bool any = false;
+            while (mailbox.pop(d)) {
+                for (uint64_t id : d.targets) w.queues[id % ALLOC_QUEUES].push(d.payload, SIZE_MAX);
+                d.payload.reset();
+                any = true;
+                handled.fetch_add(1, std::memory_order_release);
+            }
+            if (any) w.flush(devnull);
+            int p = phase.load(std::memory_order_acquire);
+            if (p != seen) {
+                seen = p;
+                if (p == 2) break;
+                before = allocations;
+            }
+            if (!any) std::this_thread::yield();
+        }
+        remote_allocs = allocations - before;
+    });
+
+    BenchWorker w;
+    RingBuffer rb;
+    std::string scratch;
+    auto post = [&](size_t fanout, const Payload& payload) {
+        BenchDelivery d{BenchTargets(), payload};
+        for (size_t i = 0; i < fanout; ++i) d.targets.push_back(i);
+        mailbox.push(std::move(d));
+        posted.fetch_add(1, std::memory_order_relaxed);
+    };
+    auto round = [&] {
+        rb.reserve(batch.size(), 1 << 17);
+        struct iovec iov[2];
+        int cnt = rb.writable_iov(iov);
+        size_t first = std::min(batch.size(), iov[0].iov_len);
+        memcpy(iov[0].iov_base, batch.data(), first);
+        if (cnt == 2) memcpy(iov[1].iov_base, batch.data() + first, batch.size() - first);
+        rb.commit(batch.size());
+
+        std::string_view frame;
+        size_t consumed = 0;
+        size_t n = 0;
+        while (next_frame(rb, 4096, scratch, frame, consumed) == FrameStatus::Ready) {
+            ParsedCommand c = parse_command(frame);
+            if (c.command == Command::Msg) {
+                Payload p = concat_payload({"[ alice ]: ", c.body, "\n"});
+                if (n++ % 2) w.queues[n % ALLOC_QUEUES].push(p, SIZE_MAX);
+                else post(1, p);
+            } else if (c.command == Command::GroupMsg) {
+                Payload p = concat_payload({"[ Group ", c.target, " ]: ", c.body, "\n"});
+                for (size_t i = 0; i < 8; ++i) w.queues[i].push(p, SIZE_MAX);
+                post(8, p);
+            } else if (c.command == Command::Broadcast) {
+                Payload p = concat_payload({"[ alice ]: ", c.body, "\n"});
+                for (OutboundQueue& q : w.queues) q.push(p, SIZE_MAX);
+                post(ALLOC_QUEUES, p);
+            }
+            rb.consume(consumed);
+        }
+        w.flush(devnull);
+        while (posted.load(std::memory_order_relaxed) - handled.load(std::memory_order_acquire) > ALLOC_MAX_BACKLOG) {
+            std::this_thread::yield();
+        }
+    };
+    auto drain = [&] {
+        while (handled.load(std::memory_order_acquire) != posted.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    };
+
+    for (int i = 0; i < ALLOC_WARMUP_ROUNDS; ++i) round();
+    drain();
+    uint64_t slabs = pool_slabs();
+    phase.store(1, std::memory_order_release);
+    size_t before = allocations;
+    auto start = Clock::now();
+    for (int i = 0; i < ALLOC_ROUNDS; ++i) round();
+    drain();
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+    size_t local_allocs = allocations - before;
+    phase.store(2, std::memory_order_release);
+    remote.join();
+    close(devnull);
+
+    size_t messages = static_cast<size_t>(ALLOC_ROUNDS) * 16;
+    size_t total = local_allocs + remote_allocs;
+    std::cout << "steady-state allocations (" << messages << " messages, 2 workers)\n";
+    std::cout << std::setw(14) << "messages/s" << std::setw(14) << "allocs" << std::setw(14) << "new slabs" << "\n";
+    std::cout << std::setw(14) << std::fixed << std::setprecision(0) << messages / secs
+              << std::setw(14) << total << std::setw(14) << pool_slabs() - slabs << "\n";
+    if (total != 0) {
+        std::cout << "FAIL: the message path allocated " << total << " times\n";
+        return false;
+    }
+    return true;
+}
+
+// ----------------- Pool Thread Exit ------------------
+// A thread that exits hands its cached blocks to the depot, and the last
+// batch of a class is short whenever the cache held a count that is not a
+// multiple of POOL_BATCH: after freeing blocks another thread allocated,
+// or in the large classes whose slab has fewer blocks than a batch. Here
+// threads run one after another. Each frees the blocks the previous one
+// left it, allocates and frees at random, checks that every cached list is
+// as long as its count, then hands some blocks still in use to the next
+// thread and exits, passing its cache on through the depot. Every block
+// carries the stamp of its allocation, so one handed out twice shows up
+// when its first owner frees it.
+#define POOL_CHECK_THREADS 200
+#define POOL_CHECK_OPS 2000
+
+struct PoolCheckBlock {
+    uint64_t* p;
+    size_t n;
+    uint64_t stamp;
+};
+
+bool cache_counts_match() {
+    using namespace pool_detail;
+    for (size_t c = 0; c < POOL_CLASSES; ++c) {
+        size_t n = 0;
+        for (FreeBlock* b = cache.head[c]; b; b = b->next) ++n;
+        if (n != cache.count[c]) return false;
+    }
+    return true;
+}
+
+bool check_pool() {
+    const size_t sizes[] = {32, 48, 200, 1000, 20000};
+    std::vector<PoolCheckBlock> handed;   // from one thread to the next
+    uint64_t next_stamp = 0;
+    bool ok = true;
+    for (int t = 0; t < POOL_CHECK_THREADS && ok; ++t) {
+        std::thread([&, t] {
+            auto release = [&](const PoolCheckBlock& b) {
+                if (b.p[b.n / 8 - 1] != b.stamp) ok = false;
+                pool_deallocate(b.p, b.n);
+            };
+            for (const PoolCheckBlock& b : handed) release(b);
+            handed.clear();
+
+            std::mt19937 rng(t);
+            std::vector<PoolCheckBlock> live;
+            for (int i = 0; i < POOL_CHECK_OPS && ok; ++i) {
+                if (live.empty() || rng() % 3 != 0) {
+                    size_t n = sizes[rng() % 5];
+                    auto* p = static_cast<uint64_t*>(pool_allocate(n));
+                    p[n / 8 - 1] = ++next_stamp;
+                    live.push_back({p, n, next_stamp});
+                } else {
+                    size_t k = rng() % live.size();
+                    release(live[k]);
+                    live[k] = live.back();
+                    live.pop_back();
+                }
+                if (i % 50 == 0 && !cache_counts_match()) ok = false;
+            }
+            std::shuffle(live.begin(), live.end(), rng);
+            size_t keep = rng() % (live.size() + 1);
+            handed.assign(live.begin(), live.begin() + keep);
+            for (size_t i = keep; i < live.size(); ++i) release(live[i]);
+            if (!cache_counts_match()) ok = false;
+        }).join();
+    }
+    for (const PoolCheckBlock& b : handed) pool_deallocate(b.p, b.n);
+    std::cout << "pool thread exit (" << POOL_CHECK_THREADS << " threads, " << POOL_CHECK_OPS << " ops each): "
+              << (ok ? "ok" : "FAIL: a cache lost count of its blocks or handed one out twice") << "\n";
+    return ok;
+}
+
+// ----------------- Session Deadlines -----------------
+// One deadline per session, as the server keeps them: arm every session,
+// move every deadline once (activity pushing an idle timeout out), then run
+// the clock until all have fired. The wheel is next to a std::multimap
+// keyed by expiry, each session keeping its iterator to cancel with.
+#define TIMER_SPREAD_TICKS 6000   // deadlines fall within 60 s of 10 ms ticks
+
+struct TimerResult {
+    double arm_ns, rearm_ns, fire_ns, allocs;
+};
+
+TimerResult run_wheel(const std::vector<uint64_t>& first, const std::vector<uint64_t>& second) {
+    size_t n = first.size();
+    TimerWheel wheel;
+    std::vector<Timer> timers(n);
+    size_t before = allocations;
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        timers[i].id = i;
+        wheel.arm(timers[i], first[i]);
+    }
+    auto t1 = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        wheel.arm(timers[i], second[i]);
+    }
+    auto t2 = Clock::now();
+    size_t fired = 0;
+    wheel.advance(2 * TIMER_SPREAD_TICKS, [&](Timer& t) { fired += t.id != SIZE_MAX; });
+    auto t3 = Clock::now();
+    sink_total += fired;
+    auto ns = [n](auto a, auto b) { return std::chrono::duration<double, std::nano>(b - a).count() / n; };
+    return {ns(t0, t1), ns(t1, t2), ns(t2, t3), static_cast<double>(allocations - before) / (2 * n)};
+}
+
+TimerResult run_multimap(const std::vector<uint64_t>& first, const std::vector<uint64_t>& second) {
+    size_t n = first.size();
+    using Queue = std::multimap<uint64_t, size_t>;
+    Queue queue;
+    std::vector<Queue::iterator> handles(n);
+    size_t before = allocations;
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        handles[i] = queue.emplace(first[i], i);
+    }
+    auto t1 = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        queue.erase(handles[i]);
+        handles[i] = queue.emplace(second[i], i);
+    }
+    auto t2 = Clock::now();
+    size_t fired = 0;
+    for (uint64_t now = 1; now <= 2 * TIMER_SPREAD_TICKS; ++now) {
+        while (!queue.empty() && queue.begin()->first <= now) {
+            fired += queue.begin()->second != SIZE_MAX;
+            queue.erase(queue.begin());
+        }
+    }
+    auto t3 = Clock::now();
+    sink_total += fired;
+    auto ns = [n](auto a, auto b) { return std::chrono::duration<double, std::nano>(b - a).count() / n; };
+    return {ns(t0, t1), ns(t1, t2), ns(t2, t3), static_cast<double>(allocations - before) / (2 * n)};
+}
+
+void bench_timers() {
+    std::cout << "session deadlines (ns per timer)\n";
+    std::cout << std::setw(9) << "sessions" << std::setw(10) << "queue" << std::setw(10) << "arm"
+              << std::setw(10) << "re-arm" << std::setw(10) << "fire" << std::setw(12) << "allocs/arm" << "\n";
+    std::mt19937_64 rng(7);
+    for (size_t n : {10000, 100000, 1000000}) {
+        std::vector<uint64_t> first(n), second(n);
+        for (size_t i = 0; i < n; ++i) {
+            first[i] = 1 + rng() % TIMER_SPREAD_TICKS;
+            second[i] = first[i] + rng() % TIMER_SPREAD_TICKS;
+        }
+        for (int kind = 0; kind < 2; ++kind) {
+            TimerResult r = kind == 0 ? run_multimap(first, second) : run_wheel(first, second);
+            std::cout << std::setw(9) << n << std::setw(10) << (kind == 0 ? "multimap" : "wheel")
+                      << std::setw(10) << std::fixed << std::setprecision(1) << r.arm_ns
+                      << std::setw(10) << r.rearm_ns << std::setw(10) << r.fire_ns
+                      << std::setw(12) << std::setprecision(2) << r.allocs << "\n";
+        }
+    }
+}
+
+// ----------------- Main -------------------------------
+int main(int argc, char* argv[]) {
+    std::string which = argc > 1 ? argv[1] : "all";
+    bool all = which == "all";
+
+    if (all || which == "registry") bench_registry();
+    if (all || which == "fanout") bench_fanout();
+    if (all || which == "members") bench_members();
+    if (all || which == "limits") bench_limits();
+    if (all || which == "compress") bench_compress();
+    if (all || which == "parser") bench_parser();
+    if (all || which == "ring") bench_ring();
+    if (all || which == "timers") bench_timers();
+    if ((all || which == "alloc") && !bench_alloc()) return 1;
+    if ((all || which == "pool") && !check_pool()) return 1;
+    return 0;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "lz.h"
+
+// ----------------- Client Handshake -----------------
+// Connection and login steps shared by the interactive client and the load
+// generator. The server frames input by newline, so every line sent ends
+// with '\n'.
+
+#define CHAT_PORT 12345
+
+inline int connect_to_server(const char* host, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    sockaddr_in server_address{};
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    server_address.sin_addr.s_addr = inet_addr(host);
+    if (connect(sock, (sockaddr*)&server_address, sizeof(server_address)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Receives until marker has arrived; out gets everything read. False if the
+// server closed the connection first.
+inline bool read_until(int sock, const std::string& marker, std::string& out) {
+    out.clear();
+    char buffer[1024];
+    while (out.find(marker) == std::string::npos) {
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return false;
+        }
+        out.append(buffer, n);
+    }
+    return true;
+}
+
+inline bool send_line(int sock, std::string line) {
+    line += '\n';
+    size_t off = 0;
+    while (off < line.size()) {
+        ssize_t n = send(sock, line.data() + off, line.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+// Server prompts, in the order the login handshake sends them.
+const char* const USERNAME_PROMPT = "Enter username : ";
+const char* const PASSWORD_PROMPT = "Enter password : ";
+const char* const AUTH_FAILED = "Authentication failed";
+// Sent instead of the password prompt by a cluster node that is not the
+// user's home: "Connect to HOST:PORT ."
+const char* const REDIRECT = "Connect to ";
+#define MAX_REDIRECTS 4
+// Sent by a server with heartbeats on to a client that has been silent;
+// the client answers PONG, which the server takes as a sign of life.
+const char* const HEARTBEAT = "PING .\n";
+const char* const PONG = "/pong";
+// Asks for large messages as compressed frames; see LzInflater in lz.h.
+const char* const COMPRESS_ON = "/compress on";
+
+// Parses a redirect out of reply; false if it holds none.
+inline bool parse_redirect(const std::string& reply, std::string& host, int& port) {
+    size_t at = reply.find(REDIRECT);
+    if (at == std::string::npos) {
+        return false;
+    }
+    at += strlen(REDIRECT);
+    size_t colon = reply.find(':', at);
+    size_t end = reply.find(' ', colon);
+    if (colon == std::string::npos || end == std::string::npos) {
+        return false;
+    }
+    host = reply.substr(at, colon - at);
+    port = atoi(reply.c_str() + colon + 1);
+    return port > 0;
+}
+
+// Removes heartbeat lines from received text; returns how many there were.
+// A heartbeat split across two reads is left in place.
+inline size_t strip_heartbeats(std::string& text) {
+    size_t count = 0;
+    size_t len = strlen(HEARTBEAT);
+    size_t at = 0;
+    while ((at = text.find(HEARTBEAT, at)) != std::string::npos) {
+        if (at > 0 && text[at - 1] != '\n') {
+            at += len;
+            continue;
+        }
+        text.erase(at, len);
+        ++count;
+    }
+    return count;
+}
+
+// Connects and sends username, following redirects to the user's home node.
+// Returns the socket with the password prompt in reply, or -1.
+inline int connect_as(std::string host, int port, const std::string& username, std::string& reply) {
+    for (int hop = 0; hop <= MAX_REDIRECTS; ++hop) {
+        int sock = connect_to_server(host.c_str(), port);
+        if (sock < 0) {
+            return -1;
+        }
+        if (!read_until(sock, USERNAME_PROMPT, reply) || !send_line(sock, username)) {
+            close(sock);
+            return -1;
+        }
+        // Either the prompt or a redirect line, and the server then closes
+        if (read_until(sock, PASSWORD_PROMPT, reply)) {
+            return sock;
+        }
+        close(sock);
+        if (!parse_redirect(reply, host, port)) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Finishes the handshake after the password prompt. reply receives the
+// server's answer ("Welcome ..." or "Authentication failed .").
+inline bool send_password(int sock, const std::string& password, std::string& reply) {
+    if (!send_line(sock, password) || !read_until(sock, "\n", reply)) {
+        return false;
+    }
+    return reply.find(AUTH_FAILED) == std::string::npos;
+}
+
+// Runs the whole handshake non-interactively, following redirects. Returns
+// the logged-in socket or -1.
+inline int connect_and_login(const std::string& host, int port, const std::string& username,
+                             const std::string& password, std::string& reply) {
+    int sock = connect_as(host, port, username, reply);
+    if (sock < 0) {
+        return -1;
+    }
+    if (!send_password(sock, password, reply)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
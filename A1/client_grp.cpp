@@ -13,12 +13,15 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 
+#include "chat_client.h"
+
 #define BUFFER_SIZE 1024
 
 std::mutex cout_mutex;
 
 void handle_server_messages(int server_socket) {
     char buffer[BUFFER_SIZE];
+    LzInflater inflater;   // expands the compressed frames asked for at login
     while (true) {
         memset(buffer, 0, BUFFER_SIZE);
         int bytes_received = recv(server_socket, buffer, BUFFER_SIZE, 0);
@@ -28,59 +31,75 @@ void handle_server_messages(int server_socket) {
             close(server_socket);
             exit(0);
         }
+        std::string text;
+        if (!inflater.feed(buffer, bytes_received, text)) {
+            std::lock_guard<std::mutex> lock(cout_mutex);
+            std::cout << "Corrupt data from server." << std::endl;
+            close(server_socket);
+            exit(1);
+        }
+        for (size_t n = strip_heartbeats(text); n > 0; --n) {
+            send_line(server_socket, PONG);
+        }
+        if (text.empty()) {
+            continue;
+        }
         std::lock_guard<std::mutex> lock(cout_mutex);
-        std::cout << buffer << std::endl;
+        std::cout << text << std::endl;
     }
 }
 
-int main() {
-    int client_socket;
-    sockaddr_in server_address{};
-
-    client_socket = socket(AF_INET, SOCK_STREAM, 0);
+// Usage: ./client_grp [HOST [PORT]]
+int main(int argc, char* argv[]) {
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : CHAT_PORT;
+    int client_socket = connect_to_server(host.c_str(), port);
     if (client_socket < 0) {
-        std::cerr << "Error creating socket." << std::endl;
-        return 1;
-    }
-
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(12345);
-    server_address.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-    if (connect(client_socket, (sockaddr*)&server_address, sizeof(server_address)) < 0) {
         std::cerr << "Error connecting to server." << std::endl;
         return 1;
     }
 
     std::cout << "Connected to the server." << std::endl;
 
-    // Authentication
-    std::string username, password;
-    char buffer[BUFFER_SIZE];
+    // Authentication: same handshake as connect_and_login() in chat_client.h,
+    // with the prompts shown and the answers read from the terminal
+    std::string username, password, reply;
 
-    memset(buffer, 0, BUFFER_SIZE);
-    recv(client_socket, buffer, BUFFER_SIZE, 0); // Receive the message "Enter the user name" for the server
-    // You should have a line like this in the server.cpp code: send_message(client_socket, "Enter username: ");
- 
-    std::cout << buffer;
+    if (!read_until(client_socket, USERNAME_PROMPT, reply)) {
+        std::cerr << "Disconnected from server." << std::endl;
+        return 1;
+    }
+    std::cout << reply;
     std::getline(std::cin, username);
-    send(client_socket, username.c_str(), username.size(), 0);
+    send_line(client_socket, username);
 
-    memset(buffer, 0, BUFFER_SIZE);
-    recv(client_socket, buffer, BUFFER_SIZE, 0); // Receive the message "Enter the password" for the server
-    std::cout << buffer;
+    if (!read_until(client_socket, PASSWORD_PROMPT, reply)) {
+        // A cluster node sends users to their home node
+        close(client_socket);
+        if (!parse_redirect(reply, host, port)) {
+            std::cerr << "Disconnected from server." << std::endl;
+            return 1;
+        }
+        std::cout << "Redirected to " << host << ":" << port << std::endl;
+        client_socket = connect_as(host, port, username, reply);
+        if (client_socket < 0) {
+            std::cerr << "Error connecting to server." << std::endl;
+            return 1;
+        }
+    }
+    std::cout << reply;
     std::getline(std::cin, password);
-    send(client_socket, password.c_str(), password.size(), 0);
 
-    memset(buffer, 0, BUFFER_SIZE);
     // Depending on whether the authentication passes or not, receive the message "Authentication Failed" or "Welcome to the server"
-    recv(client_socket, buffer, BUFFER_SIZE, 0); 
-    std::cout << buffer << std::endl;
-
-    if (std::string(buffer).find("Authentication failed") != std::string::npos) {
+    if (!send_password(client_socket, password, reply)) {
+        std::cout << reply << std::endl;
         close(client_socket);
         return 1;
     }
+    std::cout << reply << std::endl;
+
+    // Large messages may now arrive compressed
+    send_line(client_socket, COMPRESS_ON);
 
     // Start thread for receiving messages from server
     std::thread receive_thread(handle_server_messages, client_socket);
@@ -94,7 +113,7 @@ int main() {
 
         if (message.empty()) continue;
 
-        send(client_socket, message.c_str(), message.size(), 0);
+        send_line(client_socket, message);
 
         if (message == "/exit") {
             close(client_socket);
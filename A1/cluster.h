@@ -0,0 +1,879 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "framing.h"
+#include "metrics.h"
+#include "mpsc.h"
+#include "outbound.h"
+#include "payload.h"
+
+#define CLUSTER_VNODES 160              // ring points per node
+#define CLUSTER_MAX_NODES 64            // node sets are 64-bit masks
+#define CLUSTER_MAX_BATCH (1u << 20)    // record bytes per batch frame
+#define CLUSTER_RX_CAPACITY (4u << 20)  // power of two, holds a max batch
+#define CLUSTER_INLINE_BODY 512         // larger bodies go out by reference
+#define CLUSTER_OUT_BUDGET (64u << 20)  // unsent bytes before a link is reset
+#define CLUSTER_BACKLOG (16u << 20)     // message bytes held for a link that is down
+#define CLUSTER_RETRY_MS 500
+
+// ----------------- Membership -----------------------
+// A cluster file lists every node, one per line:
+//   name host chat_port cluster_port
+// Blank lines and lines starting with '#' are ignored. All nodes read the
+// same file; --node picks which line is this process.
+struct ClusterNode {
+    std::string name;
+    std::string host;
+    int chat_port = 0;
+    int cluster_port = 0;
+};
+
+inline bool load_cluster_file(const std::string& path, std::vector<ClusterNode>& nodes, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+    nodes.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream in(line);
+        ClusterNode n;
+        if (!(in >> n.name) || n.name[0] == '#') {
+            continue;
+        }
+        if (!(in >> n.host >> n.chat_port >> n.cluster_port)) {
+            error = "malformed line: " + line;
+            return false;
+        }
+        for (const ClusterNode& other : nodes) {
+            if (other.name == n.name) {
+                error = "duplicate node " + n.name;
+                return false;
+            }
+        }
+        nodes.push_back(std::move(n));
+    }
+    if (nodes.empty() || nodes.size() > CLUSTER_MAX_NODES) {
+        error = "a cluster has 1 to " + std::to_string(CLUSTER_MAX_NODES) + " nodes";
+        return false;
+    }
+    return true;
+}
+
+// ----------------- Hash Ring ------------------------
+// FNV-1a finished with the splitmix64 mixer: FNV alone leaves short,
+// similar names (user1, user2, ...) clustered on the ring.
+inline uint64_t ring_hash(std::string_view s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+// Consistent hashing with CLUSTER_VNODES points per node. A user belongs to
+// the first point at or after its hash, so adding a node takes over only
+// the arcs in front of its own points: about 1/(N+1) of the users move, all
+// of them to the new node.
+class HashRing {
+public:
+    HashRing() = default;
+    explicit HashRing(const std::vector<ClusterNode>& nodes) {
+        points_.reserve(nodes.size() * CLUSTER_VNODES);
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            for (unsigned v = 0; v < CLUSTER_VNODES; ++v) {
+                points_.push_back({ring_hash(nodes[i].name + "#" + std::to_string(v)), i});
+            }
+        }
+        std::sort(points_.begin(), points_.end());
+    }
+
+    // Index of the node that owns key.
+    size_t owner(std::string_view key) const {
+        auto it = std::lower_bound(points_.begin(), points_.end(), std::make_pair(ring_hash(key), uint32_t(0)));
+        return it == points_.end() ? points_.front().second : it->second;
+    }
+
+private:
+    std::vector<std::pair<uint64_t, uint32_t>> points_;
+};
+
+// ----------------- Link Protocol --------------------
+// Each node keeps one outbound TCP link to every other node and sends all
+// of its records for that node over it; it only reads from the links peers
+// opened to it. Records travel in batch frames:
+//   [u32 bytes][u32 count] then count records of
+//   [u8 type][u16 key length][u32 body length][key][body]
+// all integers big-endian. The first record on a link is Hello, naming the
+// sender.
+enum class LinkRecord : uint8_t {
+    Hello = 1,          // key: node name
+    Join,               // key: user, body: non-empty to announce ("" in a snapshot)
+    Leave,              // key: user, body: non-empty to announce
+    Broadcast,          // body: "Broadcast: ...\n"
+    Direct,             // key: recipient, body: "[ sender ]: ...\n"
+    GroupCreate,        // key: group
+    GroupSubscribe,     // key: group; the sender has members
+    GroupUnsubscribe,   // key: group; the sender has none left
+    GroupMessage        // key: group, body: "[ Group g ]: ...\n"
+};
+
+// Broadcast, Direct and GroupMessage carry what users sent and are held
+// across an outage; the rest is state the snapshot on reconnect rebuilds.
+inline bool is_message_record(LinkRecord type) {
+    return type == LinkRecord::Broadcast || type == LinkRecord::Direct || type == LinkRecord::GroupMessage;
+}
+
+constexpr size_t LINK_BATCH_HEADER = 8;
+constexpr size_t LINK_RECORD_HEADER = 7;
+
+inline void put_be(std::string& out, uint32_t v, int bytes) {
+    for (int shift = 8 * (bytes - 1); shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((v >> shift) & 0xff));
+    }
+}
+
+inline uint32_t get_be(const char* p, int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; ++i) {
+        v = (v << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return v;
+}
+
+// Calls f(type, key, body) for each record of a batch's record bytes.
+// Returns false if the batch is malformed.
+template <typename F>
+bool parse_link_batch(std::string_view records, uint32_t count, F&& f) {
+    for (uint32_t i = 0; i < count; ++i) {
+        if (records.size() < LINK_RECORD_HEADER) {
+            return false;
+        }
+        auto type = static_cast<LinkRecord>(records[0]);
+        size_t key_len = get_be(records.data() + 1, 2);
+        size_t body_len = get_be(records.data() + 3, 4);
+        if (records.size() - LINK_RECORD_HEADER < key_len + body_len) {
+            return false;
+        }
+        std::string_view key = records.substr(LINK_RECORD_HEADER, key_len);
+        std::string_view body = records.substr(LINK_RECORD_HEADER + key_len, body_len);
+        f(type, key, body);
+        records.remove_prefix(LINK_RECORD_HEADER + key_len + body_len);
+    }
+    return records.empty();
+}
+
+// ----------------- Cluster --------------------------
+struct LinkMessage {
+    LinkRecord type = LinkRecord::Hello;
+    std::string key;
+    Payload body;   // may be null
+};
+
+// Everything queued for one peer. Any thread may push; the link thread
+// drains it into batch frames.
+struct Link {
+    ClusterNode node;
+    size_t index = 0;
+    MpscQueue<LinkMessage> outbox;
+
+    // Link thread only: messages waiting for the link to come up, oldest
+    // first, at most CLUSTER_BACKLOG bytes of them.
+    std::vector<LinkMessage> backlog;
+    size_t backlog_bytes = 0;
+};
+
+// Immutable view of the membership. Workers load it once per routing
+// decision; a reload replaces it as a whole.
+struct Topology {
+    std::vector<ClusterNode> nodes;
+    size_t self = 0;
+    HashRing ring;
+    std::vector<std::shared_ptr<Link>> links;   // by node index; null for self
+
+    size_t owner(std::string_view user) const { return ring.owner(user); }
+    bool is_local(std::string_view user) const { return owner(user) == self; }
+};
+
+// Runs every inter-node link on one thread with its own epoll loop. Records
+// pushed by any worker are coalesced: each wakeup drains whole outboxes into
+// as few batch frames as fit, written with one writev per link.
+class Cluster {
+public:
+    // All run on the link thread.
+    struct Callbacks {
+        std::function<void()> on_start;
+        std::function<void(size_t peer)> on_link_up;       // queue a snapshot for peer
+        std::function<void(size_t peer)> on_peer_lost;     // forget what peer told us
+        std::function<void(size_t peer, LinkRecord, std::string_view key, std::string_view body)> on_record;
+        std::function<void()> on_topology;                 // a reload took effect
+    };
+
+    Counter records_sent;
+    Counter batches_sent;
+    Counter bytes_sent;
+    Counter records_received;
+    Counter records_held;       // messages kept for a peer while its link was down
+    Counter records_dropped;    // superseded by a snapshot, or past the backlog
+    Gauge links_up;
+
+    ~Cluster() {
+        for (auto& [id, c] : conns_) {
+            close(c->fd);
+        }
+        if (listen_fd_ >= 0) close(listen_fd_);
+        if (wake_fd_ >= 0) close(wake_fd_);
+        if (epoll_fd_ >= 0) close(epoll_fd_);
+    }
+
+    // Reads the cluster file and binds this node's cluster port. The link
+    // thread starts with run().
+    bool open(const std::string& path, const std::string& self_name, Callbacks cb, std::string& error) {
+        path_ = path;
+        self_name_ = self_name;
+        cb_ = std::move(cb);
+        auto topo = load(error);
+        if (!topo) {
+            return false;
+        }
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (epoll_fd_ < 0 || wake_fd_ < 0 || listen_fd_ < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        int opt = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(topo->nodes[topo->self].cluster_port);
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, SOMAXCONN) < 0) {
+            error = std::string("cluster port: ") + strerror(errno);
+            return false;
+        }
+        add_fd(listen_fd_, LISTEN_ID, EPOLLIN);
+        add_fd(wake_fd_, WAKE_ID, EPOLLIN);
+        topology_.store(std::move(topo));
+        return true;
+    }
+
+    std::shared_ptr<const Topology> topology() const { return topology_.load(); }
+
+    // Re-reads the cluster file; the link thread swaps it in, reconnects
+    // every link and calls on_topology. Any thread.
+    bool reload(std::string& error) {
+        auto topo = load(error);
+        if (!topo) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(reload_mu_);
+            pending_ = std::move(topo);
+        }
+        wake();
+        return true;
+    }
+
+    // Queues a record for peer in t. Any thread; never blocks.
+    void send(const Topology& t, size_t peer, LinkRecord type, std::string_view key, Payload body) {
+        if (peer >= t.links.size() || !t.links[peer]) {
+            return;
+        }
+        t.links[peer]->outbox.push(LinkMessage{type, std::string(key), std::move(body)});
+        wake();
+    }
+
+    void send_all(const Topology& t, LinkRecord type, std::string_view key, const Payload& body) {
+        for (const auto& link : t.links) {
+            if (link) {
+                link->outbox.push(LinkMessage{type, std::string(key), body});
+            }
+        }
+        wake();
+    }
+
+    void run() {
+        if (cb_.on_start) {
+            cb_.on_start();
+        }
+        dial_all();
+        epoll_event events[64];
+        while (true) {
+            int n = epoll_wait(epoll_fd_, events, 64, next_timeout_ms());
+            if (n < 0 && errno != EINTR) {
+                return;
+            }
+            for (int i = 0; i < n; ++i) {
+                uint64_t id = events[i].data.u64;
+                if (id == LISTEN_ID) {
+                    accept_links();
+                } else if (id == WAKE_ID) {
+                    uint64_t count;
+                    ssize_t rc = read(wake_fd_, &count, sizeof(count));
+                    (void)rc;
+                    wake_pending_.store(false, std::memory_order_release);
+                    apply_reload();
+                } else {
+                    auto it = conns_.find(id);
+                    if (it != conns_.end()) {
+                        handle_io(*it->second, events[i].events);
+                    }
+                }
+            }
+            retry_links();
+            drain_outboxes();
+            reap();
+        }
+    }
+
+private:
+    static constexpr uint64_t LISTEN_ID = 1;
+    static constexpr uint64_t WAKE_ID = 2;
+
+    using Clock = std::chrono::steady_clock;
+
+    // A message record an outbound link has queued, kept until the socket
+    // has taken all of its batch frame.
+    struct Unwritten {
+        uint64_t end;   // Conn::queued once its frame was queued
+        LinkMessage msg;
+    };
+
+    struct Conn {
+        uint64_t id = 0;
+        int fd = -1;
+        bool outbound = false;
+        bool connecting = false;
+        bool closing = false;
+        std::shared_ptr<Link> link;   // null on an inbound link before Hello
+        RingBuffer inbuf;
+        OutboundQueue outq;
+        uint64_t queued = 0;          // bytes ever pushed to outq
+        uint64_t written = 0;         // of those, bytes the socket took
+        std::deque<Unwritten> unwritten;   // oldest first
+    };
+
+    std::shared_ptr<const Topology> load(std::string& error) const {
+        auto topo = std::make_shared<Topology>();
+        if (!load_cluster_file(path_, topo->nodes, error)) {
+            return nullptr;
+        }
+        auto self = std::find_if(topo->nodes.begin(), topo->nodes.end(),
+                                 [&](const ClusterNode& n) { return n.name == self_name_; });
+        if (self == topo->nodes.end()) {
+            error = "node " + self_name_ + " is not in " + path_;
+            return nullptr;
+        }
+        topo->self = self - topo->nodes.begin();
+        topo->ring = HashRing(topo->nodes);
+        topo->links.resize(topo->nodes.size());
+        for (size_t i = 0; i < topo->nodes.size(); ++i) {
+            if (i != topo->self) {
+                topo->links[i] = std::make_shared<Link>();
+                topo->links[i]->node = topo->nodes[i];
+                topo->links[i]->index = i;
+            }
+        }
+        return topo;
+    }
+
+    void wake() {
+        if (!wake_pending_.exchange(true, std::memory_order_acq_rel)) {
+            uint64_t one = 1;
+            ssize_t rc = write(wake_fd_, &one, sizeof(one));
+            (void)rc;
+        }
+    }
+
+    void add_fd(int fd, uint64_t id, uint32_t events) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = id;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    // Everything reconnects against the new membership. Peers rebuild what
+    // they know about us from the snapshot on_link_up queues.
+    void apply_reload() {
+        std::shared_ptr<const Topology> next;
+        {
+            std::lock_guard<std::mutex> lock(reload_mu_);
+            next = std::move(pending_);
+        }
+        if (!next) {
+            return;
+        }
+        for (auto& [id, c] : conns_) {
+            close_conn(*c);
+        }
+        reap();
+        // Messages held for a node that stays in the cluster wait for its
+        // new link; the rest is state the new links resend anyway
+        auto prev = topology_.load();
+        for (const auto& old : prev->links) {
+            if (!old) {
+                continue;
+            }
+            std::shared_ptr<Link> link;
+            for (const auto& l : next->links) {
+                if (l && l->node.name == old->node.name) {
+                    link = l;
+                }
+            }
+            if (!link) {
+                records_dropped.add(old->backlog.size());
+                continue;
+            }
+            for (LinkMessage& m : old->backlog) {
+                hold(*link, std::move(m));
+            }
+            LinkMessage m;
+            while (old->outbox.pop(m)) {
+                hold(*link, std::move(m));
+            }
+        }
+        topology_.store(next);
+        if (cb_.on_topology) {
+            cb_.on_topology();
+        }
+        dial_all();
+    }
+
+    void dial_all() {
+        auto topo = topology_.load();
+        out_conn_.assign(topo->nodes.size(), 0);
+        retry_at_.assign(topo->nodes.size(), Clock::now());
+        retry_links();
+    }
+
+    int next_timeout_ms() const {
+        auto now = Clock::now();
+        size_t self = topology_.load()->self;
+        int best = -1;
+        for (size_t i = 0; i < retry_at_.size(); ++i) {
+            if (out_conn_[i] == 0 && i != self) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(retry_at_[i] - now).count();
+                int wait = static_cast<int>(std::max<int64_t>(ms, 0));
+                best = best < 0 ? wait : std::min(best, wait);
+            }
+        }
+        return best;
+    }
+
+    void retry_links() {
+        auto topo = topology_.load();
+        auto now = Clock::now();
+        for (size_t i = 0; i < topo->links.size(); ++i) {
+            if (topo->links[i] && out_conn_[i] == 0 && retry_at_[i] <= now) {
+                dial(topo->links[i]);
+            }
+        }
+    }
+
+    void dial(const std::shared_ptr<Link>& link) {
+        retry_at_[link->index] = Clock::now() + std::chrono::milliseconds(CLUSTER_RETRY_MS);
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return;
+        }
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(link->node.cluster_port);
+        if (inet_pton(AF_INET, link->node.host.c_str(), &addr.sin_addr) != 1 ||
+            (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)) {
+            close(fd);
+            return;
+        }
+        Conn& c = add_conn(fd, true);
+        c.connecting = true;
+        c.link = link;
+        out_conn_[link->index] = c.id;
+    }
+
+    Conn& add_conn(int fd, bool outbound) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        auto c = std::make_unique<Conn>();
+        c->id = ++next_id_;
+        c->fd = fd;
+        c->outbound = outbound;
+        add_fd(fd, c->id, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        Conn& ref = *c;
+        conns_[c->id] = std::move(c);
+        return ref;
+    }
+
+    void accept_links() {
+        while (true) {
+            int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return;
+            }
+            add_conn(fd, false);
+        }
+    }
+
+    void handle_io(Conn& c, uint32_t events) {
+        if (c.connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+                close_conn(c);
+                return;
+            }
+            c.connecting = false;
+            links_up.add(1);
+            auto topo = topology_.load();
+            // Held messages go first, right after Hello; state queued while
+            // the link was down is covered by the snapshot on_link_up queues
+            Link& link = *c.link;
+            LinkMessage stale;
+            while (link.outbox.pop(stale)) {
+                hold(link, std::move(stale));
+            }
+            std::vector<LinkMessage> first;
+            first.reserve(link.backlog.size() + 1);
+            first.push_back(LinkMessage{LinkRecord::Hello, topo->nodes[topo->self].name, nullptr});
+            std::move(link.backlog.begin(), link.backlog.end(), std::back_inserter(first));
+            link.backlog.clear();
+            link.backlog_bytes = 0;
+            queue_batch(c, first);
+            if (cb_.on_link_up) {
+                cb_.on_link_up(c.link->index);
+            }
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            read_links(c);
+        }
+        if (!c.closing && !c.connecting && (events & EPOLLOUT)) {
+            flush(c);
+        }
+    }
+
+    // Outbound links only ever carry our records; reading them just
+    // notices the peer going away.
+    void read_links(Conn& c) {
+        while (!c.closing) {
+            if (!c.inbuf.reserve(64 * 1024, CLUSTER_RX_CAPACITY)) {
+                close_conn(c);
+                return;
+            }
+            struct iovec iov[2];
+            int cnt = c.inbuf.writable_iov(iov);
+            ssize_t n = readv(c.fd, iov, cnt);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) close_conn(c);
+                return;
+            }
+            if (n == 0) {
+                close_conn(c);
+                return;
+            }
+            c.inbuf.commit(n);
+            if (c.outbound) {
+                c.inbuf.consume(c.inbuf.size());
+            } else {
+                parse_batches(c);
+            }
+        }
+    }
+
+    void parse_batches(Conn& c) {
+        while (!c.closing && c.inbuf.size() >= LINK_BATCH_HEADER) {
+            char header[LINK_BATCH_HEADER];
+            for (size_t i = 0; i < LINK_BATCH_HEADER; ++i) {
+                header[i] = c.inbuf.at(i);
+            }
+            uint32_t bytes = get_be(header, 4);
+            uint32_t count = get_be(header + 4, 4);
+            if (bytes > CLUSTER_MAX_BATCH) {
+                close_conn(c);
+                return;
+            }
+            if (c.inbuf.size() < LINK_BATCH_HEADER + bytes) {
+                return;
+            }
+            std::string_view records = c.inbuf.view(LINK_BATCH_HEADER, bytes, scratch_);
+            bool ok = parse_link_batch(records, count, [&](LinkRecord type, std::string_view key, std::string_view body) {
+                if (c.closing) {
+                    return;
+                }
+                records_received.add();
+                if (type == LinkRecord::Hello) {
+                    hello(c, key);
+                } else if (c.link && cb_.on_record) {
+                    cb_.on_record(c.link->index, type, key, body);
+                }
+            });
+            if (!ok) {
+                close_conn(c);
+                return;
+            }
+            c.inbuf.consume(LINK_BATCH_HEADER + bytes);
+        }
+        c.inbuf.shrink();
+    }
+
+    // Binds an inbound link to the peer it names. A peer that restarted
+    // reaches us on a new connection before we notice the old one closing;
+    // what the old one told us is dropped now, before the new snapshot.
+    void hello(Conn& c, std::string_view name) {
+        auto topo = topology_.load();
+        for (const auto& link : topo->links) {
+            if (link && link->node.name == name) {
+                for (auto& [id, other] : conns_) {
+                    if (other.get() != &c && !other->outbound && other->link == link) {
+                        other->link = nullptr;
+                        close_conn(*other);
+                        if (cb_.on_peer_lost) {
+                            cb_.on_peer_lost(link->index);
+                        }
+                    }
+                }
+                c.link = link;
+                return;
+            }
+        }
+        close_conn(c);
+    }
+
+    // Appends msgs to c's queue as batch frames. Small bodies are copied
+    // into the frame; larger ones are queued by reference. Message records
+    // move to c.unwritten.
+    void queue_batch(Conn& c, std::vector<LinkMessage>& msgs) {
+        size_t i = 0;
+        while (i < msgs.size()) {
+            std::vector<Payload> parts;
+            std::string seg;
+            uint32_t bytes = 0;
+            uint32_t count = 0;
+            size_t first = i;
+            for (; i < msgs.size() && (count == 0 || bytes < CLUSTER_MAX_BATCH / 2); ++i) {
+                LinkMessage& m = msgs[i];
+                size_t body_len = m.body ? m.body->size() : 0;
+                size_t key_len = std::min<size_t>(m.key.size(), UINT16_MAX);
+                if (LINK_RECORD_HEADER + key_len + body_len > CLUSTER_MAX_BATCH / 2) {
+                    records_dropped.add();   // larger than any message a client can send
+                    continue;
+                }
+                seg.push_back(static_cast<char>(m.type));
+                put_be(seg, key_len, 2);
+                put_be(seg, body_len, 4);
+                seg.append(m.key, 0, key_len);
+                if (body_len <= CLUSTER_INLINE_BODY) {
+                    if (body_len) seg.append(m.body->view());
+                } else {
+                    parts.push_back(make_payload(std::move(seg)));
+                    parts.push_back(m.body);
+                    seg.clear();
+                }
+                bytes += LINK_RECORD_HEADER + key_len + body_len;
+                ++count;
+            }
+            if (count == 0) {
+                continue;
+            }
+            parts.push_back(make_payload(std::move(seg)));
+            std::string header;
+            put_be(header, bytes, 4);
+            put_be(header, count, 4);
+            bool ok = c.outq.push(make_payload(std::move(header)), CLUSTER_OUT_BUDGET);
+            for (Payload& p : parts) {
+                ok = ok && c.outq.push(std::move(p), CLUSTER_OUT_BUDGET);
+            }
+            c.queued += LINK_BATCH_HEADER + bytes;
+            for (; first < i; ++first) {
+                if (is_message_record(msgs[first].type)) {
+                    c.unwritten.push_back(Unwritten{c.queued, std::move(msgs[first])});
+                }
+            }
+            if (!ok) {
+                // The peer stopped reading; reconnecting resyncs it. None of
+                // the rest was queued, so reap() holds it with the unwritten.
+                for (; i < msgs.size(); ++i) {
+                    if (is_message_record(msgs[i].type)) {
+                        c.unwritten.push_back(Unwritten{UINT64_MAX, std::move(msgs[i])});
+                    }
+                }
+                close_conn(c);
+                return;
+            }
+            records_sent.add(count);
+            batches_sent.add();
+        }
+    }
+
+    void drain_outboxes() {
+        auto topo = topology_.load();
+        for (const auto& link : topo->links) {
+            if (!link) {
+                continue;
+            }
+            batch_.clear();
+            LinkMessage m;
+            while (link->outbox.pop(m)) {
+                batch_.push_back(std::move(m));
+            }
+            if (batch_.empty()) {
+                continue;
+            }
+            auto it = conns_.find(out_conn_[link->index]);
+            if (it == conns_.end() || it->second->connecting || it->second->closing) {
+                for (LinkMessage& held : batch_) {
+                    hold(*link, std::move(held));
+                }
+                continue;
+            }
+            queue_batch(*it->second, batch_);
+            flush(*it->second);
+        }
+        batch_.clear();
+    }
+
+    // Keeps a message for link until it comes up again. State records are
+    // dropped: the snapshot sent on reconnect supersedes them.
+    void hold(Link& link, LinkMessage&& m) {
+        size_t bytes = m.key.size() + (m.body ? m.body->size() : 0);
+        if (!is_message_record(m.type) || link.backlog_bytes + bytes > CLUSTER_BACKLOG) {
+            records_dropped.add();
+            return;
+        }
+        link.backlog.push_back(std::move(m));
+        link.backlog_bytes += bytes;
+        records_held.add();
+    }
+
+    void flush(Conn& c) {
+        if (c.closing) {
+            return;
+        }
+        size_t before = c.outq.bytes();
+        if (!c.outq.flush(c.fd)) {
+            close_conn(c);
+            return;
+        }
+        bytes_sent.add(before - c.outq.bytes());
+        c.written += before - c.outq.bytes();
+        while (!c.unwritten.empty() && c.unwritten.front().end <= c.written) {
+            c.unwritten.pop_front();
+        }
+    }
+
+    // Called as a failed outbound conn goes: messages its socket never took
+    // go back in front of the link's backlog, for the next link. What the
+    // socket did take is not sent again, since the peer may have it; a
+    // message caught in the kernel's buffers when a link fails is lost, so
+    // delivery across a failure is at most once.
+    void requeue_unwritten(Conn& c) {
+        if (c.unwritten.empty()) {
+            return;
+        }
+        Link& link = *c.link;
+        std::vector<LinkMessage> newer;
+        newer.swap(link.backlog);
+        link.backlog_bytes = 0;
+        for (Unwritten& u : c.unwritten) {
+            hold(link, std::move(u.msg));
+        }
+        c.unwritten.clear();
+        for (LinkMessage& m : newer) {
+            size_t bytes = m.key.size() + (m.body ? m.body->size() : 0);
+            if (link.backlog_bytes + bytes > CLUSTER_BACKLOG) {
+                records_dropped.add();
+                continue;
+            }
+            link.backlog.push_back(std::move(m));
+            link.backlog_bytes += bytes;
+        }
+    }
+
+    void close_conn(Conn& c) {
+        if (!c.closing) {
+            c.closing = true;
+            closing_.push_back(c.id);
+        }
+    }
+
+    void reap() {
+        for (uint64_t id : closing_) {
+            auto it = conns_.find(id);
+            if (it == conns_.end()) {
+                continue;
+            }
+            std::unique_ptr<Conn> c = std::move(it->second);
+            conns_.erase(it);
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c->fd, nullptr);
+            if (c->outbound) {
+                requeue_unwritten(*c);
+            }
+            close(c->fd);
+            if (c->outbound) {
+                if (!c->connecting) {
+                    links_up.add(-1);
+                }
+                if (c->link->index < out_conn_.size() && out_conn_[c->link->index] == c->id) {
+                    out_conn_[c->link->index] = 0;
+                }
+            } else if (c->link && cb_.on_peer_lost) {
+                cb_.on_peer_lost(c->link->index);
+            }
+        }
+        closing_.clear();
+    }
+
+    std::string path_;
+    std::string self_name_;
+    Callbacks cb_;
+    std::atomic<std::shared_ptr<const Topology>> topology_;
+    std::mutex reload_mu_;
+    std::shared_ptr<const Topology> pending_;
+
+    int epoll_fd_ = -1;
+    int listen_fd_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> wake_pending_{false};
+
+    // Link thread only
+    uint64_t next_id_ = WAKE_ID;
+    std::unordered_map<uint64_t, std::unique_ptr<Conn>> conns_;
+    std::vector<uint64_t> out_conn_;            // by node index, 0 = down
+    std::vector<Clock::time_point> retry_at_;
+    std::vector<uint64_t> closing_;
+    std::vector<LinkMessage> batch_;
+    std::string scratch_;
+};
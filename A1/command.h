@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// ----------------- Commands -------------------------
+enum class Command {
+    Broadcast,
+    Msg,
+    CreateGroup,
+    JoinGroup,
+    LeaveGroup,
+    GroupMsg,
+    History,
+    Missed,
+    Presence,
+    Compress,
+    Pong,
+    Unknown,
+    COUNT
+};
+
+const char* const COMMAND_NAMES[] = {
+    "broadcast", "msg", "create_group", "join_group", "leave_group", "group_msg",
+    "history", "missed", "presence", "compress", "pong", "unknown"
+};
+
+// Command words as typed, indexed by Command.
+constexpr std::string_view COMMAND_WORDS[] = {
+    "/broadcast", "/msg", "/create_group", "/join_group", "/leave_group", "/group_msg",
+    "/history", "/missed", "/presence", "/compress", "/pong"
+};
+
+// ----------------- Tokenizer ------------------------
+// Everything here returns views into the caller's line: parsing a command
+// allocates nothing, and the views live exactly as long as the frame.
+constexpr std::string_view WHITESPACE = " \n\r\t";
+
+constexpr std::string_view trim_view(std::string_view s) {
+    size_t start = s.find_first_not_of(WHITESPACE);
+    if (start == std::string_view::npos) {
+        return {};
+    }
+    size_t end = s.find_last_not_of(WHITESPACE);
+    return s.substr(start, end - start + 1);
+}
+
+// Perfect hash over COMMAND_WORDS: length and second character tell every
+// command apart, so dispatch is a single switch plus one compare to reject
+// words that merely collide.
+constexpr uint32_t command_key(std::string_view word) {
+    return word.size() < 2 ? 0 : static_cast<uint32_t>(word.size() << 8 | static_cast<unsigned char>(word[1]));
+}
+
+constexpr bool command_keys_distinct() {
+    constexpr size_t n = sizeof(COMMAND_WORDS) / sizeof(COMMAND_WORDS[0]);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = i + 1; j < n; ++j) {
+            if (command_key(COMMAND_WORDS[i]) == command_key(COMMAND_WORDS[j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+static_assert(command_keys_distinct(), "command_key() no longer separates the command words");
+
+constexpr Command lookup_command(std::string_view word) {
+    Command c = Command::Unknown;
+    switch (command_key(word)) {
+        case command_key("/broadcast"):    c = Command::Broadcast; break;
+        case command_key("/msg"):          c = Command::Msg; break;
+        case command_key("/create_group"): c = Command::CreateGroup; break;
+        case command_key("/join_group"):   c = Command::JoinGroup; break;
+        case command_key("/leave_group"):  c = Command::LeaveGroup; break;
+        case command_key("/group_msg"):    c = Command::GroupMsg; break;
+        case command_key("/history"):      c = Command::History; break;
+        case command_key("/missed"):       c = Command::Missed; break;
+        case command_key("/presence"):     c = Command::Presence; break;
+        case command_key("/compress"):     c = Command::Compress; break;
+        case command_key("/pong"):         c = Command::Pong; break;
+        default:                           return Command::Unknown;
+    }
+    return word == COMMAND_WORDS[static_cast<size_t>(c)] ? c : Command::Unknown;
+}
+
+// target is the recipient or group (or /presence's and /compress's on/off), body the message
+// text (or /history's count), both trimmed. malformed means a /msg or /group_msg with no message
+// after the target.
+struct ParsedCommand {
+    Command command = Command::Unknown;
+    std::string_view target;
+    std::string_view body;
+    bool malformed = false;
+};
+
+// A command that takes arguments only counts when a space follows it, as in
+// "/msg bob hi"; "/msg" on its own is an unknown command. /missed and /pong
+// take none.
+constexpr ParsedCommand parse_command(std::string_view line) {
+    ParsedCommand p;
+    std::string_view msg = trim_view(line);
+    size_t space = msg.find(' ');
+    p.command = lookup_command(msg.substr(0, space));
+    if (space == std::string_view::npos) {
+        if (p.command != Command::Missed && p.command != Command::Pong) {
+            p.command = Command::Unknown;
+        }
+        return p;
+    }
+    std::string_view rest = msg.substr(space + 1);
+
+    switch (p.command) {
+        case Command::Broadcast:
+            p.body = trim_view(rest);
+            break;
+        case Command::CreateGroup:
+        case Command::JoinGroup:
+        case Command::LeaveGroup:
+        case Command::Presence:
+        case Command::Compress:
+            p.target = trim_view(rest);
+            break;
+        case Command::Msg:
+        case Command::GroupMsg: {
+            size_t split = rest.find(' ');
+            if (split == std::string_view::npos) {
+                p.malformed = true;
+                break;
+            }
+            p.target = trim_view(rest.substr(0, split));
+            p.body = trim_view(rest.substr(split + 1));
+            break;
+        }
+        case Command::History: {
+            size_t split = rest.find(' ');
+            p.target = trim_view(rest.substr(0, split));
+            if (split != std::string_view::npos) {
+                p.body = trim_view(rest.substr(split + 1));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return p;
+}
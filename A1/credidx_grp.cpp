@@ -0,0 +1,154 @@
+// Builds the credential index that server_grp maps at startup.
+//
+//   ./credidx_grp [--iterations N] users.txt users.idx
+//
+// users.txt holds one username:password per line; a repeated username keeps
+// its last password. The index is written next to its destination and
+// renamed over it, so a running server never sees a half-written file and
+// picks the new one up on SIGHUP.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdio>
+#include <sys/random.h>
+
+#include "credstore.h"
+
+#define DEFAULT_ITERATIONS 600000   // OWASP's floor for PBKDF2-HMAC-SHA256
+#define MAX_LOAD_PERCENT 70
+
+struct Entry {
+    std::string username;
+    std::string password;
+};
+
+bool read_users(const std::string& filename, std::vector<Entry>& entries) {
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Failed to open " << filename << std::endl;
+        return false;
+    }
+    std::unordered_map<std::string, size_t> seen;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t delimiter = line.find(':');
+        if (delimiter == std::string::npos) {
+            continue;
+        }
+        std::string username = line.substr(0, delimiter);
+        std::string password = line.substr(delimiter + 1);
+        auto [it, inserted] = seen.try_emplace(username, entries.size());
+        if (inserted) {
+            entries.push_back({std::move(username), std::move(password)});
+        } else {
+            entries[it->second].password = std::move(password);
+        }
+    }
+    return true;
+}
+
+bool fill_random(uint8_t* out, size_t n) {
+    while (n > 0) {
+        ssize_t got = getrandom(out, n, 0);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        out += got;
+        n -= got;
+    }
+    return true;
+}
+
+bool write_index(const std::vector<Entry>& entries, uint32_t iterations, const std::string& path) {
+    uint32_t slot_bits = 1;
+    while ((1ull << slot_bits) * MAX_LOAD_PERCENT / 100 < entries.size()) {
+        ++slot_bits;
+    }
+    uint64_t mask = (1ull << slot_bits) - 1;
+    std::vector<CredSlot> slots(mask + 1);
+    std::string names;
+
+    for (const Entry& e : entries) {
+        if (names.size() + e.username.size() > UINT32_MAX) {
+            std::cerr << "Usernames exceed the 4 GiB name region" << std::endl;
+            return false;
+        }
+        uint64_t h = cred_name_hash(e.username);
+        uint64_t i = h & mask;
+        while (slots[i].name_hash != 0) {
+            i = (i + 1) & mask;
+        }
+        CredSlot& s = slots[i];
+        s.name_hash = h;
+        s.name_offset = static_cast<uint32_t>(names.size());
+        s.name_length = static_cast<uint32_t>(e.username.size());
+        if (!fill_random(s.salt, sizeof(s.salt))) {
+            std::cerr << "getrandom failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        pbkdf2_sha256(e.password, s.salt, sizeof(s.salt), iterations, s.hash);
+        names += e.username;
+    }
+
+    CredHeader header{};
+    memcpy(header.magic, CRED_MAGIC, sizeof(header.magic));
+    header.iterations = iterations;
+    header.slot_bits = slot_bits;
+    header.count = entries.size();
+    header.names_offset = sizeof(CredHeader) + slots.size() * sizeof(CredSlot);
+    header.names_size = names.size();
+
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(slots.data()), slots.size() * sizeof(CredSlot));
+    out.write(names.data(), names.size());
+    out.close();
+    if (!out) {
+        std::cerr << "Failed to write " << tmp << std::endl;
+        return false;
+    }
+    // Durable before it becomes visible under the real name
+    int fd = open(tmp.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    if (rename(tmp.c_str(), path.c_str()) < 0) {
+        std::cerr << "Failed to rename " << tmp << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--iterations N] users.txt users.idx\n";
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::stoul(argv[++i]);
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.size() != 2 || iterations == 0) {
+        usage(argv[0]);
+    }
+
+    std::vector<Entry> entries;
+    if (!read_users(files[0], entries) || !write_index(entries, iterations, files[1])) {
+        return 1;
+    }
+    std::cout << "Indexed " << entries.size() << " users into " << files[1] << std::endl;
+    return 0;
+}
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// ----------------- SHA-256 --------------------------
+// Just enough of FIPS 180-4 for PBKDF2-HMAC-SHA256; no external crypto library
+// is needed to build or read a credential index.
+class Sha256 {
+public:
+    static constexpr size_t DIGEST = 32;
+    static constexpr size_t BLOCK = 64;
+
+    Sha256() { reset(); }
+
+    void reset() {
+        static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(h_, init, sizeof(h_));
+        len_ = 0;
+        used_ = 0;
+    }
+
+    void update(const void* data, size_t n) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        len_ += n;
+        while (n > 0) {
+            size_t take = std::min(n, BLOCK - used_);
+            memcpy(buf_ + used_, p, take);
+            used_ += take;
+            p += take;
+            n -= take;
+            if (used_ == BLOCK) {
+                compress(buf_);
+                used_ = 0;
+            }
+        }
+    }
+
+    void final(uint8_t out[DIGEST]) {
+        uint64_t bits = len_ * 8;
+        buf_[used_++] = 0x80;
+        if (used_ > BLOCK - 8) {
+            memset(buf_ + used_, 0, BLOCK - used_);
+            compress(buf_);
+            used_ = 0;
+        }
+        memset(buf_ + used_, 0, BLOCK - 8 - used_);
+        for (int i = 0; i < 8; ++i) buf_[BLOCK - 8 + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        compress(buf_);
+        for (int i = 0; i < 8; ++i) {
+            out[4 * i] = static_cast<uint8_t>(h_[i] >> 24);
+            out[4 * i + 1] = static_cast<uint8_t>(h_[i] >> 16);
+            out[4 * i + 2] = static_cast<uint8_t>(h_[i] >> 8);
+            out[4 * i + 3] = static_cast<uint8_t>(h_[i]);
+        }
+    }
+
+private:
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t* block) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16) |
+                   (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+        h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+    }
+
+    uint32_t h_[8];
+    uint64_t len_;
+    uint8_t buf_[BLOCK];
+    size_t used_;
+};
+
+// PBKDF2-HMAC-SHA256 with a single 32-byte output block (RFC 8018).
+inline void pbkdf2_sha256(std::string_view password, const uint8_t* salt, size_t salt_len,
+                          uint32_t iterations, uint8_t out[Sha256::DIGEST]) {
+    uint8_t key[Sha256::BLOCK] = {};
+    if (password.size() > Sha256::BLOCK) {
+        Sha256 kh;
+        kh.update(password.data(), password.size());
+        kh.final(key);
+    } else {
+        memcpy(key, password.data(), password.size());
+    }
+    // The keyed pad blocks are the same for every HMAC round, so hash them
+    // once and start each round from a copy of that state.
+    uint8_t ipad[Sha256::BLOCK], opad[Sha256::BLOCK];
+    for (size_t i = 0; i < Sha256::BLOCK; ++i) {
+        ipad[i] = key[i] ^ 0x36;
+        opad[i] = key[i] ^ 0x5c;
+    }
+    Sha256 inner_base, outer_base;
+    inner_base.update(ipad, sizeof(ipad));
+    outer_base.update(opad, sizeof(opad));
+    auto hmac = [&](const uint8_t* a, size_t an, const uint8_t* b, size_t bn, uint8_t mac[Sha256::DIGEST]) {
+        Sha256 inner = inner_base;
+        inner.update(a, an);
+        inner.update(b, bn);
+        uint8_t ih[Sha256::DIGEST];
+        inner.final(ih);
+        Sha256 outer = outer_base;
+        outer.update(ih, sizeof(ih));
+        outer.final(mac);
+    };
+
+    static const uint8_t block_index[4] = {0, 0, 0, 1};
+    uint8_t u[Sha256::DIGEST];
+    hmac(salt, salt_len, block_index, sizeof(block_index), u);
+    memcpy(out, u, sizeof(u));
+    for (uint32_t i = 1; i < iterations; ++i) {
+        hmac(u, sizeof(u), nullptr, 0, u);
+        for (size_t j = 0; j < sizeof(u); ++j) out[j] ^= u[j];
+    }
+}
+
+// Compares every byte whatever the first mismatch, so the time taken says
+// nothing about how much of a hash was right.
+inline bool constant_time_equal(const uint8_t* a, const uint8_t* b, size_t n) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < n; ++i) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+// ----------------- Index File Format ----------------
+// [CredHeader][CredSlot x 2^slot_bits][username bytes]
+// Slots form an open-addressing table probed linearly from the username's
+// FNV-1a hash; name_hash 0 marks an empty slot. Every slot is one cache
+// line, so a lookup usually touches one line of the table plus the name.
+#define CRED_MAGIC "CHATCRD1"
+#define CRED_SALT_SIZE 16
+
+struct CredHeader {
+    char magic[8];
+    uint32_t iterations;
+    uint32_t slot_bits;
+    uint64_t count;
+    uint64_t names_offset;
+    uint64_t names_size;
+};
+
+struct CredSlot {
+    uint64_t name_hash;
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint8_t salt[CRED_SALT_SIZE];
+    uint8_t hash[Sha256::DIGEST];
+};
+static_assert(sizeof(CredSlot) == 64, "one slot per cache line");
+
+inline uint64_t cred_name_hash(std::string_view name) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : name) {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
+// ----------------- Credential Index ------------------
+// A read-only view of an index file. Opening it is one mmap plus a header
+// check, whatever the number of users; pages fault in as logins touch them.
+// Hold it through a shared_ptr so a reload can swap in a new index while
+// logins already in progress finish against the old mapping.
+class CredentialIndex {
+public:
+    // Null (with error set) if path is missing or not a valid index.
+    static std::shared_ptr<const CredentialIndex> open(const std::string& path, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return nullptr;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(CredHeader)) {
+            close(fd);
+            error = path + " is too short to be a credential index";
+            return nullptr;
+        }
+        size_t size = st.st_size;
+        void* base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            error = "cannot map " + path + ": " + strerror(errno);
+            return nullptr;
+        }
+        madvise(base, size, MADV_RANDOM);
+
+        std::shared_ptr<CredentialIndex> idx(new CredentialIndex(base, size));
+        const CredHeader& h = *idx->header_;
+        uint64_t slots_end = sizeof(CredHeader) + (uint64_t(sizeof(CredSlot)) << std::min(h.slot_bits, 40u));
+        if (memcmp(h.magic, CRED_MAGIC, sizeof(h.magic)) != 0 || h.slot_bits > 40 || h.iterations == 0 ||
+            h.count >= (1ull << h.slot_bits) || h.names_offset < slots_end ||
+            h.names_offset > size || h.names_size > size - h.names_offset) {
+            error = path + " is not a valid credential index";
+            return nullptr;
+        }
+        idx->slots_ = reinterpret_cast<const CredSlot*>(idx->header_ + 1);
+        idx->mask_ = (1ull << h.slot_bits) - 1;
+        idx->names_ = static_cast<const char*>(base) + h.names_offset;
+        return idx;
+    }
+
+    ~CredentialIndex() { munmap(base_, size_); }
+
+    CredentialIndex(const CredentialIndex&) = delete;
+    CredentialIndex& operator=(const CredentialIndex&) = delete;
+
+    uint64_t size() const { return header_->count; }
+
+    bool contains(std::string_view username) const { return find(username) != nullptr; }
+
+    // An unknown username still costs one full hash, so a failed login
+    // takes as long whether or not the name exists.
+    bool verify(std::string_view username, std::string_view password) const {
+        static const CredSlot dummy{};
+        const CredSlot* slot = find(username);
+        const CredSlot& s = slot ? *slot : dummy;
+        uint8_t computed[Sha256::DIGEST];
+        pbkdf2_sha256(password, s.salt, sizeof(s.salt), header_->iterations, computed);
+        return constant_time_equal(computed, s.hash, sizeof(computed)) && slot != nullptr;
+    }
+
+private:
+    CredentialIndex(void* base, size_t size)
+        : base_(base), size_(size), header_(static_cast<const CredHeader*>(base)) {}
+
+    const CredSlot* find(std::string_view username) const {
+        uint64_t h = cred_name_hash(username);
+        for (uint64_t i = h & mask_, probes = 0; probes <= mask_; i = (i + 1) & mask_, ++probes) {
+            const CredSlot& s = slots_[i];
+            if (s.name_hash == 0) {
+                return nullptr;
+            }
+            if (s.name_hash == h && s.name_length == username.size() &&
+                uint64_t(s.name_offset) + s.name_length <= header_->names_size &&
+                memcmp(names_ + s.name_offset, username.data(), username.size()) == 0) {
+                return &s;
+            }
+        }
+        return nullptr;
+    }
+
+    void* base_;
+    size_t size_;
+    const CredHeader* header_;
+    const CredSlot* slots_ = nullptr;
+    uint64_t mask_ = 0;
+    const char* names_ = nullptr;
+};
+
+// ----------------- Verifier -------------------------
+// Checks passwords on a few threads of its own. At a realistic iteration
+// count one check takes tens of milliseconds of CPU, which an event loop
+// serving thousands of sessions cannot spend inline. done(ok) runs on a
+// verifier thread.
+class CredentialVerifier {
+public:
+    using Done = std::function<void(bool ok)>;
+
+    ~CredentialVerifier() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (std::thread& t : threads_) {
+            t.join();
+        }
+    }
+
+    void start(unsigned threads) {
+        for (unsigned i = 0; i < std::max(threads, 1u); ++i) {
+            threads_.emplace_back([this] { run(); });
+        }
+    }
+
+    // idx is held until the check is done, so a reload cannot unmap it.
+    void submit(std::shared_ptr<const CredentialIndex> idx, std::string username, std::string password, Done done) {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            jobs_.push_back(Job{std::move(idx), std::move(username), std::move(password), std::move(done)});
+        }
+        cv_.notify_one();
+    }
+
+private:
+    struct Job {
+        std::shared_ptr<const CredentialIndex> idx;
+        std::string username;
+        std::string password;
+        Done done;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mu_);
+        while (true) {
+            cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if (stop_) {
+                return;
+            }
+            Job job = std::move(jobs_.front());
+            jobs_.pop_front();
+            lock.unlock();
+            job.done(job.idx->verify(job.username, job.password));
+            lock.lock();
+        }
+    }
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    bool stop_ = false;
+    std::vector<std::thread> threads_;
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "pool.h"
+
+// ----------------- Receive Ring ---------------------
+// Growable per-connection receive buffer. The capacity is always a power of
+// two so positions wrap with a mask; recv() writes straight into the free
+// space through readv(), and frames are parsed in place. Storage comes from
+// the pool, whose size classes match the capacities exactly.
+class RingBuffer {
+public:
+    static constexpr size_t MIN_CAPACITY = 512;
+
+    RingBuffer() = default;
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    ~RingBuffer() { release(); }
+
+    size_t size() const { return tail_ - head_; }
+    bool empty() const { return head_ == tail_; }
+    size_t capacity() const { return cap_; }
+    size_t free_space() const { return cap_ - size(); }
+
+    char at(size_t i) const { return buf_[(head_ + i) & (cap_ - 1)]; }
+
+    // Makes room for at least min_free more bytes, up to max_capacity.
+    // Returns false when the buffer is already as large as allowed.
+    bool reserve(size_t min_free, size_t max_capacity) {
+        if (free_space() >= min_free) {
+            return true;
+        }
+        size_t new_cap = cap_ ? cap_ : MIN_CAPACITY;
+        while (new_cap - size() < min_free) {
+            new_cap <<= 1;
+        }
+        if (new_cap > max_capacity) {
+            if (cap_ >= max_capacity) {
+                return free_space() > 0;
+            }
+            new_cap = max_capacity;
+        }
+        char* grown = static_cast<char*>(pool_allocate(new_cap));
+        size_t n = size();
+        copy_out(0, n, grown);
+        release();
+        buf_ = grown;
+        cap_ = new_cap;
+        head_ = 0;
+        tail_ = n;
+        return true;
+    }
+
+    // Fills up to two iovecs covering the free space; returns how many.
+    int writable_iov(struct iovec iov[2]) {
+        size_t mask = cap_ - 1;
+        size_t start = tail_ & mask;
+        size_t avail = free_space();
+        size_t first = std::min(avail, cap_ - start);
+        iov[0].iov_base = buf_ + start;
+        iov[0].iov_len = first;
+        if (avail > first) {
+            iov[1].iov_base = buf_;
+            iov[1].iov_len = avail - first;
+            return 2;
+        }
+        return 1;
+    }
+
+    void commit(size_t n) { tail_ += n; }
+
+    void consume(size_t n) {
+        head_ += n;
+        if (head_ == tail_) {
+            head_ = tail_ = 0;
+        }
+    }
+
+    // Drops the storage of an empty buffer so idle connections stay small.
+    void shrink() {
+        if (empty() && cap_ > 4 * MIN_CAPACITY) {
+            release();
+            buf_ = nullptr;
+            cap_ = 0;
+        }
+    }
+
+    // Offset of the first c at or after from, or npos.
+    size_t find(char c, size_t from) const {
+        size_t n = size();
+        while (from < n) {
+            size_t mask = cap_ - 1;
+            size_t start = (head_ + from) & mask;
+            size_t run = std::min(n - from, cap_ - start);
+            const void* hit = memchr(buf_ + start, c, run);
+            if (hit) {
+                return from + (static_cast<const char*>(hit) - (buf_ + start));
+            }
+            from += run;
+        }
+        return std::string::npos;
+    }
+
+    // Contiguous view of [offset, offset + n). Only a range that wraps around
+    // the end of the storage is copied, into scratch.
+    std::string_view view(size_t offset, size_t n, std::string& scratch) const {
+        size_t start = (head_ + offset) & (cap_ - 1);
+        if (start + n <= cap_) {
+            return std::string_view(buf_ + start, n);
+        }
+        scratch.resize(n);
+        copy_out(offset, n, scratch.data());
+        return scratch;
+    }
+
+private:
+    void release() {
+        if (buf_) {
+            pool_deallocate(buf_, cap_);
+        }
+    }
+
+    void copy_out(size_t offset, size_t n, char* dst) const {
+        if (n == 0) {
+            return;
+        }
+        size_t start = (head_ + offset) & (cap_ - 1);
+        size_t first = std::min(n, cap_ - start);
+        memcpy(dst, buf_ + start, first);
+        memcpy(dst + first, buf_, n - first);
+    }
+
+    char* buf_ = nullptr;
+    size_t cap_ = 0;
+    size_t head_ = 0;
+    size_t tail_ = 0;
+};
+
+// ----------------- Framing --------------------------
+// Two frame kinds share a stream:
+//   text   - bytes up to '\n' (a trailing '\r' is dropped)
+//   binary - BINARY_FRAME_MARK, a 4-byte big-endian length, then the payload
+// Text commands never start with NUL, so the marker byte is unambiguous.
+constexpr char BINARY_FRAME_MARK = '\0';
+constexpr size_t BINARY_HEADER_SIZE = 5;
+
+enum class FrameStatus {
+    Ready,
+    Incomplete,
+    Oversized
+};
+
+// Extracts the next frame from rb. On Ready, frame refers into rb (or
+// scratch) and stays valid until `consumed` bytes are released.
+inline FrameStatus next_frame(const RingBuffer& rb, size_t max_frame,
+                              std::string& scratch, std::string_view& frame,
+                              size_t& consumed) {
+    size_t n = rb.size();
+    if (n == 0) {
+        return FrameStatus::Incomplete;
+    }
+
+    if (rb.at(0) == BINARY_FRAME_MARK) {
+        if (n < BINARY_HEADER_SIZE) {
+            return FrameStatus::Incomplete;
+        }
+        uint32_t len = 0;
+        for (size_t i = 1; i < BINARY_HEADER_SIZE; ++i) {
+            len = (len << 8) | static_cast<unsigned char>(rb.at(i));
+        }
+        if (len > max_frame) {
+            return FrameStatus::Oversized;
+        }
+        if (n < BINARY_HEADER_SIZE + len) {
+            return FrameStatus::Incomplete;
+        }
+        frame = rb.view(BINARY_HEADER_SIZE, len, scratch);
+        consumed = BINARY_HEADER_SIZE + len;
+        return FrameStatus::Ready;
+    }
+
+    size_t eol = rb.find('\n', 0);
+    if (eol == std::string::npos) {
+        return n > max_frame ? FrameStatus::Oversized : FrameStatus::Incomplete;
+    }
+    if (eol > max_frame) {
+        return FrameStatus::Oversized;
+    }
+    size_t len = eol;
+    if (len > 0 && rb.at(len - 1) == '\r') {
+        --len;
+    }
+    frame = rb.view(0, len, scratch);
+    consumed = eol + 1;
+    return FrameStatus::Ready;
+}
+
+// Wraps payload in a length-prefixed binary frame.
+inline std::string encode_binary_frame(std::string_view payload) {
+    std::string out;
+    out.reserve(BINARY_HEADER_SIZE + payload.size());
+    out.push_back(BINARY_FRAME_MARK);
+    uint32_t len = static_cast<uint32_t>(payload.size());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((len >> shift) & 0xff));
+    }
+    out.append(payload);
+    return out;
+}
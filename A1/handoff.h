@@ -0,0 +1,254 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define HANDOFF_MAGIC "CHATHOF1"          // 8 bytes, followed by the sizes
+#define HANDOFF_HEADER 24                 // magic, snapshot size, fd count
+#define HANDOFF_MAX_SNAPSHOT (1ull << 32)
+#define HANDOFF_FDS_PER_MSG 253           // SCM_MAX_FD: fds one sendmsg may carry
+#define HANDOFF_ACK 'A'                   // successor: adopted everything
+#define HANDOFF_NAK 'N'                   // successor: gave up
+#define HANDOFF_COMMIT 'C'                // predecessor: log closed, exiting
+#define HANDOFF_REPLY_TIMEOUT_MS 10000
+
+// ----------------- Snapshots -------------------------
+// State handed from one server process to the next. Both ends are builds
+// of the same server on the same host, so integers go in native byte order
+// and the format carries no version beyond the magic.
+class SnapshotWriter {
+public:
+    void u8(uint8_t v) { raw(&v, sizeof(v)); }
+    void u32(uint32_t v) { raw(&v, sizeof(v)); }
+    void u64(uint64_t v) { raw(&v, sizeof(v)); }
+
+    void str(std::string_view s) {
+        u32(static_cast<uint32_t>(s.size()));
+        out_.append(s);
+    }
+
+    const std::string& data() const { return out_; }
+
+private:
+    void raw(const void* p, size_t n) { out_.append(static_cast<const char*>(p), n); }
+
+    std::string out_;
+};
+
+// Reads what SnapshotWriter wrote. Reading past the end yields zeros and
+// empty strings and clears ok(), so a caller checks once per record.
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::string_view in) : in_(in) {}
+
+    uint8_t u8() { return fixed<uint8_t>(); }
+    uint32_t u32() { return fixed<uint32_t>(); }
+    uint64_t u64() { return fixed<uint64_t>(); }
+
+    std::string_view str() {
+        uint32_t n = u32();
+        if (!ok_ || n > in_.size() - at_) {
+            ok_ = false;
+            return {};
+        }
+        std::string_view s = in_.substr(at_, n);
+        at_ += n;
+        return s;
+    }
+
+    bool ok() const { return ok_; }
+    bool done() const { return ok_ && at_ == in_.size(); }
+
+private:
+    template <typename T>
+    T fixed() {
+        T v{};
+        if (!ok_ || sizeof(T) > in_.size() - at_) {
+            ok_ = false;
+            return v;
+        }
+        memcpy(&v, in_.data() + at_, sizeof(T));
+        at_ += sizeof(T);
+        return v;
+    }
+
+    std::string_view in_;
+    size_t at_ = 0;
+    bool ok_ = true;
+};
+
+// ----------------- Handoff Transfer -------------------
+// Over a connected Unix stream socket: the header, the snapshot, then the
+// fds HANDOFF_FDS_PER_MSG at a time, each batch riding on one byte so the
+// receiver can tell where a batch ends. The receiver gets every fd with
+// FD_CLOEXEC set; file status flags such as O_NONBLOCK travel with them.
+namespace handoff_detail {
+
+inline bool write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+inline bool read_all(int fd, char* p, size_t n) {
+    while (n > 0) {
+        ssize_t r = recv(fd, p, n, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+}  // namespace handoff_detail
+
+// Connects to a server listening at path; -1 if none is.
+inline int handoff_connect(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+inline bool send_handoff(int sock, const std::string& snapshot, const std::vector<int>& fds, std::string& error) {
+    using namespace handoff_detail;
+    char header[HANDOFF_HEADER];
+    uint64_t sizes[2] = {snapshot.size(), fds.size()};
+    memcpy(header, HANDOFF_MAGIC, 8);
+    memcpy(header + 8, sizes, sizeof(sizes));
+    if (!write_all(sock, header, sizeof(header)) || !write_all(sock, snapshot.data(), snapshot.size())) {
+        error = std::string("snapshot: ") + strerror(errno);
+        return false;
+    }
+    alignas(cmsghdr) char control[CMSG_SPACE(HANDOFF_FDS_PER_MSG * sizeof(int))];
+    for (size_t at = 0; at < fds.size(); at += HANDOFF_FDS_PER_MSG) {
+        size_t n = std::min<size_t>(HANDOFF_FDS_PER_MSG, fds.size() - at);
+        char byte = 'F';
+        iovec iov{&byte, 1};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(n * sizeof(int));
+        cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(n * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds.data() + at, n * sizeof(int));
+        ssize_t rc;
+        do {
+            rc = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        } while (rc < 0 && errno == EINTR);
+        if (rc != 1) {
+            error = std::string("fds: ") + strerror(errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+// On failure, fds holds whatever arrived; the caller owns those.
+inline bool receive_handoff(int sock, std::string& snapshot, std::vector<int>& fds, std::string& error) {
+    using namespace handoff_detail;
+    char header[HANDOFF_HEADER];
+    uint64_t sizes[2];
+    if (!read_all(sock, header, sizeof(header))) {
+        error = "no snapshot";
+        return false;
+    }
+    memcpy(sizes, header + 8, sizeof(sizes));
+    if (memcmp(header, HANDOFF_MAGIC, 8) != 0 || sizes[0] > HANDOFF_MAX_SNAPSHOT) {
+        error = "not a snapshot";
+        return false;
+    }
+    snapshot.resize(sizes[0]);
+    if (!read_all(sock, snapshot.data(), snapshot.size())) {
+        error = "snapshot truncated";
+        return false;
+    }
+    alignas(cmsghdr) char control[CMSG_SPACE(HANDOFF_FDS_PER_MSG * sizeof(int))];
+    while (fds.size() < sizes[1]) {
+        char byte;
+        iovec iov{&byte, 1};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t rc;
+        do {
+            rc = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        } while (rc < 0 && errno == EINTR);
+        if (rc != 1) {
+            error = "fds truncated";
+            return false;
+        }
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+                size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                const char* data = reinterpret_cast<const char*>(CMSG_DATA(cm));
+                for (size_t i = 0; i < n; ++i) {
+                    int fd;
+                    memcpy(&fd, data + i * sizeof(int), sizeof(fd));
+                    fds.push_back(fd);
+                }
+            }
+        }
+        if (msg.msg_flags & MSG_CTRUNC) {
+            error = "fds dropped (RLIMIT_NOFILE?)";
+            return false;
+        }
+    }
+    if (fds.size() != sizes[1]) {
+        error = "fd count mismatch";
+        return false;
+    }
+    return true;
+}
+
+// ----------------- Acknowledgement --------------------
+// Neither side lets go on its own. Once it has adopted the state, the
+// successor answers HANDOFF_ACK; one that gives up answers HANDOFF_NAK or
+// just closes the socket. After an ACK the predecessor releases what the
+// two cannot share, the message log, and answers HANDOFF_COMMIT. Only then
+// does the successor start serving and the predecessor exit. Without an
+// ACK, or if the COMMIT cannot be sent, the predecessor serves on; without
+// a COMMIT the successor exits before reading from any client.
+inline bool handoff_reply(int sock, char byte) {
+    return handoff_detail::write_all(sock, &byte, 1);
+}
+
+// False unless `expected` arrives within HANDOFF_REPLY_TIMEOUT_MS.
+inline bool handoff_await(int sock, char expected) {
+    timeval timeout{HANDOFF_REPLY_TIMEOUT_MS / 1000, (HANDOFF_REPLY_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char byte = 0;
+    return handoff_detail::read_all(sock, &byte, 1) && byte == expected;
+}
@@ -0,0 +1,651 @@
+// Load generator for server_grp. Logs in many sessions with the client's
+// handshake, then drives a mix of /msg, /broadcast and /group_msg traffic at a
+// fixed aggregate rate and reports throughput and delivery latency.
+//
+//   ./loadgen_grp [--host IP] [--port N] [--users FILE] [--sessions N]
+//                 [--rate MSGS/S] [--seconds S] [--mix MSG,BROADCAST,GROUP]
+//                 [--groups N] [--size BYTES] [--threads N]
+//   ./loadgen_grp --scenario storm [--host IP] [--port N] [--users FILE]
+//                 [--sessions N] [--seconds S]
+//   ./loadgen_grp --scenario frames [--host IP] [--port N] [--users FILE]
+//   ./loadgen_grp --make-users N FILE
+//
+// Every message carries the time it was scheduled to be sent, so each
+// delivery's latency is measured from the schedule rather than from when the
+// generator got around to sending it; a stalled server shows up in the tail
+// instead of silently lowering the offered load.
+//
+// The storm scenario instead connects every session at once, as clients do
+// after a server restart, and reports how long the logins took and how much
+// presence traffic each client received.
+//
+// The frames scenario is a check rather than a load: it sends a binary frame
+// whose message hides a newline and a forged compressed frame, and fails
+// unless a compressing recipient's stream stays intact.
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+
+#include "chat_client.h"
+#include "metrics.h"
+
+#define MAX_EVENTS 256
+#define RECV_CHUNK 65536
+#define DRAIN_SECONDS 1.0
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// ----------------- Configuration -----------------
+struct LoadConfig {
+    std::string host = "127.0.0.1";
+    int port = CHAT_PORT;
+    std::string users_file = "users.txt";
+    size_t sessions = 100;
+    double rate = 1000;                  // messages per second, all threads
+    double seconds = 10;
+    unsigned weights[3] = {90, 1, 9};    // msg, broadcast, group
+    size_t groups = 10;
+    size_t size = 64;                    // payload bytes per message
+    unsigned threads = 1;
+    std::string scenario = "traffic";    // traffic, storm or frames
+};
+
+LoadConfig config;
+
+enum Kind { Msg, Broadcast, Group, KIND_COUNT };
+const char* const KIND_NAMES[KIND_COUNT] = {"msg", "broadcast", "group"};
+const char KIND_TAGS[KIND_COUNT] = {'m', 'b', 'g'};
+
+// Marks generated payloads; what follows is the kind tag and the send time.
+const std::string_view STAMP = "#LG";
+
+// ----------------- Sessions -----------------
+struct LoadSession {
+    int fd = -1;
+    std::string username;
+    std::string group;
+    std::string rx;   // partial line carried between reads
+    std::string tx;   // unsent tail of a short write
+};
+
+struct LoadThread {
+    std::vector<LoadSession*> sessions;
+    int epoll_fd = -1;
+    uint64_t sent[KIND_COUNT] = {};
+    uint64_t delivered[KIND_COUNT] = {};
+    uint64_t blocked = 0;     // sends skipped because the socket was full
+    Histogram latency[KIND_COUNT];
+};
+
+std::vector<std::unique_ptr<LoadSession>> sessions;
+std::vector<std::pair<std::string, std::string>> credentials;
+
+void load_credentials(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Failed to open " << filename << std::endl;
+        exit(1);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t delimiter = line.find(':');
+        if (delimiter != std::string::npos) {
+            credentials.emplace_back(line.substr(0, delimiter), line.substr(delimiter + 1));
+        }
+    }
+    if (credentials.empty()) {
+        std::cerr << "No users in " << filename << std::endl;
+        exit(1);
+    }
+}
+
+void make_users(size_t n, const std::string& filename) {
+    std::ofstream file(filename);
+    for (size_t i = 0; i < n; ++i) {
+        file << "load" << i << ":pw" << i << '\n';
+    }
+}
+
+void raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// Logs every session in and puts it in its group. Done serially with the
+// blocking helpers: setup is not what is being measured.
+bool setup_sessions() {
+    std::string reply;
+    for (size_t i = 0; i < config.sessions; ++i) {
+        auto s = std::make_unique<LoadSession>();
+        const auto& [user, pass] = credentials[i % credentials.size()];
+        s->username = user;
+        s->group = "lg" + std::to_string(i % config.groups);
+        s->fd = connect_and_login(config.host, config.port, user, pass, reply);
+        if (s->fd < 0) {
+            std::cerr << "Session " << i << " (" << user << ") failed to log in" << std::endl;
+            return false;
+        }
+        // Create-then-join works whichever cluster node saw the group first
+        if (!send_line(s->fd, "/create_group " + s->group) || !send_line(s->fd, "/join_group " + s->group) ||
+            !read_until(s->fd, "You joined the group " + s->group, reply)) {
+            std::cerr << "Session " << i << " failed to join " << s->group << std::endl;
+            return false;
+        }
+        sessions.push_back(std::move(s));
+    }
+    return true;
+}
+
+// ----------------- Traffic -----------------
+bool flush_tx(LoadSession& s) {
+    while (!s.tx.empty()) {
+        ssize_t n = send(s.fd, s.tx.data(), s.tx.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        s.tx.erase(0, n);
+    }
+    return true;
+}
+
+std::string make_command(Kind kind, const LoadSession& from, std::mt19937_64& rng, uint64_t stamp) {
+    std::string cmd;
+    switch (kind) {
+        case Msg:       cmd = "/msg " + sessions[rng() % sessions.size()]->username + " "; break;
+        case Broadcast: cmd = "/broadcast "; break;
+        case Group:     cmd = "/group_msg " + from.group + " "; break;
+        default:        break;
+    }
+    cmd += STAMP;
+    cmd += KIND_TAGS[kind];
+    cmd += std::to_string(stamp);
+    cmd += ' ';
+    size_t body = cmd.size();
+    cmd.append(config.size > body ? config.size - body : 1, 'x');
+    cmd += '\n';
+    return cmd;
+}
+
+// Picks the message kind by the configured weights.
+Kind pick_kind(std::mt19937_64& rng) {
+    unsigned total = config.weights[0] + config.weights[1] + config.weights[2];
+    unsigned r = rng() % total;
+    for (int k = 0; k < KIND_COUNT; ++k) {
+        if (r < config.weights[k]) {
+            return static_cast<Kind>(k);
+        }
+        r -= config.weights[k];
+    }
+    return Msg;
+}
+
+// Consumes complete lines and records a latency for each stamped one.
+void scan_lines(LoadThread& t, LoadSession& s, uint64_t now) {
+    size_t start = 0;
+    size_t nl;
+    while ((nl = s.rx.find('\n', start)) != std::string::npos) {
+        std::string_view line(s.rx.data() + start, nl - start);
+        size_t at = line.find(STAMP);
+        // "You broadcasted: ..." is the sender's own ack, not a delivery
+        bool ack = line.rfind("You ", 0) == 0;
+        if (!ack && at != std::string_view::npos && at + STAMP.size() < line.size()) {
+            char tag = line[at + STAMP.size()];
+            uint64_t stamp = strtoull(line.data() + at + STAMP.size() + 1, nullptr, 10);
+            for (int k = 0; k < KIND_COUNT; ++k) {
+                if (KIND_TAGS[k] == tag) {
+                    t.delivered[k]++;
+                    t.latency[k].record(now > stamp ? now - stamp : 0);
+                }
+            }
+        }
+        start = nl + 1;
+    }
+    s.rx.erase(0, start);
+}
+
+void read_session(LoadThread& t, LoadSession& s) {
+    static thread_local char buffer[RECV_CHUNK];
+    while (true) {
+        ssize_t n = recv(s.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n > 0) {
+            s.rx.append(buffer, n);
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            std::cerr << s.username << " disconnected" << std::endl;
+            epoll_ctl(t.epoll_fd, EPOLL_CTL_DEL, s.fd, nullptr);
+        }
+        break;
+    }
+    scan_lines(t, s, now_ns());
+}
+
+// Open-loop sender: message i of this thread is due at start + i * interval
+// whether or not earlier ones have been answered. Any backlog is sent as soon
+// as the loop gets back here.
+void run_thread(LoadThread& t, uint64_t start, uint64_t stop, unsigned seed) {
+    std::mt19937_64 rng(seed);
+    double interval = 1e9 * config.threads / config.rate;
+    uint64_t issued = 0;
+    uint64_t drain_until = stop + static_cast<uint64_t>(DRAIN_SECONDS * 1e9);
+    epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        uint64_t now = now_ns();
+        if (now >= drain_until) {
+            break;
+        }
+        while (now < stop) {
+            uint64_t due = start + static_cast<uint64_t>(issued * interval);
+            if (due > now || due >= stop) {
+                break;
+            }
+            ++issued;
+            LoadSession& s = *t.sessions[rng() % t.sessions.size()];
+            if (!s.tx.empty()) {
+                t.blocked++;
+                continue;
+            }
+            Kind kind = pick_kind(rng);
+            s.tx = make_command(kind, s, rng, due);
+            flush_tx(s);
+            t.sent[kind]++;
+        }
+
+        // Sleep exactly until the next send is due; epoll_wait's millisecond
+        // timeout would either spin or add up to 1ms to every measurement.
+        uint64_t next = start + static_cast<uint64_t>(issued * interval);
+        uint64_t wait = now < stop && next > now ? next - now : 1000000;
+        timespec timeout{static_cast<time_t>(wait / 1000000000), static_cast<long>(wait % 1000000000)};
+        int n = epoll_pwait2(t.epoll_fd, events, MAX_EVENTS, &timeout, nullptr);
+        for (int i = 0; i < n; ++i) {
+            LoadSession& s = *static_cast<LoadSession*>(events[i].data.ptr);
+            if (events[i].events & EPOLLOUT) {
+                flush_tx(s);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                read_session(t, s);
+            }
+        }
+    }
+}
+
+// ----------------- Reconnect Storm -----------------
+// One nonblocking connection per session, all in flight together, each
+// walking the login handshake as its prompts arrive. Everything received
+// after the welcome is presence traffic; it is counted, not kept.
+struct StormSession {
+    int fd = -1;
+    size_t user = 0;
+    int stage = 0;            // 0 username prompt, 1 password prompt, 2 welcome, 3 logged in
+    uint64_t start = 0;
+    std::string rx;           // handshake bytes not yet matched
+};
+
+bool storm_step(StormSession& s, Histogram& logins, uint64_t now) {
+    const auto& [user, pass] = credentials[s.user % credentials.size()];
+    while (s.stage < 3) {
+        const char* marker = s.stage == 0 ? USERNAME_PROMPT : s.stage == 1 ? PASSWORD_PROMPT : "\n";
+        size_t at = s.rx.find(marker);
+        if (at == std::string::npos) {
+            return true;
+        }
+        if (s.stage == 2 && s.rx.find(AUTH_FAILED) < at) {
+            return false;
+        }
+        s.rx.erase(0, at + strlen(marker));
+        if (s.stage == 2) {
+            logins.record(now - s.start);
+        } else {
+            // Short lines go out whole on a fresh socket
+            std::string line = (s.stage == 0 ? user : pass) + "\n";
+            if (send(s.fd, line.data(), line.size(), MSG_NOSIGNAL | MSG_DONTWAIT) != static_cast<ssize_t>(line.size())) {
+                return false;
+            }
+        }
+        ++s.stage;
+    }
+    return true;
+}
+
+int run_storm() {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<StormSession> storm(config.sessions);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    addr.sin_addr.s_addr = inet_addr(config.host.c_str());
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < storm.size(); ++i) {
+        StormSession& s = storm[i];
+        s.user = i;
+        s.start = now_ns();
+        s.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (s.fd < 0 || (connect(s.fd, (sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)) {
+            std::cerr << "Session " << i << " failed to connect: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = &s;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s.fd, &ev);
+    }
+
+    // Runs until every login is done and presence traffic has been quiet
+    // for DRAIN_SECONDS, or --seconds have passed
+    Histogram logins;
+    size_t logged_in = 0, failed = 0;
+    uint64_t bytes = 0, lines = 0;
+    uint64_t all_in = 0, last_rx = start;
+    uint64_t deadline = start + static_cast<uint64_t>(config.seconds * 1e9);
+    static char buffer[RECV_CHUNK];
+    epoll_event events[MAX_EVENTS];
+    while (true) {
+        uint64_t now = now_ns();
+        if (now >= deadline || (logged_in + failed == storm.size() && now - last_rx >= DRAIN_SECONDS * 1e9)) {
+            break;
+        }
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
+        now = now_ns();
+        for (int i = 0; i < n; ++i) {
+            StormSession& s = *static_cast<StormSession*>(events[i].data.ptr);
+            while (s.fd >= 0) {
+                ssize_t got = recv(s.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (got <= 0) {
+                    if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                        failed += s.stage < 3;
+                        close(s.fd);
+                        s.fd = -1;
+                    }
+                    break;
+                }
+                last_rx = now;
+                if (s.stage == 3) {
+                    bytes += got;
+                    lines += std::count(buffer, buffer + got, '\n');
+                    continue;
+                }
+                s.rx.append(buffer, got);
+                bool ok = storm_step(s, logins, now);
+                if (!ok) {
+                    ++failed;
+                    close(s.fd);
+                    s.fd = -1;
+                } else if (s.stage == 3) {
+                    if (++logged_in + failed == storm.size()) {
+                        all_in = now;
+                    }
+                    // Whatever followed the welcome in this read
+                    bytes += s.rx.size();
+                    lines += std::count(s.rx.begin(), s.rx.end(), '\n');
+                    s.rx.clear();
+                    s.rx.shrink_to_fit();
+                }
+            }
+        }
+    }
+
+    Histogram::Snapshot h;
+    logins.merge_into(h);
+    std::cout << "storm: " << storm.size() << " sessions, " << logged_in << " logged in, " << failed << " failed\n"
+              << std::fixed << std::setprecision(1)
+              << "all logins done after " << (all_in ? (all_in - start) / 1e6 : (now_ns() - start) / 1e6) << " ms"
+              << "  (login p50 " << h.quantile(0.5) / 1e3 << " us, p99 " << h.quantile(0.99) / 1e3
+              << " us, max " << h.quantile(1.0) / 1e3 << " us)\n"
+              << "presence traffic: " << lines << " lines, " << bytes << " bytes; per session "
+              << static_cast<double>(lines) / std::max<size_t>(logged_in, 1) << " lines, "
+              << static_cast<double>(bytes) / std::max<size_t>(logged_in, 1) << " bytes\n"
+              << "quiet after " << (last_rx - start) / 1e6 << " ms\n";
+    for (const StormSession& s : storm) {
+        if (s.fd >= 0) close(s.fd);
+    }
+    close(epoll_fd);
+    return logged_in == storm.size() ? 0 : 1;
+}
+
+// ----------------- Forged Frames -----------------
+// The first user turns compression on; the second sends it a /msg in a
+// binary frame whose body is "hi", a newline and a well-formed compressed
+// frame carrying a forged line. The server must refuse it, and the
+// recipient must then inflate the next ordinary message without error and
+// without ever seeing the forged line.
+int run_frames() {
+    if (credentials.size() < 2) {
+        std::cerr << "The frames scenario needs two users" << std::endl;
+        return 1;
+    }
+    const auto& [to, to_pass] = credentials[0];
+    const auto& [from, from_pass] = credentials[1];
+    std::string reply;
+    int rx = connect_and_login(config.host, config.port, to, to_pass, reply);
+    if (rx < 0 || !send_line(rx, COMPRESS_ON) || !read_until(rx, "Compression on", reply)) {
+        std::cerr << to << " failed to log in" << std::endl;
+        return 1;
+    }
+    int tx = connect_and_login(config.host, config.port, from, from_pass, reply);
+    if (tx < 0) {
+        std::cerr << from << " failed to log in" << std::endl;
+        return 1;
+    }
+    // A server that stays silent fails the check instead of hanging it
+    timeval timeout{static_cast<time_t>(config.seconds), 0};
+    setsockopt(tx, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    const std::string forged = "[ admin ]: forged\n";
+    std::string block(lz_bound(forged.size()), '\0');
+    block.resize(lz_compress(forged.data(), forged.size(), block.data()));
+    char header[LZ_FRAME_HEADER];
+    lz_frame_header(header, block.size(), forged.size());
+    std::string body = "/msg " + to + " hi\n" + std::string(header, sizeof(header)) + block;
+    std::string frame(1, '\0');
+    for (int i = 3; i >= 0; --i) {
+        frame += static_cast<char>(body.size() >> (8 * i));
+    }
+    frame += body;
+    bool refused = send(tx, frame.data(), frame.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(frame.size()) &&
+                   read_until(tx, "Invalid message", reply);
+    bool sent = send_line(tx, "/msg " + to + " done");
+
+    // Everything up to the ordinary message, expanded as client_grp would
+    LzInflater inflater;
+    std::string text;
+    std::string done = "[ " + from + " ]: done\n";
+    bool intact = true;
+    char buffer[RECV_CHUNK];
+    while (intact && text.find(done) == std::string::npos) {
+        ssize_t n = recv(rx, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        intact = inflater.feed(buffer, n, text);
+    }
+    bool delivered = text.find(done) != std::string::npos;
+    bool forged_seen = text.find(forged) != std::string::npos;
+    close(tx);
+    close(rx);
+
+    std::cout << "frames: binary frame " << (refused ? "refused" : "NOT refused")
+              << ", recipient stream " << (intact ? "intact" : "CORRUPT")
+              << ", forged line " << (forged_seen ? "DELIVERED" : "not delivered")
+              << ", next message " << (delivered ? "delivered" : "NOT delivered") << std::endl;
+    return refused && sent && intact && delivered && !forged_seen ? 0 : 1;
+}
+
+// ----------------- Report -----------------
+void report(const std::vector<std::unique_ptr<LoadThread>>& threads, double secs) {
+    std::cout << "sessions " << sessions.size() << "  threads " << config.threads
+              << "  target " << std::fixed << std::setprecision(0) << config.rate << " msg/s"
+              << "  duration " << std::setprecision(1) << secs << "s\n";
+    std::cout << std::setw(10) << "kind" << std::setw(10) << "sent" << std::setw(10) << "sent/s"
+              << std::setw(12) << "delivered" << std::setw(12) << "deliv/s"
+              << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(11) << "p99.9 us" << "\n";
+
+    uint64_t blocked = 0;
+    uint64_t all_sent = 0, all_delivered = 0;
+    Histogram::Snapshot all;
+    auto row = [&](const char* name, uint64_t sent, uint64_t delivered, const Histogram::Snapshot& h) {
+        std::cout << std::setw(10) << name << std::setw(10) << sent << std::setw(10) << std::setprecision(0) << sent / secs
+                  << std::setw(12) << delivered << std::setw(12) << delivered / secs << std::setprecision(1)
+                  << std::setw(10) << h.quantile(0.5) / 1e3 << std::setw(10) << h.quantile(0.99) / 1e3
+                  << std::setw(11) << h.quantile(0.999) / 1e3 << "\n";
+    };
+    for (int k = 0; k < KIND_COUNT; ++k) {
+        uint64_t sent = 0, delivered = 0;
+        Histogram::Snapshot h;
+        for (const auto& t : threads) {
+            sent += t->sent[k];
+            delivered += t->delivered[k];
+            t->latency[k].merge_into(h);
+        }
+        row(KIND_NAMES[k], sent, delivered, h);
+        all.merge(h);
+        all_sent += sent;
+        all_delivered += delivered;
+    }
+    row("all", all_sent, all_delivered, all);
+    for (const auto& t : threads) blocked += t->blocked;
+    std::cout << "skipped (socket full): " << blocked << "\n";
+}
+
+// ----------------- Main -----------------
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--host IP] [--port N] [--users FILE] [--sessions N]\n"
+              << "       [--rate MSGS/S] [--seconds S] [--mix MSG,BROADCAST,GROUP]\n"
+              << "       [--groups N] [--size BYTES] [--threads N] [--scenario traffic|storm|frames]\n"
+              << "       " << prog << " --make-users N FILE\n";
+    exit(1);
+}
+
+void parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        std::string value = argv[++i];
+        if (arg == "--host") {
+            config.host = value;
+        } else if (arg == "--port") {
+            config.port = std::stoi(value);
+        } else if (arg == "--users") {
+            config.users_file = value;
+        } else if (arg == "--sessions") {
+            config.sessions = std::stoul(value);
+        } else if (arg == "--rate") {
+            config.rate = std::stod(value);
+        } else if (arg == "--seconds") {
+            config.seconds = std::stod(value);
+        } else if (arg == "--groups") {
+            config.groups = std::stoul(value);
+        } else if (arg == "--size") {
+            config.size = std::stoul(value);
+        } else if (arg == "--threads") {
+            config.threads = std::stoul(value);
+        } else if (arg == "--mix") {
+            std::stringstream ss(value);
+            std::string w;
+            for (int k = 0; k < KIND_COUNT; ++k) {
+                if (!std::getline(ss, w, ',')) {
+                    usage(argv[0]);
+                }
+                config.weights[k] = std::stoul(w);
+            }
+        } else if (arg == "--scenario") {
+            if (value != "traffic" && value != "storm" && value != "frames") {
+                usage(argv[0]);
+            }
+            config.scenario = value;
+        } else if (arg == "--make-users") {
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+            }
+            make_users(std::stoul(value), argv[++i]);
+            exit(0);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.sessions == 0 || config.groups == 0 || config.threads == 0 || config.rate <= 0 ||
+        config.weights[0] + config.weights[1] + config.weights[2] == 0) {
+        usage(argv[0]);
+    }
+    config.groups = std::min(config.groups, config.sessions);
+    config.threads = std::min<size_t>(config.threads, config.sessions);
+}
+
+int main(int argc, char* argv[]) {
+    parse_args(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+    load_credentials(config.users_file);
+    if (config.scenario == "frames") {
+        return run_frames();
+    }
+    if (credentials.size() < config.sessions) {
+        std::cerr << "Note: " << credentials.size() << " users for " << config.sessions
+                  << " sessions; /msg goes to each name's latest login" << std::endl;
+    }
+    if (config.scenario == "storm") {
+        return run_storm();
+    }
+
+    if (!setup_sessions()) {
+        return 1;
+    }
+    std::cout << "Logged in " << sessions.size() << " sessions" << std::endl;
+
+    std::vector<std::unique_ptr<LoadThread>> threads;
+    for (unsigned i = 0; i < config.threads; ++i) {
+        auto t = std::make_unique<LoadThread>();
+        t->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        threads.push_back(std::move(t));
+    }
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        LoadThread& t = *threads[i % threads.size()];
+        LoadSession* s = sessions[i].get();
+        fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = s;
+        epoll_ctl(t.epoll_fd, EPOLL_CTL_ADD, s->fd, &ev);
+        t.sessions.push_back(s);
+    }
+
+    uint64_t start = now_ns();
+    uint64_t stop = start + static_cast<uint64_t>(config.seconds * 1e9);
+    std::vector<std::thread> runners;
+    for (unsigned i = 0; i < threads.size(); ++i) {
+        runners.emplace_back(run_thread, std::ref(*threads[i]), start, stop, i * 7919 + 1);
+    }
+    for (auto& r : runners) r.join();
+
+    report(threads, config.seconds);
+    for (auto& s : sessions) close(s->fd);
+    return 0;
+}
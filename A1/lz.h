@@ -0,0 +1,251 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#define LZ_HASH_BITS 12         // match finder table: 4096 positions
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+// ----------------- LZ Codec -------------------------
+// A small LZ77 block codec in the style of LZ4, so compression needs no
+// library. A block is a run of sequences, each a token byte (literal count
+// in the high nibble, match length - 4 in the low one, 15 meaning more
+// length bytes follow, each adding up to 255), the literals, a 2-byte
+// little-endian offset back into the output and the match. The last
+// sequence has literals only. The compressor is greedy with a single hash
+// probe per position: fast rather than tight, which suits chat text.
+namespace lz_detail {
+
+inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Bytes at p that equal those at ref, compared a word at a time.
+inline size_t match_length(const unsigned char* p, const unsigned char* ref, const unsigned char* end) {
+    const unsigned char* start = p;
+    while (end - p >= 8) {
+        uint64_t a, b;
+        memcpy(&a, p, 8);
+        memcpy(&b, ref, 8);
+        if (uint64_t diff = a ^ b) {
+            return p - start + std::countr_zero(diff) / 8;
+        }
+        p += 8;
+        ref += 8;
+    }
+    while (p < end && *p == *ref) {
+        ++p;
+        ++ref;
+    }
+    return p - start;
+}
+
+inline unsigned char* put_length(unsigned char* out, size_t len) {
+    for (; len >= 255; len -= 255) {
+        *out++ = 255;
+    }
+    *out++ = static_cast<unsigned char>(len);
+    return out;
+}
+
+inline unsigned char* put_sequence(unsigned char* out, const unsigned char* literals, size_t lit_len,
+                                   size_t offset, size_t match_len) {
+    unsigned char* token = out++;
+    *token = static_cast<unsigned char>((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15) {
+        out = put_length(out, lit_len - 15);
+    }
+    memcpy(out, literals, lit_len);
+    out += lit_len;
+    if (match_len == 0) {
+        return out;   // the last sequence
+    }
+    *out++ = static_cast<unsigned char>(offset);
+    *out++ = static_cast<unsigned char>(offset >> 8);
+    size_t m = match_len - LZ_MIN_MATCH;
+    *token |= static_cast<unsigned char>(m < 15 ? m : 15);
+    if (m >= 15) {
+        out = put_length(out, m - 15);
+    }
+    return out;
+}
+
+// Reads an extended length after a nibble of 15; false past end.
+inline bool get_length(const unsigned char*& in, const unsigned char* end, size_t& len) {
+    unsigned char b;
+    do {
+        if (in == end) {
+            return false;
+        }
+        b = *in++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+}  // namespace lz_detail
+
+// Largest possible output for n input bytes.
+inline size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+// Compresses n bytes of src into dst, which holds lz_bound(n) bytes, and
+// returns the compressed size.
+inline size_t lz_compress(const char* src, size_t n, char* dst) {
+    using namespace lz_detail;
+    const auto* in = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* end = in + n;
+    const unsigned char* ip = in;
+    const unsigned char* anchor = in;
+    auto* out = reinterpret_cast<unsigned char*>(dst);
+    uint32_t table[1 << LZ_HASH_BITS] = {};
+
+    while (n >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+        uint32_t h = hash(read32(ip));
+        const unsigned char* ref = in + table[h];
+        table[h] = static_cast<uint32_t>(ip - in);
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+            ++ip;
+            continue;
+        }
+        size_t len = match_length(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, end) + LZ_MIN_MATCH;
+        out = put_sequence(out, anchor, ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+    }
+    out = put_sequence(out, anchor, end - anchor, 0, 0);
+    return out - reinterpret_cast<unsigned char*>(dst);
+}
+
+// Decompresses a block into exactly raw_size bytes at dst. False if the
+// block is malformed or does not decode to raw_size bytes.
+inline bool lz_decompress(const char* src, size_t n, char* dst, size_t raw_size) {
+    using namespace lz_detail;
+    const auto* in = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* end = in + n;
+    auto* out = reinterpret_cast<unsigned char*>(dst);
+    auto* out_begin = out;
+    auto* out_end = out + raw_size;
+
+    while (in < end) {
+        unsigned char token = *in++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !get_length(in, end, lit_len)) {
+            return false;
+        }
+        if (lit_len > static_cast<size_t>(end - in) || lit_len > static_cast<size_t>(out_end - out)) {
+            return false;
+        }
+        memcpy(out, in, lit_len);
+        in += lit_len;
+        out += lit_len;
+        if (in == end) {
+            break;
+        }
+        if (end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !get_length(in, end, match_len)) {
+            return false;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(out - out_begin) ||
+            match_len > static_cast<size_t>(out_end - out)) {
+            return false;
+        }
+        const unsigned char* ref = out - offset;
+        if (offset >= match_len) {
+            memcpy(out, ref, match_len);
+        } else {
+            // Overlapping: a run that repeats its last offset bytes
+            for (size_t i = 0; i < match_len; ++i) {
+                out[i] = ref[i];
+            }
+        }
+        out += match_len;
+    }
+    return out == out_end;
+}
+
+// ----------------- Compressed Frames ----------------
+// A client that sent "/compress on" may receive, between two messages, a
+// frame of LZ_FRAME_MARK, the block size and the original size (4 bytes
+// each, big-endian) and the block. The block decodes to one or more
+// ordinary newline-terminated messages. Messages never start with a NUL,
+// so the mark cannot be mistaken for text.
+#define LZ_FRAME_MARK '\0'
+#define LZ_FRAME_HEADER 9
+#define LZ_FRAME_MAX (16 * 1024 * 1024)   // larger original sizes are rejected
+
+inline void lz_frame_header(char* out, size_t block_size, size_t raw_size) {
+    out[0] = LZ_FRAME_MARK;
+    for (int i = 0; i < 4; ++i) {
+        out[1 + i] = static_cast<char>(block_size >> (24 - 8 * i));
+        out[5 + i] = static_cast<char>(raw_size >> (24 - 8 * i));
+    }
+}
+
+// Turns the received byte stream back into text, expanding frames.
+class LzInflater {
+public:
+    // Appends what data completes to text. False on a corrupt frame.
+    bool feed(const char* data, size_t n, std::string& text) {
+        pending_.append(data, n);
+        size_t at = 0;
+        while (at < pending_.size()) {
+            if (!at_boundary_ || pending_[at] != LZ_FRAME_MARK) {
+                size_t nl = pending_.find('\n', at);
+                size_t stop = nl == std::string::npos ? pending_.size() : nl + 1;
+                text.append(pending_, at, stop - at);
+                at_boundary_ = nl != std::string::npos;
+                at = stop;
+                continue;
+            }
+            if (pending_.size() - at < LZ_FRAME_HEADER) {
+                break;
+            }
+            size_t block = field(at + 1);
+            size_t raw = field(at + 5);
+            if (raw > LZ_FRAME_MAX || block > lz_bound(raw)) {
+                return false;
+            }
+            if (pending_.size() - at < LZ_FRAME_HEADER + block) {
+                break;
+            }
+            size_t base = text.size();
+            text.resize(base + raw);
+            if (!lz_decompress(pending_.data() + at + LZ_FRAME_HEADER, block, text.data() + base, raw)) {
+                return false;
+            }
+            at += LZ_FRAME_HEADER + block;
+        }
+        pending_.erase(0, at);
+        return true;
+    }
+
+private:
+    size_t field(size_t at) const {
+        size_t v = 0;
+        for (int i = 0; i < 4; ++i) {
+            v = v << 8 | static_cast<unsigned char>(pending_[at + i]);
+        }
+        return v;
+    }
+
+    std::string pending_;
+    bool at_boundary_ = true;
+};
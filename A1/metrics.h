@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// ----------------- Counters -------------------------
+// Each metric has exactly one writer (the worker that owns it) and is read by
+// whoever renders a scrape, so updates are a relaxed load + store: no locked
+// read-modify-write on the hot path. Readers sum the per-worker copies.
+class Counter {
+public:
+    void add(uint64_t n = 1) { v_.store(v_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    uint64_t get() const { return v_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> v_{0};
+};
+
+class Gauge {
+public:
+    void add(int64_t n) { v_.store(v_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    int64_t get() const { return v_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> v_{0};
+};
+
+// ----------------- Histogram ------------------------
+// HDR-style log-linear histogram: values below SUB are exact, above that each
+// power of two is split into SUB linear buckets, so every bucket is within
+// 1/SUB (12.5%) of the values it holds. Recording is one bit scan and three
+// counter updates; the whole uint64 range fits in 496 buckets.
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 3;
+    static constexpr uint64_t SUB = 1u << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    static size_t bucket_of(uint64_t v) {
+        if (v < SUB) {
+            return static_cast<size_t>(v);
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB + ((v >> shift) & (SUB - 1));
+    }
+
+    // Largest value that lands in bucket b.
+    static uint64_t upper_bound(size_t b) {
+        if (b < SUB) {
+            return b;
+        }
+        size_t shift = b / SUB - 1;
+        uint64_t sub = b % SUB;
+        return ((SUB + sub + 1) << shift) - 1;
+    }
+
+    void record(uint64_t v) {
+        counts_[bucket_of(v)].add();
+        sum_.add(v);
+        count_.add();
+    }
+
+    struct Snapshot {
+        std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKETS);
+        uint64_t sum = 0;
+        uint64_t count = 0;
+
+        void merge(const Snapshot& o) {
+            for (size_t b = 0; b < BUCKETS; ++b) counts[b] += o.counts[b];
+            sum += o.sum;
+            count += o.count;
+        }
+
+        // Upper bound of the bucket holding quantile q (0..1).
+        uint64_t quantile(double q) const {
+            if (count == 0) {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                seen += counts[b];
+                if (seen >= rank) {
+                    return upper_bound(b);
+                }
+            }
+            return upper_bound(BUCKETS - 1);
+        }
+    };
+
+    void merge_into(Snapshot& out) const {
+        for (size_t b = 0; b < BUCKETS; ++b) out.counts[b] += counts_[b].get();
+        out.sum += sum_.get();
+        out.count += count_.get();
+    }
+
+private:
+    Counter counts_[BUCKETS];
+    Counter sum_;
+    Counter count_;
+};
+
+// ----------------- Prometheus Text ------------------
+inline void write_metric_header(std::ostream& os, const char* name, const char* type, const char* help) {
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << ' ' << type << '\n';
+}
+
+// Emits cumulative buckets only where the count changes, plus +Inf. scale
+// converts recorded units to the exported unit (e.g. 1e-9 for ns -> s).
+inline void write_histogram(std::ostream& os, const char* name, const char* help,
+                            const Histogram::Snapshot& h, double scale) {
+    write_metric_header(os, name, "histogram", help);
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b < Histogram::BUCKETS; ++b) {
+        if (h.counts[b] == 0) {
+            continue;
+        }
+        cumulative += h.counts[b];
+        os << name << "_bucket{le=\"" << Histogram::upper_bound(b) * scale << "\"} " << cumulative << '\n';
+    }
+    os << name << "_bucket{le=\"+Inf\"} " << h.count << '\n'
+       << name << "_sum " << h.sum * scale << '\n'
+       << name << "_count " << h.count << '\n';
+}
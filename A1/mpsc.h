@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+#include "pool.h"
+
+// ----------------- MPSC Queue -----------------------
+// Unbounded lock-free multi-producer / single-consumer queue (Vyukov).
+// push() is one atomic exchange and never blocks or spins; pop() is only
+// ever called by the owning thread. The consumer always holds one
+// already-consumed node as a stub, so T must be default-constructible.
+// Nodes come from the pool; the consumer's frees refill its own cache and
+// flow back to producers through the pool's depot.
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head_(new Node), tail_(head_.load(std::memory_order_relaxed)) {}
+
+    ~MpscQueue() {
+        T discard;
+        while (pop(discard)) {
+        }
+        delete tail_;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Any thread.
+    void push(T value) {
+        Node* n = new Node;
+        n->value = std::move(value);
+        Node* prev = head_.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // Owning thread only. A producer caught between its exchange and its
+    // link makes the queue look empty for a moment; its wakeup follows.
+    bool pop(T& out) {
+        Node* next = tail_->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        out = std::move(next->value);
+        delete tail_;
+        tail_ = next;
+        return true;
+    }
+
+private:
+    struct Node : Pooled {
+        std::atomic<Node*> next{nullptr};
+        T value{};
+    };
+
+    alignas(64) std::atomic<Node*> head_;   // producers
+    alignas(64) Node* tail_;                // consumer
+};
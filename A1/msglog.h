@@ -0,0 +1,475 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "payload.h"
+#include "registry.h"
+
+// ----------------- Log Records ----------------------
+// The log is a directory of fixed-size segment files, each mapped and
+// filled front to back with 8-byte aligned records:
+//   [LogRecordHeader][key bytes][body bytes][padding]
+// key is the group or recipient, body the exact bytes delivered to clients,
+// so a replay hands the mapped body straight to writev().
+enum class LogKind : uint8_t {
+    GroupMessage = 1,     // key: group, body: "[ Group g ]: ...\n"
+    PrivateMessage = 2,   // key: offline recipient, body: "[ sender ]: ...\n"
+    Ack = 3               // key: user, body: uint64 seq read up to
+};
+
+struct LogRecordHeader {
+    uint32_t size;        // whole record incl. padding; 0 = end of data
+    uint32_t checksum;    // log_checksum() of everything after this field
+    uint64_t seq;
+    uint64_t time_ns;     // wall clock at append
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t key_len;
+    uint32_t body_len;
+};
+static_assert(sizeof(LogRecordHeader) == 32, "records stay 8-byte aligned");
+
+#define LOG_SEGMENT_SIZE (64u << 20)
+#define LOG_HISTORY_PER_KEY 1000   // newest records indexed per group/user
+
+#define LOG_PREFAULT_AHEAD (4u << 20) // bytes past the tail kept mapped in
+
+// FNV-style multiply-xor taken eight bytes at a time: it only has to catch
+// torn and garbage records, and it sits on every append.
+inline uint32_t log_checksum(const LogRecordHeader& h, std::string_view key, std::string_view body) {
+    uint64_t x = 14695981039346656037ull;
+    auto mix = [&x](const void* p, size_t n) {
+        const char* b = static_cast<const char*>(p);
+        for (; n >= 8; b += 8, n -= 8) {
+            uint64_t w;
+            memcpy(&w, b, 8);
+            x = (x ^ w) * 1099511628211ull;
+        }
+        uint64_t w = 0;
+        memcpy(&w, b, n);
+        x = (x ^ w ^ (uint64_t(n) << 56)) * 1099511628211ull;
+    };
+    mix(&h.seq, sizeof(h) - offsetof(LogRecordHeader, seq));
+    mix(key.data(), key.size());
+    mix(body.data(), body.size());
+    return static_cast<uint32_t>(x ^ (x >> 32));
+}
+
+// ----------------- Message Log ----------------------
+// Appends go to the active segment under one short lock: a bounds check, a
+// memcpy into the mapping and an index push. Durability is batched: a
+// background thread fdatasync()s dirty segments every fsync_ms, so no
+// sender waits on the disk. The index (group / recipient -> newest record
+// locations) lives in memory and is rebuilt by scanning the segments at
+// startup; a torn record at the tail ends the scan.
+class MessageLog {
+public:
+    struct Options {
+        std::string dir;
+        size_t segment_size = LOG_SEGMENT_SIZE;
+        size_t max_segments = 16;   // oldest segments are deleted beyond this
+        unsigned fsync_ms = 50;
+    };
+
+    ~MessageLog() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        if (flusher_.joinable()) {
+            flusher_.join();
+        }
+        sync_dirty();
+    }
+
+    // Opens or creates the log in opts.dir and rebuilds the index.
+    bool open(const Options& opts, std::string& error) {
+        opts_ = opts;
+        if (mkdir(opts_.dir.c_str(), 0755) < 0 && errno != EEXIST) {
+            error = "cannot create " + opts_.dir + ": " + strerror(errno);
+            return false;
+        }
+        std::vector<uint64_t> ids;
+        if (DIR* d = opendir(opts_.dir.c_str())) {
+            while (dirent* e = readdir(d)) {
+                unsigned long long id;
+                char tail;
+                if (sscanf(e->d_name, "%llu.seg%c", &id, &tail) == 1) {
+                    ids.push_back(id);
+                }
+            }
+            closedir(d);
+        }
+        std::sort(ids.begin(), ids.end());
+
+        for (uint64_t id : ids) {
+            auto seg = map_segment(id, false, error);
+            if (!seg) {
+                return false;
+            }
+            segments_.push_back(seg);
+            size_t end = scan(*seg);
+            if (id == ids.back()) {
+                tail_ = end;
+                // Anything past the last good record is a torn write; clear
+                // it so a later record cannot be mistaken for its successor.
+                if (fallocate(seg->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, end, seg->size - end) < 0) {
+                    memset(seg->base + end, 0, seg->size - end);
+                } else {
+                    posix_fallocate(seg->fd, end, seg->size - end);
+                }
+            }
+        }
+        if (segments_.empty() && !roll(error)) {
+            return false;
+        }
+        flusher_ = std::thread([this] { flush_loop(); });
+        return true;
+    }
+
+    // Appends one record. Returns its sequence number, or 0 if it could not
+    // be written (larger than a segment, or a new segment failed).
+    uint64_t append(LogKind kind, std::string_view key, std::string_view body) {
+        std::lock_guard<std::mutex> lock(mu_);
+        return append_locked(kind, key, body);
+    }
+
+    // Up to n newest messages of group, oldest first, as payloads that point
+    // into the mapped segments.
+    std::vector<Payload> group_history(std::string_view group, size_t n) const {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = groups_.find(group);
+        if (it == groups_.end()) {
+            return {};
+        }
+        const History& h = it->second;
+        return payloads(h, h.size() > n ? h.size() - n : 0);
+    }
+
+    // Private messages stored for user while offline; last_seq receives the
+    // newest one's sequence number, to pass to ack().
+    std::vector<Payload> mailbox(std::string_view user, uint64_t& last_seq) const {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = mailboxes_.find(user);
+        if (it == mailboxes_.end() || it->second.empty()) {
+            return {};
+        }
+        last_seq = it->second.back().seq;
+        return payloads(it->second, 0);
+    }
+
+    size_t mailbox_size(std::string_view user) const {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = mailboxes_.find(user);
+        return it == mailboxes_.end() ? 0 : it->second.size();
+    }
+
+    // Marks user's mailbox read up to seq; recorded in the log so it stays
+    // read after a restart.
+    void ack(std::string_view user, uint64_t seq) {
+        std::lock_guard<std::mutex> lock(mu_);
+        std::string_view body(reinterpret_cast<const char*>(&seq), sizeof(seq));
+        append_locked(LogKind::Ack, user, body);   // index() applies it
+    }
+
+private:
+    struct Segment {
+        uint64_t id = 0;
+        int fd = -1;
+        char* base = nullptr;
+        size_t size = 0;
+        size_t prefaulted = 0;   // flusher thread only
+
+        ~Segment() {
+            if (base) munmap(base, size);
+            if (fd >= 0) close(fd);
+        }
+    };
+    using SegmentPtr = std::shared_ptr<Segment>;
+
+    // Where a record's body sits.
+    struct Ref {
+        uint64_t seq;
+        uint64_t segment;
+        uint32_t offset;
+        uint32_t length;
+    };
+    using History = std::deque<Ref, PoolAllocator<Ref>>;
+
+    std::string segment_path(uint64_t id) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/%020llu.seg", static_cast<unsigned long long>(id));
+        return opts_.dir + name;
+    }
+
+    SegmentPtr map_segment(uint64_t id, bool create, std::string& error) {
+        auto seg = std::make_shared<Segment>();
+        seg->id = id;
+        std::string path = segment_path(id);
+        seg->fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+        if (seg->fd < 0) {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return nullptr;
+        }
+        if (create) {
+            // Reserve the blocks now: running out of disk later would be a
+            // SIGBUS on a store into the mapping.
+            int rc = posix_fallocate(seg->fd, 0, opts_.segment_size);
+            if (rc != 0) {
+                error = "cannot allocate " + path + ": " + strerror(rc);
+                unlink(path.c_str());
+                return nullptr;
+            }
+        }
+        struct stat st;
+        if (fstat(seg->fd, &st) < 0) {
+            error = "cannot stat " + path + ": " + strerror(errno);
+            return nullptr;
+        }
+        seg->size = st.st_size;
+        void* base = mmap(nullptr, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+        if (base == MAP_FAILED) {
+            error = "cannot map " + path + ": " + strerror(errno);
+            return nullptr;
+        }
+        seg->base = static_cast<char*>(base);
+        return seg;
+    }
+
+    // Indexes every intact record of seg; returns where its data ends.
+    size_t scan(const Segment& seg) {
+        size_t off = 0;
+        while (off + sizeof(LogRecordHeader) <= seg.size) {
+            LogRecordHeader h;
+            memcpy(&h, seg.base + off, sizeof(h));
+            size_t payload = size_t(h.key_len) + h.body_len;
+            if (h.size == 0 || h.size % 8 != 0 || h.size > seg.size - off ||
+                h.size < sizeof(h) + payload) {
+                break;
+            }
+            std::string_view key(seg.base + off + sizeof(h), h.key_len);
+            std::string_view body(key.data() + key.size(), h.body_len);
+            if (h.checksum != log_checksum(h, key, body)) {
+                break;
+            }
+            index(static_cast<LogKind>(h.kind), key, body, Ref{h.seq, seg.id, uint32_t(body.data() - seg.base), h.body_len});
+            next_seq_ = std::max(next_seq_, h.seq + 1);
+            off += h.size;
+        }
+        return off;
+    }
+
+    void index(LogKind kind, std::string_view key, std::string_view body, const Ref& ref) {
+        StringMap<History>* map = nullptr;
+        if (kind == LogKind::GroupMessage) {
+            map = &groups_;
+        } else if (kind == LogKind::PrivateMessage) {
+            map = &mailboxes_;
+        } else if (kind == LogKind::Ack && body.size() == sizeof(uint64_t)) {
+            uint64_t seq;
+            memcpy(&seq, body.data(), sizeof(seq));
+            apply_ack(key, seq);
+            return;
+        } else {
+            return;
+        }
+        auto it = map->find(key);
+        if (it == map->end()) {
+            it = map->try_emplace(std::string(key)).first;
+        }
+        it->second.push_back(ref);
+        if (it->second.size() > LOG_HISTORY_PER_KEY) {
+            it->second.pop_front();
+        }
+    }
+
+    void apply_ack(std::string_view user, uint64_t seq) {
+        auto it = mailboxes_.find(user);
+        if (it == mailboxes_.end()) {
+            return;
+        }
+        History& h = it->second;
+        while (!h.empty() && h.front().seq <= seq) {
+            h.pop_front();
+        }
+        if (h.empty()) {
+            mailboxes_.erase(it);
+        }
+    }
+
+    // The mapped segment with id, or null if there is none. Ids need not be
+    // contiguous: a log reopened after files went missing has gaps.
+    const SegmentPtr* find_segment(uint64_t id) const {
+        auto it = std::lower_bound(segments_.begin(), segments_.end(), id,
+                                   [](const SegmentPtr& seg, uint64_t id) { return seg->id < id; });
+        return it != segments_.end() && (*it)->id == id ? &*it : nullptr;
+    }
+
+    std::vector<Payload> payloads(const History& h, size_t from) const {
+        std::vector<Payload> out;
+        out.reserve(h.size() - from);
+        for (size_t i = from; i < h.size(); ++i) {
+            const Ref& r = h[i];
+            const SegmentPtr* seg = find_segment(r.segment);
+            if (!seg) {
+                continue;
+            }
+            out.push_back(borrow_payload(*seg, std::string_view((*seg)->base + r.offset, r.length)));
+        }
+        return out;
+    }
+
+    // Drops the refs into segments older than the oldest one left, so a
+    // history's size counts only messages that can still be read. Refs are
+    // in append order, so the stale ones are at the front.
+    void prune(StringMap<History>& map) {
+        uint64_t first = segments_.front()->id;
+        for (auto it = map.begin(); it != map.end();) {
+            History& h = it->second;
+            while (!h.empty() && h.front().segment < first) {
+                h.pop_front();
+            }
+            it = h.empty() ? map.erase(it) : std::next(it);
+        }
+    }
+
+    // Starts a new active segment and retires the oldest past max_segments.
+    // Queued payloads keep a retired segment mapped until they are written.
+    bool roll(std::string& error) {
+        uint64_t id = segments_.empty() ? 1 : segments_.back()->id + 1;
+        auto seg = map_segment(id, true, error);
+        if (!seg) {
+            return false;
+        }
+        if (!segments_.empty()) {
+            unsynced_.push_back(segments_.back());
+        }
+        segments_.push_back(seg);
+        tail_ = 0;
+        bool retired = false;
+        while (segments_.size() > std::max<size_t>(opts_.max_segments, 1)) {
+            unlink(segment_path(segments_.front()->id).c_str());
+            segments_.pop_front();
+            retired = true;
+        }
+        if (retired) {
+            prune(groups_);
+            prune(mailboxes_);
+        }
+        return true;
+    }
+
+    uint64_t append_locked(LogKind kind, std::string_view key, std::string_view body) {
+        size_t need = (sizeof(LogRecordHeader) + key.size() + body.size() + 7) & ~size_t(7);
+        if (need > opts_.segment_size || key.size() > UINT16_MAX) {
+            return 0;
+        }
+        std::string error;
+        if (tail_ + need > segments_.back()->size && !roll(error)) {
+            return 0;
+        }
+        Segment& seg = *segments_.back();
+        char* at = seg.base + tail_;
+
+        LogRecordHeader h{};
+        h.seq = next_seq_++;
+        h.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        h.kind = static_cast<uint8_t>(kind);
+        h.key_len = static_cast<uint16_t>(key.size());
+        h.body_len = static_cast<uint32_t>(body.size());
+        h.checksum = log_checksum(h, key, body);
+        memcpy(at + sizeof(h), key.data(), key.size());
+        memcpy(at + sizeof(h) + key.size(), body.data(), body.size());
+        // A record the disk saw only part of fails its checksum on the next
+        // scan, which ends the log there.
+        h.size = static_cast<uint32_t>(need);
+        memcpy(at, &h, sizeof(h));
+
+        uint32_t body_off = static_cast<uint32_t>(tail_ + sizeof(h) + key.size());
+        tail_ += need;
+        dirty_ = true;
+        index(kind, key, body, Ref{h.seq, seg.id, body_off, h.body_len});
+        return h.seq;
+    }
+
+    void sync_dirty() {
+        std::vector<SegmentPtr> todo;
+        SegmentPtr active;
+        size_t tail = 0;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            todo.swap(unsynced_);
+            if (dirty_ && !segments_.empty()) {
+                todo.push_back(segments_.back());
+            }
+            dirty_ = false;
+            if (!segments_.empty()) {
+                active = segments_.back();
+                tail = tail_;
+            }
+        }
+        for (const SegmentPtr& seg : todo) {
+            fdatasync(seg->fd);
+        }
+        if (active) {
+            prefault(*active, tail);
+        }
+    }
+
+    // Maps in the pages appends will reach next, so the first store to each
+    // one does not take a page fault while holding the log lock.
+    void prefault(Segment& seg, size_t tail) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t from = std::max(tail & ~(page - 1), seg.prefaulted);
+        size_t to = std::min(seg.size, (tail + LOG_PREFAULT_AHEAD) & ~(page - 1));
+        if (from < to && madvise(seg.base + from, to - from, MADV_POPULATE_WRITE) == 0) {
+            seg.prefaulted = to;
+        }
+    }
+
+    void flush_loop() {
+        std::unique_lock<std::mutex> lock(mu_);
+        while (!stop_) {
+            cv_.wait_for(lock, std::chrono::milliseconds(opts_.fsync_ms));
+            lock.unlock();
+            sync_dirty();
+            lock.lock();
+        }
+    }
+
+    Options opts_;
+    mutable std::mutex mu_;
+    std::deque<SegmentPtr> segments_;   // oldest first; back() is active
+    std::vector<SegmentPtr> unsynced_;  // rolled over since the last sync
+    size_t tail_ = 0;                   // write offset in the active segment
+    uint64_t next_seq_ = 1;
+    bool dirty_ = false;
+    StringMap<History> groups_;
+    StringMap<History> mailboxes_;
+
+    std::thread flusher_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "payload.h"
+
+// What to do with a client whose unsent output exceeds its budget.
+enum class SlowConsumerPolicy {
+    Drop,        // discard the new message, keep the connection
+    Disconnect   // close the connection
+};
+
+// ----------------- Outbound Queue -------------------
+// Per-connection queue of messages waiting for the socket to become
+// writable. push() only appends a reference to a shared payload, so
+// producers never block on a slow reader and never copy the bytes;
+// flush() hands up to IOV_MAX queued messages to a single writev().
+class OutboundQueue {
+public:
+    static constexpr int MAX_IOV = IOV_MAX < 64 ? IOV_MAX : 64;
+
+    bool empty() const { return bytes_ == 0; }
+    size_t bytes() const { return bytes_; }
+    size_t chunks() const { return chunks_.size() - head_; }
+
+    // Queues data unless the queue would grow past budget bytes.
+    bool push(Payload data, size_t budget) {
+        if (data->empty()) {
+            return true;
+        }
+        if (bytes_ + data->size() > budget) {
+            return false;
+        }
+        bytes_ += data->size();
+        chunks_.push_back(std::move(data));
+        return true;
+    }
+
+    // Writes until the queue is empty or the socket would block. Returns
+    // false on a socket error that should end the session.
+    bool flush(int fd) {
+        while (bytes_ > 0) {
+            struct iovec iov[MAX_IOV];
+            int cnt = gather(iov, MAX_IOV);
+            ssize_t n = writev(fd, iov, cnt);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            advance(static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    // Describes up to max unsent chunks, oldest first, without consuming
+    // them; for callers that write asynchronously and report back through
+    // advance(). The memory stays valid until advance() passes it.
+    int gather(struct iovec* iov, int max) const {
+        int cnt = 0;
+        for (size_t i = head_; i < chunks_.size() && cnt < max; ++i, ++cnt) {
+            size_t skip = (i == head_) ? offset_ : 0;
+            iov[cnt].iov_base = const_cast<char*>(chunks_[i]->data()) + skip;
+            iov[cnt].iov_len = chunks_[i]->size() - skip;
+        }
+        return cnt;
+    }
+
+    // Releases the first n unsent bytes.
+    void advance(size_t n) {
+        bytes_ -= n;
+        while (n > 0) {
+            size_t left = chunks_[head_]->size() - offset_;
+            if (n < left) {
+                offset_ += n;
+                return;
+            }
+            n -= left;
+            chunks_[head_].reset();
+            ++head_;
+            offset_ = 0;
+        }
+        if (head_ == chunks_.size()) {
+            // Keep the vector's capacity for the next burst; drop it only
+            // when it grew well beyond a typical burst.
+            chunks_.clear();
+            if (chunks_.capacity() > 4 * MAX_IOV) {
+                chunks_.shrink_to_fit();
+            }
+            head_ = 0;
+        } else if (head_ >= MAX_IOV && 2 * head_ >= chunks_.size()) {
+            chunks_.erase(chunks_.begin(), chunks_.begin() + head_);
+            head_ = 0;
+        }
+    }
+
+    void clear() {
+        chunks_.clear();
+        chunks_.shrink_to_fit();
+        head_ = offset_ = bytes_ = 0;
+    }
+
+private:
+    std::vector<Payload, PoolAllocator<Payload>> chunks_;
+    size_t head_ = 0;     // first chunk not yet fully written
+    size_t offset_ = 0;   // bytes of chunks_[head_] already written
+    size_t bytes_ = 0;    // unsent bytes across all chunks
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "pool.h"
+
+// ----------------- Payload --------------------------
+// Immutable, reference-counted message bytes. A fan-out formats its message
+// once and every recipient's outbound queue holds the same buffer, so a
+// group of N members costs N reference bumps instead of N string copies.
+//
+// The bytes are a string the buffer owns, a block from the pool, or a range
+// of someone else's memory (e.g. a mapped log segment) that owner keeps
+// alive until the last queue lets go of it.
+class PayloadBuffer {
+public:
+    // size bytes at data, a pool block the buffer frees with itself
+    struct PoolBlock {
+        char* data;
+        size_t size;
+    };
+
+    explicit PayloadBuffer(std::string data) : owned_(std::move(data)), bytes_(owned_) {}
+    explicit PayloadBuffer(PoolBlock block) : pooled_(block.data), bytes_(block.data, block.size) {}
+    PayloadBuffer(std::shared_ptr<const void> owner, std::string_view bytes)
+        : owner_(std::move(owner)), bytes_(bytes) {}
+
+    ~PayloadBuffer() {
+        if (pooled_) {
+            pool_deallocate(pooled_, bytes_.size());
+        }
+    }
+
+    // bytes_ may point into owned_, so the buffer never moves.
+    PayloadBuffer(const PayloadBuffer&) = delete;
+    PayloadBuffer& operator=(const PayloadBuffer&) = delete;
+
+    const char* data() const { return bytes_.data(); }
+    size_t size() const { return bytes_.size(); }
+    bool empty() const { return bytes_.empty(); }
+    std::string_view view() const { return bytes_; }
+
+    // A second encoding of these bytes (e.g. compressed), built by the first
+    // caller on any thread and shared by every later one, so a fan-out
+    // encodes once however many recipients want it. make returns the
+    // encoding, or null when there is none worth sending.
+    template <typename F>
+    const std::shared_ptr<const PayloadBuffer>& packed(F&& make) const {
+        std::call_once(packed_once_, [&] { packed_ = make(*this); });
+        return packed_;
+    }
+
+private:
+    std::string owned_;
+    char* pooled_ = nullptr;
+    std::shared_ptr<const void> owner_;
+    std::string_view bytes_;
+    mutable std::once_flag packed_once_;
+    mutable std::shared_ptr<const PayloadBuffer> packed_;
+};
+
+using Payload = std::shared_ptr<const PayloadBuffer>;
+
+inline Payload make_payload(std::string data) {
+    return std::make_shared<const PayloadBuffer>(std::move(data));
+}
+
+// Payload over memory that owner keeps valid; nothing is copied.
+inline Payload borrow_payload(std::shared_ptr<const void> owner, std::string_view bytes) {
+    return std::allocate_shared<PayloadBuffer>(PoolAllocator<PayloadBuffer>(), std::move(owner), bytes);
+}
+
+// Concatenates parts into a new payload, e.g.
+// concat_payload({"[ Group ", name, " ]: ", msg, "\n"}). The text and the
+// buffer with its reference count both come from the pool, so the message
+// path builds payloads without touching the heap.
+inline Payload concat_payload(std::initializer_list<std::string_view> parts) {
+    size_t total = 0;
+    for (std::string_view p : parts) {
+        total += p.size();
+    }
+    char* out = static_cast<char*>(pool_allocate(total));
+    size_t at = 0;
+    for (std::string_view p : parts) {
+        memcpy(out + at, p.data(), p.size());
+        at += p.size();
+    }
+    return std::allocate_shared<PayloadBuffer>(PoolAllocator<PayloadBuffer>(),
+                                               PayloadBuffer::PoolBlock{out, total});
+}
+
+// One payload with the bytes of every payload in parts, in order.
+template <typename Range>
+inline Payload join_payloads(const Range& parts) {
+    size_t total = 0;
+    for (const Payload& p : parts) {
+        total += p->size();
+    }
+    char* out = static_cast<char*>(pool_allocate(total));
+    size_t at = 0;
+    for (const Payload& p : parts) {
+        memcpy(out + at, p->data(), p->size());
+        at += p->size();
+    }
+    return std::allocate_shared<PayloadBuffer>(PoolAllocator<PayloadBuffer>(),
+                                               PayloadBuffer::PoolBlock{out, total});
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#define POOL_MIN_BLOCK 32
+#define POOL_CLASSES 13                  // 32 B ... 128 KiB, powers of two
+#define POOL_BATCH 32                    // blocks per depot transfer
+#define POOL_SLAB_BYTES (256 * 1024)     // carved into blocks of one class
+
+// ----------------- Block Pool -----------------------
+// Size-classed free lists for everything the message path creates and
+// destroys: payloads and their bytes, mailbox nodes, delivery target lists,
+// sessions and receive rings. Each thread allocates from and frees into its
+// own cache without locks. Caches trade batches of POOL_BATCH blocks with a
+// shared depot, so blocks released on another thread (a payload freed by
+// the worker that wrote it out) come back into circulation. The heap is
+// only called to carve a new slab, so once the pools are warm the steady
+// state makes no heap calls at all. Slabs are never returned; the pools
+// stay at their high-water mark.
+namespace pool_detail {
+
+struct FreeBlock {
+    FreeBlock* next;
+    FreeBlock* next_batch;   // depot only: the batch after this one
+    size_t batch_size;       // depot only: blocks in this batch
+};
+static_assert(sizeof(FreeBlock) <= POOL_MIN_BLOCK, "a free block must fit the smallest class");
+
+constexpr size_t MAX_BLOCK = size_t(POOL_MIN_BLOCK) << (POOL_CLASSES - 1);
+
+inline size_t size_class(size_t n) {
+    return n <= POOL_MIN_BLOCK ? 0 : std::bit_width(n - 1) - std::bit_width(size_t(POOL_MIN_BLOCK) - 1);
+}
+
+inline size_t class_size(size_t c) {
+    return size_t(POOL_MIN_BLOCK) << c;
+}
+
+class Depot {
+public:
+    static Depot& instance() {
+        static Depot depot;
+        return depot;
+    }
+
+    // A batch of class c and its length in n, or nullptr. Batches from an
+    // exiting thread's cache can be shorter than POOL_BATCH.
+    FreeBlock* take(size_t c, size_t& n) {
+        Class& cl = classes_[c];
+        std::lock_guard<std::mutex> lock(cl.mu);
+        FreeBlock* batch = cl.batches;
+        if (batch) {
+            cl.batches = batch->next_batch;
+            n = batch->batch_size;
+        }
+        return batch;
+    }
+
+    void give(size_t c, FreeBlock* batch, size_t n) {
+        Class& cl = classes_[c];
+        std::lock_guard<std::mutex> lock(cl.mu);
+        batch->next_batch = cl.batches;
+        batch->batch_size = n;
+        cl.batches = batch;
+    }
+
+    std::atomic<uint64_t> slabs{0};   // heap calls made to grow the pools
+
+private:
+    struct alignas(64) Class {
+        std::mutex mu;
+        FreeBlock* batches = nullptr;
+    };
+    Class classes_[POOL_CLASSES];
+};
+
+struct ThreadCache {
+    FreeBlock* head[POOL_CLASSES] = {};
+    size_t count[POOL_CLASSES] = {};
+
+    ~ThreadCache() {
+        for (size_t c = 0; c < POOL_CLASSES; ++c) {
+            while (count[c] > 0) {
+                size_t n = std::min<size_t>(count[c], POOL_BATCH);
+                Depot::instance().give(c, detach(c, n), n);
+            }
+        }
+    }
+
+    // Unlinks the first n blocks of class c as one batch.
+    FreeBlock* detach(size_t c, size_t n) {
+        FreeBlock* batch = head[c];
+        FreeBlock* last = batch;
+        for (size_t i = 1; i < n; ++i) {
+            last = last->next;
+        }
+        head[c] = last->next;
+        last->next = nullptr;
+        count[c] -= n;
+        return batch;
+    }
+
+    void refill(size_t c) {
+        size_t n = 0;
+        if (FreeBlock* batch = Depot::instance().take(c, n)) {
+            head[c] = batch;
+            count[c] = n;
+            return;
+        }
+        size_t size = class_size(c);
+        size_t blocks = std::max<size_t>(POOL_SLAB_BYTES / size, 1);
+        char* slab = static_cast<char*>(::operator new(size * blocks));
+        Depot::instance().slabs.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = blocks; i-- > 0;) {
+            auto* b = reinterpret_cast<FreeBlock*>(slab + i * size);
+            b->next = head[c];
+            head[c] = b;
+        }
+        count[c] = blocks;
+    }
+};
+
+inline thread_local ThreadCache cache;
+
+}  // namespace pool_detail
+
+// A block of at least n bytes, 16-byte aligned. Sizes past the largest
+// class go straight to the heap.
+inline void* pool_allocate(size_t n) {
+    using namespace pool_detail;
+    if (n > MAX_BLOCK) {
+        return ::operator new(n);
+    }
+    size_t c = size_class(n);
+    ThreadCache& tc = cache;
+    if (!tc.head[c]) {
+        tc.refill(c);
+    }
+    FreeBlock* b = tc.head[c];
+    tc.head[c] = b->next;
+    --tc.count[c];
+    return b;
+}
+
+// n must be the size p was allocated with. Any thread.
+inline void pool_deallocate(void* p, size_t n) {
+    using namespace pool_detail;
+    if (n > MAX_BLOCK) {
+        ::operator delete(p);
+        return;
+    }
+    size_t c = size_class(n);
+    ThreadCache& tc = cache;
+    auto* b = static_cast<FreeBlock*>(p);
+    b->next = tc.head[c];
+    tc.head[c] = b;
+    if (++tc.count[c] > 2 * POOL_BATCH) {
+        Depot::instance().give(c, tc.detach(c, POOL_BATCH), POOL_BATCH);
+    }
+}
+
+// Slabs carved so far; flat once the pools are warm.
+inline uint64_t pool_slabs() {
+    return pool_detail::Depot::instance().slabs.load(std::memory_order_relaxed);
+}
+
+// Standard allocator over the pool, for containers and allocate_shared.
+template <typename T>
+struct PoolAllocator {
+    using value_type = T;
+    static_assert(alignof(T) <= 16, "pool blocks are 16-byte aligned");
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) { return static_cast<T*>(pool_allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) noexcept { pool_deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+};
+
+// Base class that routes new and delete of a type through the pool.
+struct Pooled {
+    static void* operator new(size_t n) { return pool_allocate(n); }
+    static void operator delete(void* p, size_t n) { pool_deallocate(p, n); }
+};
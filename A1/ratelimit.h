@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// ----------------- Token Bucket ---------------------
+// Refilled lazily from the caller's clock, so a bucket nobody touches costs
+// nothing and checking one is a multiply and a compare. Work is admitted
+// while the bucket is not in debt and charged afterwards at its real cost,
+// which may take the bucket below zero: a command that reached 10,000
+// recipients keeps its sender out until 10,000 tokens have come back. Not
+// thread-safe; every bucket belongs to one worker.
+class TokenBucket {
+public:
+    // Refills for the time since the last call, up to burst; rate is tokens
+    // per second. True while anything is left.
+    bool admit(uint64_t now_ns, double rate, double burst) {
+        if (now_ns > last_ns_) {
+            tokens_ = std::min(burst, tokens_ + static_cast<double>(now_ns - last_ns_) * rate * 1e-9);
+            last_ns_ = now_ns;
+        }
+        return tokens_ > 0;
+    }
+
+    void charge(double cost) { tokens_ -= cost; }
+
+    double tokens() const { return tokens_; }
+
+private:
+    double tokens_ = 0;     // the first admit() fills the bucket
+    uint64_t last_ns_ = 0;
+};
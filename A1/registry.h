@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pool.h"
+
+// Lets the maps below be probed with a std::string_view straight out of a
+// parsed command, without building a std::string key first.
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
+
+template <typename V>
+using StringMap = std::unordered_map<std::string, V, StringHash, std::equal_to<>>;
+
+// ----------------- User Registry --------------------
+// username -> session handle, split into independently locked shards so
+// lookups for different users never touch the same lock. Readers take a
+// shared lock; only login and logout take a shard exclusively.
+template <typename Handle>
+class UserRegistry {
+public:
+    static constexpr size_t SHARDS = 64;
+
+    // Binds username to h, replacing any previous binding.
+    void insert(const std::string& username, Handle h) {
+        Shard& sh = shard_for(username);
+        std::unique_lock lock(sh.mu);
+        sh.map[username] = h;
+    }
+
+    // As above, calling on_insert() under the shard lock, so such calls
+    // are ordered with what for_each() visits.
+    template <typename F>
+    void insert(const std::string& username, Handle h, F&& on_insert) {
+        Shard& sh = shard_for(username);
+        std::unique_lock lock(sh.mu);
+        sh.map[username] = h;
+        on_insert();
+    }
+
+    // Removes username only while it is still bound to h, so a stale
+    // session going away cannot unbind a newer login.
+    void erase(const std::string& username, Handle h) {
+        erase(username, h, [] {});
+    }
+
+    // As above, calling on_erase() under the shard lock when username is
+    // unbound. Returns whether it was.
+    template <typename F>
+    bool erase(const std::string& username, Handle h, F&& on_erase) {
+        Shard& sh = shard_for(username);
+        std::unique_lock lock(sh.mu);
+        auto it = sh.map.find(username);
+        if (it == sh.map.end() || it->second != h) {
+            return false;
+        }
+        sh.map.erase(it);
+        on_erase();
+        return true;
+    }
+
+    std::optional<Handle> find(std::string_view username) const {
+        const Shard& sh = shard_for(username);
+        std::shared_lock lock(sh.mu);
+        auto it = sh.map.find(username);
+        if (it == sh.map.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    // Visits every binding, one shard at a time under a shared lock.
+    template <typename F>
+    void for_each(F&& f) const {
+        for (const Shard& sh : shards_) {
+            std::shared_lock lock(sh.mu);
+            for (const auto& [name, h] : sh.map) {
+                f(name, h);
+            }
+        }
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const Shard& sh : shards_) {
+            std::shared_lock lock(sh.mu);
+            n += sh.map.size();
+        }
+        return n;
+    }
+
+private:
+    // Padded to a cache line so neighbouring shard locks do not false-share.
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mu;
+        StringMap<Handle> map;
+    };
+
+    Shard& shard_for(std::string_view key) {
+        return shards_[StringHash{}(key) % SHARDS];
+    }
+    const Shard& shard_for(std::string_view key) const {
+        return shards_[StringHash{}(key) % SHARDS];
+    }
+
+    Shard shards_[SHARDS];
+};
+
+// ----------------- Group Table ----------------------
+// group_name -> members. Every group is interned once as a small integer
+// GroupId, which sessions keep to find their groups again without hashing
+// the name. The table lock only guards the lookups and is taken exclusively
+// just to create a group; membership changes lock that one group, and
+// fan-out holds its group's lock shared, so group messages to different (or
+// the same) groups run in parallel. Groups are never deleted, so ids and
+// group pointers stay valid.
+//
+// Members are a sorted flat vector: fan-out is a linear scan over
+// contiguous handles, and membership tests are a binary search.
+using GroupId = uint32_t;
+
+template <typename Handle>
+class GroupTable {
+public:
+    using Members = std::vector<Handle, PoolAllocator<Handle>>;
+
+    struct Group {
+        GroupId id = 0;
+        std::string name;
+        mutable std::shared_mutex mu;
+        Members members;                  // sorted
+        std::atomic<uint64_t> peers{0};   // cluster nodes with members, by index
+    };
+    using GroupPtr = std::shared_ptr<Group>;
+
+    // Creates name with founder as its only member; null if it exists.
+    GroupPtr create(std::string_view name, Handle founder) {
+        return create(name, founder, [] {});
+    }
+
+    // As above, calling on_created() under the table lock, before anyone
+    // else can find the group, so such calls are ordered with for_each()
+    // and with the group's later joins and leaves.
+    template <typename F>
+    GroupPtr create(std::string_view name, Handle founder, F&& on_created) {
+        std::unique_lock lock(mu_);
+        auto [it, inserted] = groups_.try_emplace(std::string(name));
+        if (!inserted) {
+            return nullptr;
+        }
+        it->second = intern(it->first);
+        it->second->members.push_back(founder);
+        on_created();
+        return it->second;
+    }
+
+    // Returns name, creating it with no members if needed; for groups
+    // created elsewhere in a cluster.
+    GroupPtr ensure(std::string_view name) {
+        if (GroupPtr g = find(name)) {
+            return g;
+        }
+        std::unique_lock lock(mu_);
+        auto [it, inserted] = groups_.try_emplace(std::string(name));
+        if (inserted) {
+            it->second = intern(it->first);
+        }
+        return it->second;
+    }
+
+    GroupPtr find(std::string_view name) const {
+        std::shared_lock lock(mu_);
+        auto it = groups_.find(name);
+        return it == groups_.end() ? nullptr : it->second;
+    }
+
+    GroupPtr find(GroupId id) const {
+        std::shared_lock lock(mu_);
+        return id < by_id_.size() ? by_id_[id] : nullptr;
+    }
+
+    // Adds h to g; false if it was already a member.
+    static bool join(Group& g, Handle h) {
+        std::unique_lock lock(g.mu);
+        return insert(g.members, h);
+    }
+
+    // As above, calling on_first() under the group lock when h is the
+    // first member, so such calls are ordered like the joins themselves.
+    template <typename F>
+    static bool join(Group& g, Handle h, F&& on_first) {
+        std::unique_lock lock(g.mu);
+        bool inserted = insert(g.members, h);
+        if (inserted && g.members.size() == 1) {
+            on_first();
+        }
+        return inserted;
+    }
+
+    // Removes h from g; false if it was not a member.
+    static bool leave(Group& g, Handle h) {
+        std::unique_lock lock(g.mu);
+        return erase(g.members, h);
+    }
+
+    // As above, calling on_last() under the group lock when h was the last.
+    template <typename F>
+    static bool leave(Group& g, Handle h, F&& on_last) {
+        std::unique_lock lock(g.mu);
+        bool erased = erase(g.members, h);
+        if (erased && g.members.empty()) {
+            on_last();
+        }
+        return erased;
+    }
+
+    static size_t size(const Group& g) {
+        std::shared_lock lock(g.mu);
+        return g.members.size();
+    }
+
+    // Calls f() under the group lock if g has members, ordered with the
+    // on_first() and on_last() calls of join and leave.
+    template <typename F>
+    static void if_occupied(const Group& g, F&& f) {
+        std::shared_lock lock(g.mu);
+        if (!g.members.empty()) {
+            f();
+        }
+    }
+
+    static bool is_member(const Group& g, Handle h) {
+        std::shared_lock lock(g.mu);
+        return std::binary_search(g.members.begin(), g.members.end(), h);
+    }
+
+    // Visits every member of g under a shared lock. Returns false (and
+    // visits nobody) when required is not a member.
+    template <typename F>
+    static bool for_each_member(const Group& g, Handle required, F&& f) {
+        std::shared_lock lock(g.mu);
+        if (!std::binary_search(g.members.begin(), g.members.end(), required)) {
+            return false;
+        }
+        for (Handle h : g.members) {
+            f(h);
+        }
+        return true;
+    }
+
+    template <typename F>
+    static void for_each_member(const Group& g, F&& f) {
+        std::shared_lock lock(g.mu);
+        for (Handle h : g.members) {
+            f(h);
+        }
+    }
+
+    // Visits every group with the table lock held shared; f must not create
+    // groups.
+    template <typename F>
+    void for_each(F&& f) const {
+        std::shared_lock lock(mu_);
+        for (const GroupPtr& g : by_id_) {
+            f(g->name, *g);
+        }
+    }
+
+    // Sorted-set helpers, shared with the per-session list of joined groups.
+    template <typename Vec, typename T>
+    static bool insert(Vec& v, T x) {
+        auto it = std::lower_bound(v.begin(), v.end(), x);
+        if (it != v.end() && *it == x) {
+            return false;
+        }
+        v.insert(it, x);
+        return true;
+    }
+
+    template <typename Vec, typename T>
+    static bool erase(Vec& v, T x) {
+        auto it = std::lower_bound(v.begin(), v.end(), x);
+        if (it == v.end() || *it != x) {
+            return false;
+        }
+        v.erase(it);
+        return true;
+    }
+
+private:
+    // Caller holds mu_ exclusively.
+    GroupPtr intern(const std::string& name) {
+        auto g = std::make_shared<Group>();
+        g->id = static_cast<GroupId>(by_id_.size());
+        g->name = name;
+        by_id_.push_back(g);
+        return g;
+    }
+
+    mutable std::shared_mutex mu_;
+    StringMap<GroupPtr> groups_;
+    std::vector<GroupPtr> by_id_;   // indexed by GroupId
+};
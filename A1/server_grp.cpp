@@ -1,408 +1,2654 @@
 #include <iostream>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <linux/sockios.h>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <cstring>
+#include <cstdint>
 #include <thread>
+#include <chrono>
+#include <atomic>
+#include <barrier>
 #include <vector>
 #include <mutex>
+#include <memory>
 #include <fstream>
+#include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
+#include <charconv>
 #include <cctype>
 #include <errno.h>
+#include <csignal>
+
+#include "cluster.h"
+#include "command.h"
+#include "credstore.h"
+#include "framing.h"
+#include "handoff.h"
+#include "lz.h"
+#include "metrics.h"
+#include "mpsc.h"
+#include "msglog.h"
+#include "outbound.h"
+#include "payload.h"
+#include "ratelimit.h"
+#include "registry.h"
+#include "timerwheel.h"
+#include "uring.h"
 
 #define PORT 12345
-#define BACKLOG 10
+#define BACKLOG SOMAXCONN
 #define BUFFER_SIZE 1024
+#define MAX_EVENTS 256
+#define MAX_FRAME_SIZE (64 * 1024)
+#define RX_MAX_CAPACITY (128 * 1024)   // power of two, holds one max frame
+#define HISTORY_DEFAULT 20             // /history without a count
+#define DEFAULT_OUT_BUDGET (256 * 1024)
+#define URING_ENTRIES 1024             // SQ size per worker; the CQ gets 8x
+#define URING_BUF_COUNT 512            // provided receive buffers per worker
+#define URING_BUF_SIZE 4096
+#define URING_SEND_CHAIN 4             // linked sendmsgs per flush, MAX_IOV chunks each
+#define DEFAULT_PRESENCE_WINDOW_MS 50  // joins and leaves per presence digest
+#define PRESENCE_DIGEST_NAMES 10       // names listed per digest line; the rest are counted
+#define TIMER_TICK_MS 10               // resolution of session deadlines
+#define DEFAULT_AUTH_TIMEOUT_MS 30000  // connect to login complete
+#define DEFAULT_VERIFY_THREADS 2       // password hashes run here, off the workers
+#define DEFAULT_STALL_TIMEOUT_MS 60000 // queued output that does not move
+#define DEFAULT_USER_RATE 2000         // deliveries per second per session
+#define DEFAULT_USER_BURST 20000
+#define SERVER_BURST_MS 100            // server-wide budget that may be spent at once
+#define DEFAULT_COMPRESS_MIN 512       // smaller payloads are never compressed
+
+// ----------------- Configuration --------------------
+// How workers wait for and perform socket I/O
+enum class IoBackend {
+    Epoll,   // readiness events, then readv/writev per socket
+    Uring    // io_uring completions; one io_uring_enter per batch
+};
+
+struct ServerConfig {
+    size_t out_budget = DEFAULT_OUT_BUDGET;   // max unsent bytes per client
+    SlowConsumerPolicy slow_policy = SlowConsumerPolicy::Drop;
+    unsigned workers = 1;                     // event loops; 0 = one per core
+    std::vector<int> cpus;                    // worker i runs on cpus[i % n]
+    std::string metrics_socket;               // Unix socket path for scrapes
+    std::string credentials = "users.idx";    // index built by credidx_grp
+    MessageLog::Options log;                  // log.dir empty = no history
+    IoBackend io_backend = IoBackend::Epoll;
+    unsigned presence_window_ms = DEFAULT_PRESENCE_WINDOW_MS;   // 0 = announce each event
+    int port = PORT;                          // from the cluster file in cluster mode
+    std::string cluster_file;                 // empty = standalone
+    std::string node;                         // this node's name in cluster_file
+    unsigned auth_timeout_ms = DEFAULT_AUTH_TIMEOUT_MS;     // 0 = wait forever
+    unsigned verify_threads = DEFAULT_VERIFY_THREADS;
+    unsigned idle_timeout_ms = 0;             // silent logged-in clients; 0 = never
+    unsigned heartbeat_ms = 0;                // PING clients silent this long; 0 = off
+    unsigned stall_timeout_ms = DEFAULT_STALL_TIMEOUT_MS;   // 0 = never
+    double user_rate = DEFAULT_USER_RATE;     // per session; 0 = unlimited
+    double user_burst = DEFAULT_USER_BURST;
+    double server_rate = 0;                   // all sessions together; 0 = unlimited
+    size_t compress_min = DEFAULT_COMPRESS_MIN;   // for clients that asked (/compress)
+    std::string upgrade_socket;               // hot upgrade rendezvous; empty = off
+};
+
+// ----------------- Sessions -------------------------
+// Every connection is a small state machine driven by the event loop, so an
+// idle client costs one Session and one fd instead of a blocked thread.
+enum class SessionState {
+    AwaitUsername,
+    AwaitPassword,
+    Active,
+    Verifying   // the password is with the verifier; frames wait meanwhile
+};
+
+// Identifies a session server-wide: the owning worker's index in the top
+// bits and a per-worker sequence number below it. Unlike fds, ids are never
+// reused, so a late delivery can never reach the wrong client.
+using SessionId = uint64_t;
+constexpr int WORKER_SHIFT = 48;
+
+inline unsigned worker_of(SessionId id) {
+    return static_cast<unsigned>(id >> WORKER_SHIFT);
+}
+
+// Sessions, their queues and receive rings all live in pool blocks, so a
+// reconnect reuses the memory the last disconnect gave back.
+struct Session : Pooled {
+    SessionId id;
+    int fd;
+    SessionState state = SessionState::AwaitUsername;
+    std::string username;
+    RingBuffer inbuf;       // received bytes not yet framed into commands
+    OutboundQueue outq;     // accepted for delivery but not yet written
+    size_t dropped = 0;     // messages discarded by SlowConsumerPolicy::Drop
+    bool dirty = false;     // queued output not yet flushed this batch
+    bool closing = false;   // reaped at the end of the current event batch
+    bool presence = true;   // receives join/leave announcements (/presence)
+    bool compress = false;  // takes compressed frames (/compress)
+    std::vector<GroupId, PoolAllocator<GroupId>> joined;  // sorted; left on disconnect
+    TokenBucket bucket;     // --user-rate, in deliveries
+
+    Timer deadline;           // login deadline, then heartbeat/idle
+    Timer stall;              // armed while output is queued
+    uint64_t last_input = 0;  // ticks: bytes last received
+    uint64_t last_ping = 0;   //        heartbeat last sent
+    uint64_t last_drain = 0;  //        queued output last moved
+    size_t unacked = SIZE_MAX; // kernel send queue at the last stall check
+
+    // io_uring backend: requests still in flight keep the session alive
+    bool recv_armed = false;             // multishot recv outstanding
+    unsigned sends_inflight = 0;         // linked sendmsgs not yet completed
+    std::vector<struct iovec> send_iov;  // read by the kernel until they complete
+    std::vector<struct msghdr> send_msgs;
+};
+
+// ----------------- Metrics --------------------------
+// One set per worker, written only by that worker; a scrape sums them.
+struct WorkerMetrics {
+    Counter commands[static_cast<size_t>(Command::COUNT)];
+    Counter accepted;
+    Counter auth_failures;
+    Gauge sessions;
+    Counter bytes_in;
+    Counter bytes_out;
+    Gauge queued_bytes;             // unsent bytes across outbound queues
+    Gauge memberships;              // (session, group) pairs
+    Counter dropped;                // messages dropped for slow consumers
+    Counter slow_disconnects;
+    Counter mailbox_deliveries;     // Delivery entries received from other workers
+    Counter presence_digests;       // batched join/leave announcements sent
+    Counter auth_timeouts;
+    Counter idle_timeouts;
+    Counter heartbeats;
+    Counter stall_disconnects;      // output stuck past --stall-timeout-ms
+    Counter compressed;             // deliveries sent as compressed frames
+    Counter compress_saved;         // bytes those frames saved
+    Counter throttled[static_cast<size_t>(Command::COUNT)];   // over --user-rate
+    Counter rejected[static_cast<size_t>(Command::COUNT)];    // over --server-rate
+    Histogram fanout;               // recipients per fan-out
+    Histogram command_latency;      // ns from read to the batch's writev
+    Histogram remote_latency;       // ns from read to writev on another worker
+};
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------- Workers --------------------------
+using SessionList = std::vector<SessionId, PoolAllocator<SessionId>>;
+using SessionMap = std::unordered_map<SessionId, std::unique_ptr<Session>, std::hash<SessionId>,
+                                      std::equal_to<SessionId>,
+                                      PoolAllocator<std::pair<const SessionId, std::unique_ptr<Session>>>>;
+
+// A password check's outcome, posted back by the verifier.
+enum class LoginVerdict : uint8_t {
+    None,
+    Accepted,
+    Rejected
+};
+
+// A payload bound for sessions owned by another worker.
+struct Delivery {
+    SessionList targets;
+    Payload payload;
+    uint64_t recv_ns = 0;     // when the originating command was read
+    bool disconnect = false;  // close the targets once payload is queued
+    bool presence = false;    // skip targets that turned announcements off
+    LoginVerdict verdict = LoginVerdict::None;   // from the verifier, for targets[0]
+};
+
+// One event loop with its own SO_REUSEPORT listening socket and the
+// sessions it accepted. Only the owning thread touches anything here
+// except mailbox/wake_fd, which other workers use to hand it deliveries.
+struct Worker {
+    unsigned index = 0;
+    int cpu = -1;
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    int wake_fd = -1;                       // eventfd, readable when mail arrived
+    uint64_t next_seq = 0;
+
+    // Sessions' deadlines; declared first so it outlives their timers
+    TimerWheel timers;
+    int timer_fd = -1;                      // timerfd, set for the wheel's next busy tick
+    uint64_t timer_origin = 0;              // now_ns() at tick 0
+    uint64_t timer_fd_due = UINT64_MAX;     // tick timer_fd is set for
+
+    SessionMap sessions;
+    // Closed sessions whose io_uring requests have not all completed yet
+    SessionMap retired;
+    std::vector<SessionId> closing_sessions;
+    std::vector<SessionId> dirty_sessions;
+    std::string frame_scratch;  // holds a frame that wraps around a ring's end
+
+    Uring ring;                             // io_uring backend only
+    BufferRing recv_buffers;
+
+    MpscQueue<Delivery> mailbox;
+    std::atomic<bool> wake_pending{false};  // coalesces eventfd writes
+
+    WorkerMetrics metrics;
+    uint64_t batch_recv_ns = 0;             // read time of the command being run
+    uint64_t deliveries = 0;                // payloads queued or posted, for rate limits
+    TokenBucket admission;                  // this worker's share of --server-rate
+    std::vector<uint64_t> pending_command;  // read times, recorded after flush
+    std::vector<uint64_t> pending_remote;
+};
+
+// epoll tokens for a worker's own fds; session ids never reach these
+constexpr uint64_t LISTEN_TOKEN = UINT64_MAX;
+constexpr uint64_t WAKE_TOKEN = UINT64_MAX - 1;
+constexpr uint64_t METRICS_TOKEN = UINT64_MAX - 2;
+constexpr uint64_t RELOAD_TOKEN = UINT64_MAX - 3;
+constexpr uint64_t PRESENCE_TOKEN = UINT64_MAX - 4;
+constexpr uint64_t TIMER_TOKEN = UINT64_MAX - 5;
+constexpr uint64_t UPGRADE_TOKEN = UINT64_MAX - 6;
+// io_uring user_data for a session's sends; its multishot recv uses the bare
+// id. Worker indices stay below 2^15, so ids never have the top bit set.
+constexpr uint64_t SEND_TAG = 1ull << 63;
 
 // ----------------- Global Variables -----------------
 std::mutex cout_mutex;  // For synchronized console output
-std::vector<std::thread> client_threads;
-
-std::mutex clients_mutex;
-// client_socket -> username
-std::unordered_map<int, std::string> clients;
-// username -> client_socket
-std::unordered_map<std::string, int> usernames;
-// group_name -> set of client_sockets
-std::unordered_map<std::string, std::unordered_set<int>> groups;
-// username -> password from users.txt
-std::unordered_map<std::string, std::string> users;
+ServerConfig config;
+
+std::vector<std::unique_ptr<Worker>> workers;
+thread_local Worker* self = nullptr;    // the worker running on this thread
+
+// username -> session, for authenticated sessions only
+UserRegistry<SessionId> registry;
+// group_name -> set of sessions
+GroupTable<SessionId> groups;
+// Mapped credential index. A reload stores a new pointer; a login holds its
+// own reference, so it finishes against the index it started with.
+std::atomic<std::shared_ptr<const CredentialIndex>> credentials;
+// Declared after workers, so its threads are joined before workers go
+CredentialVerifier verifier;
+// Group and offline private messages, when --log-dir is given
+std::unique_ptr<MessageLog> message_log;
+// Links to the other nodes, when --cluster is given
+std::unique_ptr<Cluster> cluster;
+// username -> index of the node it is logged in on, for users elsewhere
+UserRegistry<uint32_t> remote_users;
+// Lets the link thread use send_to() and FanOut like a worker. Its index is
+// past the last worker's, so every session it reaches is remote.
+Worker link_context;
 
 // ----------------- Utility Functions ----------------
-std::string trim(const std::string& str) {
-    size_t start = str.find_first_not_of(" \n\r\t");
-    size_t end = str.find_last_not_of(" \n\r\t");
-    if (start == std::string::npos || end == std::string::npos) {
-        return "";
+// Maps the index and swaps it in. On failure the current index stays.
+bool load_credentials(const std::string& path) {
+    std::string error;
+    auto idx = CredentialIndex::open(path, error);
+    if (!idx) {
+        std::cerr << "Failed to load credentials: " << error << std::endl;
+        return false;
+    }
+    uint64_t count = idx->size();
+    credentials.store(std::move(idx));
+    std::lock_guard<std::mutex> lock(cout_mutex);
+    std::cout << "Loaded " << count << " users from " << path << std::endl;
+    return true;
+}
+
+void raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// ----------------- Delivery --------------------------
+void watch_output(Session& s, bool progressed);
+void finish_login(Session& s, bool ok);
+
+void close_session(Session& s) {
+    if (!s.closing) {
+        s.closing = true;
+        self->closing_sessions.push_back(s.id);
+    }
+}
+
+// Write as much of the pending output as the socket takes right now.
+void write_now(Session& s) {
+    size_t before = s.outq.bytes();
+    bool ok = s.outq.flush(s.fd);
+    size_t written = before - s.outq.bytes();
+    self->metrics.bytes_out.add(written);
+    self->metrics.queued_bytes.add(-static_cast<int64_t>(written));
+    if (!ok) {
+        close_session(s);
+        return;
+    }
+    watch_output(s, written > 0);
+}
+
+// io_uring: queues the pending output as a chain of sendmsgs, MAX_IOV chunks
+// each, linked so they run in order. MSG_WAITALL makes each one finish or
+// fail, and a failure cancels the rest of the chain, so a short send can
+// never reorder the stream. Output queued meanwhile waits for the chain.
+void submit_sends(Session& s) {
+    if (s.sends_inflight > 0 || s.outq.empty()) {
+        return;
+    }
+    constexpr size_t MAX_IOV = OutboundQueue::MAX_IOV;
+    size_t links = std::min<size_t>((s.outq.chunks() + MAX_IOV - 1) / MAX_IOV, URING_SEND_CHAIN);
+    links = std::min<size_t>(links, self->ring.reserve(links));
+    if (links == 0) {
+        close_session(s);  // the kernel is not taking submissions
+        return;
+    }
+    s.send_iov.resize(std::min(links * MAX_IOV, s.outq.chunks()));
+    size_t cnt = s.outq.gather(s.send_iov.data(), static_cast<int>(s.send_iov.size()));
+    s.send_msgs.assign(links, msghdr{});
+    for (size_t i = 0; i < links; ++i) {
+        msghdr& m = s.send_msgs[i];
+        m.msg_iov = s.send_iov.data() + i * MAX_IOV;
+        m.msg_iovlen = std::min(MAX_IOV, cnt - i * MAX_IOV);
+        io_uring_sqe* sqe = self->ring.get_sqe();
+        prep_sendmsg(sqe, s.fd, &m, MSG_WAITALL | MSG_NOSIGNAL, SEND_TAG | s.id);
+        if (i + 1 < links) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+    }
+    s.sends_inflight = links;
+}
+
+void flush_session(Session& s) {
+    if (config.io_backend == IoBackend::Uring) {
+        submit_sends(s);
+        watch_output(s, false);
+    } else {
+        write_now(s);
+    }
+}
+
+// ----------------- Compression -----------------------
+// Clients that sent "/compress on" get payloads of --compress-min bytes or
+// more as compressed frames (lz.h). The frame hangs off the payload itself,
+// so a broadcast is compressed once, by the first worker that needs it, and
+// every recipient on every worker queues the same frame. Payloads that do
+// not shrink go out as they are.
+Payload compress_payload(const PayloadBuffer& p) {
+    thread_local std::vector<char> scratch;
+    size_t need = LZ_FRAME_HEADER + lz_bound(p.size());
+    if (scratch.size() < need) {
+        scratch.resize(need);
+    }
+    size_t block = lz_compress(p.data(), p.size(), scratch.data() + LZ_FRAME_HEADER);
+    if (LZ_FRAME_HEADER + block >= p.size()) {
+        return nullptr;
+    }
+    lz_frame_header(scratch.data(), block, p.size());
+    return concat_payload({std::string_view(scratch.data(), LZ_FRAME_HEADER + block)});
+}
+
+// What actually goes to s for data.
+const Payload& wire_form(const Session& s, const Payload& data) {
+    if (!s.compress || data->size() < config.compress_min || data->size() > LZ_FRAME_MAX) {
+        return data;
+    }
+    const Payload& packed = data->packed(compress_payload);
+    if (!packed) {
+        return data;
+    }
+    self->metrics.compressed.add();
+    self->metrics.compress_saved.add(data->size() - packed->size());
+    return packed;
+}
+
+// Queues data on a session owned by the calling worker. Output is written
+// with one writev per session at the end of the event batch, so several
+// messages for the same client coalesce into one syscall; whatever the
+// kernel does not take then is written on the next EPOLLOUT edge. Presence
+// announcements skip sessions that turned them off.
+void enqueue_local(SessionId id, const Payload& data, bool presence = false) {
+    auto it = self->sessions.find(id);
+    if (it == self->sessions.end() || it->second->closing) {
+        return;
+    }
+    Session& s = *it->second;
+    if (presence && !s.presence) {
+        return;
+    }
+    const Payload& out = wire_form(s, data);
+    if (!s.outq.push(out, config.out_budget)) {
+        // Slow consumer: its backlog is already at the budget
+        if (config.slow_policy == SlowConsumerPolicy::Disconnect) {
+            self->metrics.slow_disconnects.add();
+            close_session(s);
+        } else {
+            ++s.dropped;
+            self->metrics.dropped.add();
+        }
+        return;
+    }
+    self->metrics.queued_bytes.add(out->size());
+    if (!s.dirty) {
+        s.dirty = true;
+        self->dirty_sessions.push_back(id);
+    }
+}
+
+// Hands a delivery to another worker. Only the push that finds the worker
+// without a pending wakeup pays for the eventfd write.
+void post(Worker& w, Delivery d) {
+    w.mailbox.push(std::move(d));
+    if (!w.wake_pending.exchange(true, std::memory_order_acq_rel)) {
+        uint64_t one = 1;
+        ssize_t rc = write(w.wake_fd, &one, sizeof(one));
+        (void)rc;
+    }
+}
+
+// Never blocks, whichever worker owns the recipient.
+void send_to(SessionId id, Payload data) {
+    ++self->deliveries;
+    unsigned owner = worker_of(id);
+    if (owner == self->index) {
+        enqueue_local(id, data);
+    } else {
+        post(*workers[owner], Delivery{{id}, std::move(data), self->batch_recv_ns});
+    }
+}
+
+// Single-recipient replies
+void send_to(SessionId id, std::string data) {
+    send_to(id, make_payload(std::move(data)));
+}
+
+// Delivers one payload to many sessions. Local recipients are queued right
+// away; remote ones are grouped by worker and posted as one Delivery each
+// in send(), so a broadcast costs at most one mailbox push per worker.
+class FanOut {
+public:
+    explicit FanOut(Payload payload, bool presence = false)
+        : payload_(std::move(payload)), presence_(presence), remote_(workers.size()) {}
+
+    void add(SessionId id) {
+        ++recipients_;
+        ++self->deliveries;
+        unsigned owner = worker_of(id);
+        if (owner == self->index) {
+            enqueue_local(id, payload_, presence_);
+        } else {
+            remote_[owner].push_back(id);
+        }
+    }
+
+    void send() {
+        self->metrics.fanout.record(recipients_);
+        for (size_t w = 0; w < remote_.size(); ++w) {
+            if (!remote_[w].empty()) {
+                post(*workers[w], Delivery{std::move(remote_[w]), payload_, self->batch_recv_ns, false, presence_});
+            }
+        }
+    }
+
+private:
+    uint64_t recipients_ = 0;
+    Payload payload_;
+    bool presence_;
+    std::vector<SessionList, PoolAllocator<SessionList>> remote_;
+};
+
+// Runs on the owning worker when its eventfd fires.
+void drain_mailbox(Worker& w) {
+    uint64_t count;
+    ssize_t rc = read(w.wake_fd, &count, sizeof(count));
+    (void)rc;
+    // Clear the flag before draining: a producer that pushes after this
+    // point sees false and wakes us again.
+    w.wake_pending.store(false, std::memory_order_release);
+
+    Delivery d;
+    while (w.mailbox.pop(d)) {
+        if (d.verdict != LoginVerdict::None) {
+            auto it = w.sessions.find(d.targets[0]);
+            // The session may have timed out or gone while it was checked
+            if (it != w.sessions.end() && !it->second->closing &&
+                it->second->state == SessionState::Verifying) {
+                finish_login(*it->second, d.verdict == LoginVerdict::Accepted);
+            }
+            continue;
+        }
+        for (SessionId id : d.targets) {
+            enqueue_local(id, d.payload, d.presence);
+            if (d.disconnect) {
+                auto it = w.sessions.find(id);
+                if (it != w.sessions.end()) {
+                    close_session(*it->second);
+                }
+            }
+        }
+        w.metrics.mailbox_deliveries.add();
+        if (d.recv_ns) {
+            w.pending_remote.push_back(d.recv_ns);
+        }
+    }
+}
+
+void flush_dirty_sessions() {
+    for (SessionId id : self->dirty_sessions) {
+        auto it = self->sessions.find(id);
+        if (it == self->sessions.end()) {
+            continue;
+        }
+        Session& s = *it->second;
+        s.dirty = false;
+        if (!s.closing) {
+            flush_session(s);
+        }
+    }
+    self->dirty_sessions.clear();
+}
+
+// Latency ends once the batch's writev calls are done.
+void record_latencies() {
+    Worker& w = *self;
+    if (w.pending_command.empty() && w.pending_remote.empty()) {
+        return;
+    }
+    uint64_t now = now_ns();
+    for (uint64_t t : w.pending_command) {
+        w.metrics.command_latency.record(now - t);
+    }
+    for (uint64_t t : w.pending_remote) {
+        w.metrics.remote_latency.record(now - t);
+    }
+    w.pending_command.clear();
+    w.pending_remote.clear();
+}
+
+// ----------------- Authentication --------------------
+const Payload WELCOME = make_payload("Welcome to the chat server !\n");
+const Payload AUTH_FAILED = make_payload("Authentication failed .\n");
+
+// Advances the login state machine by one frame. Returns false once the
+// client has failed authentication. The password goes to the verifier, and
+// the session waits in Verifying until finish_login() has its verdict.
+bool authenticate_client(Session& s, std::string_view input) {
+    if (s.state == SessionState::AwaitUsername) {
+        s.username = trim_view(input);
+        if (cluster) {
+            // Every user has one home node; the client reconnects there
+            auto topo = cluster->topology();
+            if (!topo->is_local(s.username)) {
+                const ClusterNode& home = topo->nodes[topo->owner(s.username)];
+                send_to(s.id, "Connect to " + home.host + ":" + std::to_string(home.chat_port) + " .\n");
+                return false;
+            }
+        }
+        send_to(s.id, "Enter password : ");
+        s.state = SessionState::AwaitPassword;
+        return true;
+    }
+
+    std::string_view password = trim_view(input);
+
+    // Validate; the verdict comes back through the mailbox
+    s.state = SessionState::Verifying;
+    SessionId id = s.id;
+    verifier.submit(credentials.load(), s.username, std::string(password), [id](bool ok) {
+        Delivery d;
+        d.targets.push_back(id);
+        d.verdict = ok ? LoginVerdict::Accepted : LoginVerdict::Rejected;
+        post(*workers[worker_of(id)], std::move(d));
+    });
+    return true;
+}
+
+// ----------------- Deadlines -------------------------
+// Each worker keeps its sessions' deadlines on one timer wheel, run from a
+// timerfd that is only ever set for the wheel's next busy tick:
+//   login    - username and password must arrive within --auth-timeout-ms
+//   activity - a client silent for --heartbeat-ms is sent a PING, and one
+//              silent for --idle-timeout-ms is closed
+//   stall    - output that has not moved for --stall-timeout-ms closes the
+//              session; that client is gone or has stopped reading. Once
+//              our queue has gone into the socket, the kernel's send queue
+//              is watched instead, so a client that stops reading before
+//              filling the socket buffer is caught within two timeouts
+// Reads and writes only note the time in the session; a timer that fires
+// early for that reason re-arms itself for the time still left.
+enum class TimerKind {
+    Login,
+    Activity,
+    Stall
+};
+
+const Payload LOGIN_TIMEOUT = make_payload("Login timed out .\n");
+const Payload IDLE_TIMEOUT = make_payload("Idle timeout .\n");
+const Payload HEARTBEAT = make_payload("PING .\n");
+
+uint64_t to_tick(uint64_t ns) {
+    return (ns - self->timer_origin) / (TIMER_TICK_MS * 1000000ull);
+}
+
+uint64_t ms_to_ticks(uint64_t ms) {
+    return (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+}
+
+void arm_timer(Timer& t, TimerKind kind, uint64_t expires) {
+    TimerWheel& wheel = self->timers;
+    if (wheel.size() == 0) {
+        // An empty wheel is not advanced; bring its clock up to date
+        wheel.advance(to_tick(now_ns()), [](Timer&) {});
+    }
+    t.kind = static_cast<int>(kind);
+    wheel.arm(t, expires);
+}
+
+void arm_login_deadline(Session& s) {
+    if (config.auth_timeout_ms > 0) {
+        arm_timer(s.deadline, TimerKind::Login, to_tick(now_ns()) + ms_to_ticks(config.auth_timeout_ms));
+    }
+}
+
+// The earlier of the next heartbeat and the idle deadline, if either is on.
+void arm_activity(Session& s) {
+    uint64_t next = UINT64_MAX;
+    if (config.idle_timeout_ms > 0) {
+        next = s.last_input + ms_to_ticks(config.idle_timeout_ms);
+    }
+    if (config.heartbeat_ms > 0) {
+        next = std::min(next, std::max(s.last_input, s.last_ping) + ms_to_ticks(config.heartbeat_ms));
+    }
+    if (next == UINT64_MAX) {
+        s.deadline.cancel();
+    } else {
+        arm_timer(s.deadline, TimerKind::Activity, next);
+    }
+}
+
+// Called after each write attempt: starts the stall clock if it is not
+// running, and restarts it when some output went out. Whether anything is
+// still pending is only looked at when the timer fires, so a session that
+// keeps writing pays for one check per timeout, not one per write.
+void watch_output(Session& s, bool progressed) {
+    if (config.stall_timeout_ms == 0) {
+        return;
+    }
+    bool armed = s.stall.armed();
+    if (progressed || !armed) {
+        s.last_drain = to_tick(now_ns());
+    }
+    if (!armed) {
+        arm_timer(s.stall, TimerKind::Stall, s.last_drain + ms_to_ticks(config.stall_timeout_ms));
+    }
+}
+
+// Bytes written to s's socket that the client has not acknowledged yet.
+size_t unacked_bytes(const Session& s) {
+    int n = 0;
+    return ioctl(s.fd, SIOCOUTQ, &n) == 0 && n > 0 ? size_t(n) : 0;
+}
+
+void on_timer(Timer& t) {
+    auto it = self->sessions.find(t.id);
+    if (it == self->sessions.end() || it->second->closing) {
+        return;
+    }
+    Session& s = *it->second;
+    uint64_t now = self->timers.now();
+    switch (static_cast<TimerKind>(t.kind)) {
+        case TimerKind::Login:
+            self->metrics.auth_timeouts.add();
+            send_to(s.id, LOGIN_TIMEOUT);
+            close_session(s);
+            break;
+        case TimerKind::Activity:
+            if (config.idle_timeout_ms > 0 && now >= s.last_input + ms_to_ticks(config.idle_timeout_ms)) {
+                self->metrics.idle_timeouts.add();
+                send_to(s.id, IDLE_TIMEOUT);
+                close_session(s);
+                break;
+            }
+            if (config.heartbeat_ms > 0 && now >= std::max(s.last_input, s.last_ping) + ms_to_ticks(config.heartbeat_ms)) {
+                s.last_ping = now;
+                self->metrics.heartbeats.add();
+                send_to(s.id, HEARTBEAT);
+            }
+            arm_activity(s);
+            break;
+        case TimerKind::Stall:
+            if (s.outq.empty()) {
+                size_t unacked = unacked_bytes(s);
+                if (unacked == 0) {
+                    s.unacked = SIZE_MAX;
+                    break;
+                }
+                if (unacked < s.unacked) {
+                    s.last_drain = now;
+                }
+                s.unacked = unacked;
+            }
+            if (now >= s.last_drain + ms_to_ticks(config.stall_timeout_ms)) {
+                self->metrics.stall_disconnects.add();
+                close_session(s);
+            } else {
+                arm_timer(s.stall, TimerKind::Stall, s.last_drain + ms_to_ticks(config.stall_timeout_ms));
+            }
+            break;
+    }
+}
+
+void run_timers(Worker& w) {
+    uint64_t expirations;
+    ssize_t rc = read(w.timer_fd, &expirations, sizeof(expirations));
+    (void)rc;
+    w.timer_fd_due = UINT64_MAX;
+    w.timers.advance(to_tick(now_ns()), on_timer);
+}
+
+// Sets the timerfd for the wheel's next busy tick unless it is already set
+// for an earlier one; once per event batch.
+void schedule_timers(Worker& w) {
+    if (w.timer_fd_due <= w.timers.now() + 1) {
+        return;
+    }
+    uint64_t ticks = w.timers.next_due();
+    if (ticks == 0 || w.timers.now() + ticks >= w.timer_fd_due) {
+        return;
+    }
+    w.timer_fd_due = w.timers.now() + ticks;
+    uint64_t ns = w.timer_origin + w.timer_fd_due * TIMER_TICK_MS * 1000000ull;
+    itimerspec at{};
+    at.it_value.tv_sec = ns / 1000000000;
+    at.it_value.tv_nsec = ns % 1000000000;
+    timerfd_settime(w.timer_fd, TFD_TIMER_ABSTIME, &at, nullptr);
+}
+
+// ----------------- Cluster Routing -------------------
+// Queues a record for every other node. Standalone servers have no links.
+void publish(LinkRecord type, std::string_view key, const Payload& body) {
+    if (cluster) {
+        cluster->send_all(*cluster->topology(), type, key, body);
+    }
+}
+
+// ----------------- Broadcast -------------------------
+// Fans message out to every user logged in on this node except sender
+// (0 excludes nobody).
+void broadcast_message(Payload message, SessionId sender) {
+    FanOut out(std::move(message));
+    registry.for_each([&](const std::string&, SessionId id) {
+        if (id != sender) {
+            out.add(id);
+        }
+    });
+    out.send();
+}
+
+// ----------------- Announcements ---------------------
+// Joins and leaves are collected for --presence-window-ms and sent as one
+// digest shared by every recipient, so when N users reconnect at once each
+// client gets a few digests instead of N messages. Worker 0 owns the timer.
+struct PresenceEvent {
+    std::string username;
+    bool joined;
+    SessionId session;   // the joining session; 0 for leaves and other nodes
+};
+
+std::mutex presence_mutex;
+std::vector<PresenceEvent> presence_events;   // since the last digest
+int presence_fd = -1;                         // timerfd, armed by the first event
+
+// Link records only say whether to announce
+const Payload ANNOUNCE = make_payload("announce");
+
+// Sends an announcement to everyone here except one session, skipping those
+// that turned presence off.
+void announce(Payload announcement, SessionId except) {
+    FanOut out(std::move(announcement), true);
+    registry.for_each([&](const std::string&, SessionId id) {
+        if (id != except) {
+            out.add(id);
+        }
+    });
+    out.send();
+}
+
+void queue_presence(std::string_view username, bool joined, SessionId session) {
+    if (config.presence_window_ms == 0) {
+        // Example: "bob has joined the chat ."
+        announce(concat_payload({username, joined ? " has joined the chat .\n" : " has left the chat .\n"}), session);
+        return;
+    }
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(presence_mutex);
+        first = presence_events.empty();
+        presence_events.push_back({std::string(username), joined, session});
+    }
+    if (first) {
+        itimerspec window{};
+        window.it_value.tv_sec = config.presence_window_ms / 1000;
+        window.it_value.tv_nsec = (config.presence_window_ms % 1000) * 1000000L;
+        timerfd_settime(presence_fd, 0, &window, nullptr);
+    }
+}
+
+// "a, b and c"; past PRESENCE_DIGEST_NAMES, "a, b, ... and 9990 others".
+void append_names(std::string& out, const std::vector<std::string_view>& names) {
+    size_t listed = names.size() <= PRESENCE_DIGEST_NAMES ? names.size() - 1 : PRESENCE_DIGEST_NAMES;
+    for (size_t i = 0; i < listed; ++i) {
+        out.append(names[i]);
+        out.append(i + 1 < listed ? ", " : "");
+    }
+    if (listed == names.size() - 1) {
+        out.append(listed ? " and " : "").append(names.back());
+    } else {
+        out.append(" and ").append(std::to_string(names.size() - listed)).append(" others");
+    }
+}
+
+// Runs on worker 0 when the window closes. A digest with a single event
+// reads exactly like the old per-event announcement.
+void send_presence_digest() {
+    uint64_t expirations;
+    ssize_t rc = read(presence_fd, &expirations, sizeof(expirations));
+    (void)rc;
+    std::vector<PresenceEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(presence_mutex);
+        events.swap(presence_events);
+    }
+
+    // Only net changes count: someone who joined and left within the window
+    // (or left and came back) looks the same to everyone as before it
+    std::unordered_map<std::string_view, std::pair<size_t, size_t>> span;   // first, last event
+    for (size_t i = 0; i < events.size(); ++i) {
+        auto [it, inserted] = span.try_emplace(events[i].username, i, i);
+        it->second.second = i;
+    }
+    std::vector<std::string_view> joined, left;
+    SessionId joiner = 0;
+    for (size_t i = 0; i < events.size(); ++i) {
+        auto [first, last] = span[events[i].username];
+        if (first != i || events[first].joined != events[last].joined) {
+            continue;
+        }
+        (events[last].joined ? joined : left).push_back(events[i].username);
+        joiner = events[last].session;
+    }
+    if (joined.empty() && left.empty()) {
+        return;
+    }
+
+    std::string text;
+    if (!joined.empty()) {
+        append_names(text, joined);
+        text.append(joined.size() == 1 ? " has joined the chat .\n" : " have joined the chat .\n");
+    }
+    if (!left.empty()) {
+        append_names(text, left);
+        text.append(left.size() == 1 ? " has left the chat .\n" : " have left the chat .\n");
+    }
+    self->metrics.presence_digests.add();
+    // A joiner is not told about itself, as before, unless it shares the
+    // digest with others
+    announce(make_payload(std::move(text)), joined.size() == 1 && left.empty() ? joiner : 0);
+}
+
+// Binds username to the joining session and announces it to all other
+// connected clients, here and on the other nodes. The Join is queued under
+// the registry lock, as send_snapshot()'s are, so a peer sees one user's
+// joins and leaves in the order they happened.
+void register_user(const std::string& username, SessionId joining) {
+    registry.insert(username, joining, [&] {
+        publish(LinkRecord::Join, username, ANNOUNCE);
+    });
+    queue_presence(username, true, joining);
+}
+
+// Unbinds the leaving session and announces e.g. "frank has left the
+// chat ." Not while a newer login of the same user is still here.
+void unregister_user(const std::string& username, SessionId leaving) {
+    if (registry.erase(username, leaving, [&] {
+            publish(LinkRecord::Leave, username, ANNOUNCE);
+        })) {
+        queue_presence(username, false, 0);
+    }
+}
+
+// Fixed replies are built once and shared like any other payload.
+const Payload UNKNOWN_COMMAND = make_payload("Unknown command.\n");
+const Payload MSG_USAGE = make_payload("Invalid format. Use /msg <username> <message>\n");
+const Payload GROUP_MSG_USAGE = make_payload("Invalid format. Use /group_msg <group_name> <message>\n");
+const Payload HISTORY_USAGE = make_payload("Invalid format. Use /history <group_name> [count]\n");
+const Payload HISTORY_DISABLED = make_payload("Message history is not enabled on this server.\n");
+const Payload NO_MISSED = make_payload("No missed messages.\n");
+const Payload PRESENCE_USAGE = make_payload("Invalid format. Use /presence on|off\n");
+const Payload PRESENCE_ON = make_payload("Presence announcements on .\n");
+const Payload PRESENCE_OFF = make_payload("Presence announcements off .\n");
+const Payload COMPRESS_USAGE = make_payload("Invalid format. Use /compress on|off\n");
+const Payload COMPRESS_ON = make_payload("Compression on .\n");
+const Payload COMPRESS_OFF = make_payload("Compression off .\n");
+const Payload BAD_BYTES = make_payload("Invalid message. Newlines and NUL bytes are not allowed.\n");
+
+// ----------------- Private Messaging -----------------
+void private_message(SessionId sender_id, std::string_view sender, std::string_view recipient, std::string_view message) {
+    // Example target: "[ bob ]: alice great , I will join"
+    // but from the perspective of the receiving user, it should be: "[ alice ]: <message>"
+    if (auto recipient_id = registry.find(recipient)) {
+        send_to(*recipient_id, concat_payload({"[ ", sender, " ]: ", message, "\n"}));
+    } else if (auto node = cluster ? remote_users.find(recipient) : std::nullopt) {
+        // Logged in on another node
+        cluster->send(*cluster->topology(), *node, LinkRecord::Direct, recipient,
+                      concat_payload({"[ ", sender, " ]: ", message, "\n"}));
+    } else if (message_log && credentials.load()->contains(recipient)) {
+        // Kept for the recipient's next /missed, on the node it logs in to
+        Payload formatted = concat_payload({"[ ", sender, " ]: ", message, "\n"});
+        auto topo = cluster ? cluster->topology() : nullptr;
+        if (topo && !topo->is_local(recipient)) {
+            cluster->send(*topo, topo->owner(recipient), LinkRecord::Direct, recipient, formatted);
+        } else {
+            message_log->append(LogKind::PrivateMessage, recipient, formatted->view());
+        }
+        send_to(sender_id, concat_payload({"User ", recipient, " is offline; message saved.\n"}));
+    } else {
+        send_to(sender_id, concat_payload({"User ", recipient, " is not connected.\n"}));
+    }
+}
+
+// ----------------- Group Management ------------------
+// Sessions remember the ids of the groups they are in, so a disconnect
+// leaves exactly those instead of searching every group.
+void create_group(std::string_view group_name, Session& s) {
+	// Example output: "Group CS425 created ."
+    SessionId client = s.id;
+    // Queued under the table lock, ahead of any join or leave of the group
+    auto group = groups.create(group_name, client, [&] {
+        publish(LinkRecord::GroupCreate, group_name, nullptr);
+        publish(LinkRecord::GroupSubscribe, group_name, nullptr);
+    });
+    if (!group) {
+        // If group exists
+        send_to(client, concat_payload({"Group ", group_name, " already exists.\n"}));
+    } else {
+        GroupTable<SessionId>::insert(s.joined, group->id);
+        self->metrics.memberships.add(1);
+        send_to(client, concat_payload({"Group ", group_name, " created .\n"}));
+    }
+}
+
+void join_group(std::string_view group_name, Session& s) {
+	// Example output: "You joined the group CS425 ."
+    SessionId client = s.id;
+    auto group = groups.find(group_name);
+
+    if (!group) {
+        send_to(client, concat_payload({"Group ", group_name, " does not exist.\n"}));
+    } else {
+        // Joining a group you are already in reports the same thing. The
+        // first member here subscribes this node to the group's messages.
+        if (GroupTable<SessionId>::join(*group, client, [&] {
+                publish(LinkRecord::GroupSubscribe, group_name, nullptr);
+            })) {
+            GroupTable<SessionId>::insert(s.joined, group->id);
+            self->metrics.memberships.add(1);
+        }
+        send_to(client, concat_payload({"You joined the group ", group_name, " .\n"}));
+    }
+}
+
+// Removes s from group; the last member here unsubscribes this node.
+bool leave(GroupTable<SessionId>::Group& group, Session& s) {
+    if (!GroupTable<SessionId>::leave(group, s.id, [&] {
+            publish(LinkRecord::GroupUnsubscribe, group.name, nullptr);
+        })) {
+        return false;
+    }
+    GroupTable<SessionId>::erase(s.joined, group.id);
+    self->metrics.memberships.add(-1);
+    return true;
+}
+
+void leave_group(std::string_view group_name, Session& s) {
+	// "You left the group CS425 ."
+    auto group = groups.find(group_name);
+
+    if (!group || !leave(*group, s)) {
+        send_to(s.id, concat_payload({"You are not a member of the group ", group_name, ".\n"}));
+    } else {
+        send_to(s.id, concat_payload({"You left the group ", group_name, " .\n"}));
+    }
+}
+
+// Disconnect: O(groups the session was in).
+void leave_all_groups(Session& s) {
+    while (!s.joined.empty()) {
+        leave(*groups.find(s.joined.back()), s);
+    }
+}
+
+void group_message(std::string_view group_name, std::string_view message, SessionId sender) {
+    // Example output: "[ Group CS425 ]: Hi , Welcome to CS425"
+    auto group = groups.find(group_name);
+    Payload formatted = concat_payload({"[ Group ", group_name, " ]: ", message, "\n"});
+    FanOut out(formatted);
+    bool member = group && GroupTable<SessionId>::for_each_member(*group, sender, [&](SessionId id) {
+        if (id != sender) {
+            out.add(id);
+        }
+    });
+    if (!member) {
+        send_to(sender, concat_payload({"You are not a member of the group ", group_name, ".\n"}));
+        return;
+    }
+    if (message_log) {
+        message_log->append(LogKind::GroupMessage, group_name, formatted->view());
+    }
+    out.send();
+    // Other nodes with members deliver it to them and keep their own history
+    if (uint64_t peers = cluster ? group->peers.load(std::memory_order_acquire) : 0) {
+        auto topo = cluster->topology();
+        for (size_t i = 0; i < topo->nodes.size(); ++i) {
+            if (peers & (1ull << i)) {
+                cluster->send(*topo, i, LinkRecord::GroupMessage, group_name, formatted);
+            }
+        }
+    }
+}
+
+// ----------------- History ---------------------------
+// Replayed records are payloads over the mapped log segments, so they reach
+// writev() without being copied. A client that takes compressed frames gets
+// the whole replay joined into one payload instead, which compresses far
+// better than records one at a time.
+void send_replay(const Session& s, std::vector<Payload>& replay) {
+    if (s.compress && replay.size() > 1) {
+        send_to(s.id, join_payloads(replay));
+        return;
+    }
+    for (Payload& p : replay) {
+        send_to(s.id, std::move(p));
+    }
+}
+
+void group_history(std::string_view group_name, std::string_view count, const Session& s) {
+    SessionId client = s.id;
+    size_t n = HISTORY_DEFAULT;
+    if (!count.empty()) {
+        auto [end, ec] = std::from_chars(count.data(), count.data() + count.size(), n);
+        if (ec != std::errc() || end != count.data() + count.size() || n == 0) {
+            send_to(client, HISTORY_USAGE);
+            return;
+        }
+    }
+    auto group = groups.find(group_name);
+    if (!group || !GroupTable<SessionId>::is_member(*group, client)) {
+        send_to(client, concat_payload({"You are not a member of the group ", group_name, ".\n"}));
+        return;
+    }
+    std::vector<Payload> history = message_log->group_history(group_name, std::min<size_t>(n, LOG_HISTORY_PER_KEY));
+    if (history.empty()) {
+        send_to(client, concat_payload({"No history for group ", group_name, ".\n"}));
+        return;
+    }
+    send_replay(s, history);
+}
+
+void missed_messages(const Session& s) {
+    uint64_t last = 0;
+    std::vector<Payload> missed = message_log->mailbox(s.username, last);
+    if (missed.empty()) {
+        send_to(s.id, NO_MISSED);
+    } else {
+        send_replay(s, missed);
+    }
+    // Even when nothing could be read back, so the login notice stops
+    if (last != 0) {
+        message_log->ack(s.username, last);
+    }
+}
+
+// ----------------- Cluster Links ---------------------
+// Everything below runs on the link thread. A peer's records describe only
+// its own users and groups, so losing a link forgets exactly that.
+void receive_record(size_t peer, LinkRecord type, std::string_view key, std::string_view body) {
+    switch (type) {
+        case LinkRecord::Join:
+            remote_users.insert(std::string(key), static_cast<uint32_t>(peer));
+            if (!body.empty()) {
+                queue_presence(key, true, 0);
+            }
+            break;
+        case LinkRecord::Leave:
+            remote_users.erase(std::string(key), static_cast<uint32_t>(peer));
+            if (!body.empty()) {
+                queue_presence(key, false, 0);
+            }
+            break;
+        case LinkRecord::Broadcast:
+            broadcast_message(concat_payload({body}), 0);
+            break;
+        case LinkRecord::Direct:
+            // Sent to the node the recipient was on, or to its home node
+            // when it was offline; either way it may have moved since
+            if (auto recipient_id = registry.find(key)) {
+                send_to(*recipient_id, concat_payload({body}));
+            } else if (message_log) {
+                message_log->append(LogKind::PrivateMessage, key, body);
+            }
+            break;
+        case LinkRecord::GroupCreate:
+            groups.ensure(key);
+            break;
+        case LinkRecord::GroupSubscribe:
+            groups.ensure(key)->peers.fetch_or(1ull << peer, std::memory_order_acq_rel);
+            break;
+        case LinkRecord::GroupUnsubscribe:
+            if (auto group = groups.find(key)) {
+                group->peers.fetch_and(~(1ull << peer), std::memory_order_acq_rel);
+            }
+            break;
+        case LinkRecord::GroupMessage:
+            if (auto group = groups.find(key)) {
+                FanOut out(concat_payload({body}));
+                GroupTable<SessionId>::for_each_member(*group, [&](SessionId id) {
+                    out.add(id);
+                });
+                out.send();
+                if (message_log) {
+                    message_log->append(LogKind::GroupMessage, key, body);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// A new link starts with everything the peer needs to know about us. Each
+// record is queued under the lock the live updates to the same user or
+// group are queued under, so a Leave or Unsubscribe queued meanwhile
+// always follows the snapshot record it supersedes.
+void send_snapshot(size_t peer) {
+    auto topo = cluster->topology();
+    registry.for_each([&](const std::string& username, SessionId) {
+        cluster->send(*topo, peer, LinkRecord::Join, username, nullptr);
+    });
+    groups.for_each([&](const std::string& name, const GroupTable<SessionId>::Group& group) {
+        cluster->send(*topo, peer, LinkRecord::GroupCreate, name, nullptr);
+        GroupTable<SessionId>::if_occupied(group, [&] {
+            cluster->send(*topo, peer, LinkRecord::GroupSubscribe, name, nullptr);
+        });
+    });
+}
+
+// Forgets the users and group subscriptions of the peers in mask.
+void forget_peers(uint64_t mask) {
+    std::vector<std::pair<std::string, uint32_t>> gone;
+    remote_users.for_each([&](const std::string& username, uint32_t node) {
+        if (mask & (1ull << node)) {
+            gone.emplace_back(username, node);
+        }
+    });
+    for (const auto& [username, node] : gone) {
+        remote_users.erase(username, node);
+    }
+    groups.for_each([&](const std::string&, GroupTable<SessionId>::Group& group) {
+        group.peers.fetch_and(~mask, std::memory_order_acq_rel);
+    });
+}
+
+const Payload HOME_MOVED = make_payload("Your home node has changed; please reconnect.\n");
+
+// The cluster file changed. Node indices may mean other nodes now, so all
+// remote state goes (the links are re-established and resend it), and users
+// whose home moved away are disconnected to log in again there.
+void change_topology() {
+    auto topo = cluster->topology();
+    forget_peers(UINT64_MAX);
+    std::vector<SessionList> moved(workers.size());
+    registry.for_each([&](const std::string& username, SessionId id) {
+        if (!topo->is_local(username)) {
+            moved[worker_of(id)].push_back(id);
+        }
+    });
+    for (size_t w = 0; w < moved.size(); ++w) {
+        if (!moved[w].empty()) {
+            post(*workers[w], Delivery{std::move(moved[w]), HOME_MOVED, 0, true});
+        }
+    }
+    std::lock_guard<std::mutex> lock(cout_mutex);
+    std::cout << "Cluster now has " << topo->nodes.size() << " node(s)" << std::endl;
+}
+
+// ----------------- Command Dispatch -------------------
+void count_command(Command c) {
+    self->metrics.commands[static_cast<size_t>(c)].add();
+}
+
+// parse_command() hands back views into the frame, so nothing is copied
+// until a reply or delivery is formatted.
+void run_command(Session& s, const ParsedCommand& cmd) {
+    SessionId client = s.id;
+
+    switch (cmd.command) {
+        case Command::Broadcast:
+            // e.g. "Broadcast: Hello, everyone!"
+            // But the example doesn't strictly show broadcast usage, so we'll keep it:
+            send_to(client, concat_payload({"You broadcasted: ", cmd.body, "\n"}));
+            {
+                Payload message = concat_payload({"Broadcast: ", cmd.body, "\n"});
+                broadcast_message(message, client);
+                publish(LinkRecord::Broadcast, {}, message);
+            }
+            break;
+        case Command::Msg:
+            if (cmd.malformed) {
+                send_to(client, MSG_USAGE);
+            } else {
+                // e.g. "[ bob ]: hey!"
+                private_message(client, s.username, cmd.target, cmd.body);
+            }
+            break;
+        case Command::CreateGroup:
+            create_group(cmd.target, s);
+            break;
+        case Command::JoinGroup:
+            join_group(cmd.target, s);
+            break;
+        case Command::LeaveGroup:
+            leave_group(cmd.target, s);
+            break;
+        case Command::GroupMsg:
+            if (cmd.malformed) {
+                send_to(client, GROUP_MSG_USAGE);
+            } else {
+                group_message(cmd.target, cmd.body, client);
+            }
+            break;
+        case Command::History:
+            if (!message_log) {
+                send_to(client, HISTORY_DISABLED);
+            } else {
+                group_history(cmd.target, cmd.body, s);
+            }
+            break;
+        case Command::Missed:
+            if (!message_log) {
+                send_to(client, HISTORY_DISABLED);
+            } else {
+                missed_messages(s);
+            }
+            break;
+        case Command::Presence:
+            if (cmd.target == "on" || cmd.target == "off") {
+                s.presence = cmd.target == "on";
+                send_to(client, s.presence ? PRESENCE_ON : PRESENCE_OFF);
+            } else {
+                send_to(client, PRESENCE_USAGE);
+            }
+            break;
+        case Command::Compress:
+            // The reply is short, so it is never compressed itself
+            if (cmd.target == "on" || cmd.target == "off") {
+                s.compress = cmd.target == "on";
+                send_to(client, s.compress ? COMPRESS_ON : COMPRESS_OFF);
+            } else {
+                send_to(client, COMPRESS_USAGE);
+            }
+            break;
+        case Command::Pong:
+            break;  // heartbeat answer; receiving it was the point
+        default:
+            send_to(client, UNKNOWN_COMMAND);
+            break;
+    }
+}
+
+// ----------------- Rate Limits -----------------------
+// A command costs one token plus one per delivery it causes, so a broadcast
+// is charged for every recipient. It is admitted while the sender's bucket
+// and its worker's share of the server-wide bucket are out of debt, then
+// charged what it really sent. Both buckets are owned by this worker and
+// the clock is the batch's read time, so a check takes no lock or syscall.
+const Payload RATE_LIMITED = make_payload("Rate limit exceeded; slow down.\n");
+const Payload SERVER_BUSY = make_payload("Server busy; try again later.\n");
+
+bool admit(Session& s, Command c) {
+    if (c == Command::Pong) {
+        return true;  // heartbeat answers keep the session alive
+    }
+    uint64_t now = self->batch_recv_ns;
+    if (config.user_rate > 0 && !s.bucket.admit(now, config.user_rate, config.user_burst)) {
+        self->metrics.throttled[static_cast<size_t>(c)].add();
+        send_to(s.id, RATE_LIMITED);
+        return false;
+    }
+    if (config.server_rate > 0) {
+        double rate = config.server_rate / workers.size();
+        if (!self->admission.admit(now, rate, rate * SERVER_BURST_MS / 1000)) {
+            self->metrics.rejected[static_cast<size_t>(c)].add();
+            send_to(s.id, SERVER_BUSY);
+            return false;
+        }
+    }
+    return true;
+}
+
+void handle_command(Session& s, std::string_view input) {
+    // Only a binary frame can carry these. Formatted into a delivery, a
+    // newline would end the line early and let the rest pose as a message
+    // of its own, or, followed by a NUL, as a compressed frame (lz.h).
+    if (input.find_first_of(std::string_view("\n\0", 2)) != std::string_view::npos) {
+        send_to(s.id, BAD_BYTES);
+        return;
+    }
+    ParsedCommand cmd = parse_command(input);
+    count_command(cmd.command);
+    if (!admit(s, cmd.command)) {
+        return;
+    }
+    uint64_t before = self->deliveries;
+    run_command(s, cmd);
+    double cost = 1 + static_cast<double>(self->deliveries - before);
+    s.bucket.charge(cost);
+    self->admission.charge(cost);
+}
+
+// ----------------- Client Handler ---------------------
+// Feeds one frame through the session's state machine.
+void process_input(Session& s, std::string_view input) {
+    if (s.state != SessionState::Active) {
+        // 1) Authenticate
+        if (!authenticate_client(s, input)) {
+            close_session(s);
+        }
+        return;
+    }
+
+    // 3) Communication
+    self->pending_command.push_back(self->batch_recv_ns);
+    handle_command(s, input);
+}
+
+void process_frames(Session& s);
+
+// Runs on the session's worker once the verifier has checked its password.
+void finish_login(Session& s, bool ok) {
+    if (!ok) {
+        // Examples show "Authentication failed ." rather than "Disconnecting..."
+        self->metrics.auth_failures.add();
+        send_to(s.id, AUTH_FAILED);
+        close_session(s);
+        return;
+    }
+    // According to examples, we show "Welcome to the chat server !"
+    send_to(s.id, WELCOME);
+    s.state = SessionState::Active;
+
+    // 2) Register the session under its username and announce to others
+    // that <username> has joined the chat
+    register_user(s.username, s.id);
+    arm_activity(s);
+
+    if (message_log) {
+        if (size_t n = message_log->mailbox_size(s.username)) {
+            send_to(s.id, "You have " + std::to_string(n) + " missed message(s). Use /missed to read them.\n");
+        }
+    }
+    // Commands the client sent without waiting for the welcome
+    process_frames(s);
+}
+
+// Runs every complete frame currently buffered, so one read can carry any
+// number of pipelined commands. None run while a password is being checked.
+void process_frames(Session& s) {
+    while (!s.closing && s.state != SessionState::Verifying) {
+        std::string_view frame;
+        size_t consumed = 0;
+        FrameStatus status = next_frame(s.inbuf, MAX_FRAME_SIZE, self->frame_scratch, frame, consumed);
+        if (status == FrameStatus::Incomplete) {
+            return;
+        }
+        if (status == FrameStatus::Oversized) {
+            send_to(s.id, "Message too long.\n");
+            close_session(s);
+            return;
+        }
+        process_input(s, frame);
+        s.inbuf.consume(consumed);
+    }
+}
+
+// Drains the socket: with EPOLLET there is no second notification for data
+// left behind, so read until the kernel reports EAGAIN.
+void handle_client(Session& s) {
+    while (!s.closing) {
+        if (!s.inbuf.reserve(BUFFER_SIZE, RX_MAX_CAPACITY)) {
+            // Full ring without a complete frame; next_frame reports this
+            // as Oversized before we get here, so treat it the same way.
+            close_session(s);
+            return;
+        }
+        struct iovec iov[2];
+        int iovcnt = s.inbuf.writable_iov(iov);
+        ssize_t bytes_read = readv(s.fd, iov, iovcnt);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) close_session(s);
+            break;
+        }
+        if (bytes_read == 0) {
+            // user disconnected
+            close_session(s);
+            break;
+        }
+        s.inbuf.commit(bytes_read);
+        self->metrics.bytes_in.add(bytes_read);
+        self->batch_recv_ns = now_ns();
+        s.last_input = to_tick(self->batch_recv_ns);
+        process_frames(s);
     }
-    return str.substr(start, end - start + 1);
+    s.inbuf.shrink();
 }
 
-void load_users(const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file) {
-        std::cerr << "Failed to open " << filename << std::endl;
-        exit(1);
+// Tears down sessions marked during the last batch. Deferring the close keeps
+// fds from being reused while events for them may still be pending.
+void reap_sessions() {
+    Worker& w = *self;
+    bool uring = config.io_backend == IoBackend::Uring;
+    if (uring && !w.closing_sessions.empty()) {
+        // Hand the kernel every SQE naming these fds before the numbers
+        // can be reused
+        w.ring.submit_and_wait(0);
     }
+    for (size_t i = 0; i < w.closing_sessions.size(); ++i) {
+        auto it = w.sessions.find(w.closing_sessions[i]);
+        if (it == w.sessions.end()) {
+            continue;
+        }
+        std::unique_ptr<Session> s = std::move(it->second);
+        w.sessions.erase(it);
+        // Best effort, e.g. "Authentication failed ."; never past a send
+        // that io_uring still has in flight
+        if (s->sends_inflight == 0) {
+            write_now(*s);
+        }
+        s->deadline.cancel();
+        s->stall.cancel();
+        w.metrics.queued_bytes.add(-static_cast<int64_t>(s->outq.bytes()));
+        w.metrics.sessions.add(-1);
+        if (uring) {
+            // Ends the multishot recv and any pending send; their
+            // completions arrive with the session already retired
+            shutdown(s->fd, SHUT_RDWR);
+        } else {
+            epoll_ctl(w.epoll_fd, EPOLL_CTL_DEL, s->fd, nullptr);
+        }
+        close(s->fd);
 
-    std::string line;
-    while (std::getline(file, line)) {
-        size_t delimiter = line.find(':');
-        if (delimiter != std::string::npos) {
-            std::string username = line.substr(0, delimiter);
-            std::string password = line.substr(delimiter + 1);
-            users[username] = password;
+        if (s->state == SessionState::Active) {
+            // unregister and announce user left
+            unregister_user(s->username, s->id);
+            leave_all_groups(*s);
+            {
+                std::lock_guard<std::mutex> lock(cout_mutex);
+                std::cout << "Client disconnected: " << s->username << std::endl;
+            }
+        }
+        if (s->recv_armed || s->sends_inflight > 0) {
+            // The kernel may still read its iovecs
+            w.retired.emplace(s->id, std::move(s));
         }
     }
-    file.close();
-    std::cout << "Users loaded successfully!" << std::endl;
+    w.closing_sessions.clear();
 }
 
-// ----------------- Authentication --------------------
-bool authenticate_client(int client_socket, std::string &username_out) {
-    char buffer[BUFFER_SIZE] = {0};
+// ----------------- Metrics Endpoint ------------------
+int metrics_fd = -1;
 
-    // Prompt for username
-    std::string prompt = "Connected to the server .\nEnter username : ";
-    send(client_socket, prompt.c_str(), prompt.size(), 0);
-    if (recv(client_socket, buffer, BUFFER_SIZE, 0) <= 0) {
-        return false; // client disconnected or error
-    }
-    username_out = trim(buffer);
-
-    // Prompt for password
-    memset(buffer, 0, BUFFER_SIZE);
-    prompt = "Enter password : ";
-    send(client_socket, prompt.c_str(), prompt.size(), 0);
-    if (recv(client_socket, buffer, BUFFER_SIZE, 0) <= 0) {
-        return false;
+// Sums every worker's metrics into Prometheus text exposition format.
+std::string render_metrics() {
+    std::ostringstream os;
+    auto sum = [](auto get) {
+        int64_t total = 0;
+        for (auto& w : workers) total += get(w->metrics);
+        return total;
+    };
+    auto counter = [&](const char* name, const char* type, const char* help, auto get) {
+        write_metric_header(os, name, type, help);
+        os << name << ' ' << sum(get) << '\n';
+    };
+
+    write_metric_header(os, "chat_commands_total", "counter", "Commands handled, by command.");
+    for (size_t c = 0; c < static_cast<size_t>(Command::COUNT); ++c) {
+        os << "chat_commands_total{command=\"" << COMMAND_NAMES[c] << "\"} "
+           << sum([c](const WorkerMetrics& m) { return m.commands[c].get(); }) << '\n';
     }
-    std::string password = trim(buffer);
+    counter("chat_connections_accepted_total", "counter", "Connections accepted.",
+            [](const WorkerMetrics& m) { return m.accepted.get(); });
+    counter("chat_auth_failures_total", "counter", "Failed logins.",
+            [](const WorkerMetrics& m) { return m.auth_failures.get(); });
+    counter("chat_sessions", "gauge", "Open connections.",
+            [](const WorkerMetrics& m) { return m.sessions.get(); });
+    counter("chat_bytes_received_total", "counter", "Bytes read from clients.",
+            [](const WorkerMetrics& m) { return m.bytes_in.get(); });
+    counter("chat_bytes_sent_total", "counter", "Bytes written to clients.",
+            [](const WorkerMetrics& m) { return m.bytes_out.get(); });
+    counter("chat_outbound_queued_bytes", "gauge", "Bytes waiting in outbound queues.",
+            [](const WorkerMetrics& m) { return m.queued_bytes.get(); });
+    counter("chat_group_memberships", "gauge", "Group memberships of connected sessions.",
+            [](const WorkerMetrics& m) { return m.memberships.get(); });
+    counter("chat_outbound_dropped_total", "counter", "Messages dropped for slow consumers.",
+            [](const WorkerMetrics& m) { return m.dropped.get(); });
+    counter("chat_slow_consumer_disconnects_total", "counter", "Clients closed for exceeding the outbound budget.",
+            [](const WorkerMetrics& m) { return m.slow_disconnects.get(); });
+    counter("chat_mailbox_deliveries_total", "counter", "Cross-worker deliveries received.",
+            [](const WorkerMetrics& m) { return m.mailbox_deliveries.get(); });
+    counter("chat_presence_digests_total", "counter", "Presence digests sent, one per window with changes.",
+            [](const WorkerMetrics& m) { return m.presence_digests.get(); });
+    counter("chat_auth_timeouts_total", "counter", "Connections closed for not logging in within --auth-timeout-ms.",
+            [](const WorkerMetrics& m) { return m.auth_timeouts.get(); });
+    counter("chat_idle_timeouts_total", "counter", "Clients closed for sending nothing within --idle-timeout-ms.",
+            [](const WorkerMetrics& m) { return m.idle_timeouts.get(); });
+    counter("chat_heartbeats_total", "counter", "PINGs sent to silent clients.",
+            [](const WorkerMetrics& m) { return m.heartbeats.get(); });
+    counter("chat_stall_disconnects_total", "counter", "Clients closed for output that did not move within --stall-timeout-ms.",
+            [](const WorkerMetrics& m) { return m.stall_disconnects.get(); });
+    counter("chat_compressed_deliveries_total", "counter", "Deliveries sent as compressed frames.",
+            [](const WorkerMetrics& m) { return m.compressed.get(); });
+    counter("chat_compression_saved_bytes_total", "counter", "Bytes compression kept off the wire.",
+            [](const WorkerMetrics& m) { return m.compress_saved.get(); });
 
-    // Validate
-    if (users.find(username_out) != users.end() && users[username_out] == password) {
-        // According to examples, we show "Welcome to the chat server !"
-        std::string welcome = "Welcome to the chat server !\n";
-        send(client_socket, welcome.c_str(), welcome.size(), 0);
-        return true;
-    } else {
-        // Examples show "Authentication failed ." rather than "Disconnecting..."
-        std::string failure = "Authentication failed .\n";
-        send(client_socket, failure.c_str(), failure.size(), 0);
-        return false;
+    write_metric_header(os, "chat_throttled_total", "counter", "Commands refused by the sender's --user-rate, by command.");
+    for (size_t c = 0; c < static_cast<size_t>(Command::COUNT); ++c) {
+        os << "chat_throttled_total{command=\"" << COMMAND_NAMES[c] << "\"} "
+           << sum([c](const WorkerMetrics& m) { return m.throttled[c].get(); }) << '\n';
+    }
+    write_metric_header(os, "chat_admission_rejected_total", "counter", "Commands refused by --server-rate, by command.");
+    for (size_t c = 0; c < static_cast<size_t>(Command::COUNT); ++c) {
+        os << "chat_admission_rejected_total{command=\"" << COMMAND_NAMES[c] << "\"} "
+           << sum([c](const WorkerMetrics& m) { return m.rejected[c].get(); }) << '\n';
     }
-}
 
-// ----------------- Announcements ---------------------
-void announce_user_join(const std::string& username, int joining_socket) {
-    // Example: "bob has joined the chat ."
-    std::lock_guard<std::mutex> lock(clients_mutex);
-    std::string msg = username + " has joined the chat .\n";
+    Histogram::Snapshot fanout, command, remote;
+    for (auto& w : workers) {
+        w->metrics.fanout.merge_into(fanout);
+        w->metrics.command_latency.merge_into(command);
+        w->metrics.remote_latency.merge_into(remote);
+    }
+    write_histogram(os, "chat_fanout_recipients", "Recipients per broadcast, group message or announcement.", fanout, 1);
+    write_histogram(os, "chat_command_latency_seconds", "Read of a command to the writev of its batch.", command, 1e-9);
+    write_histogram(os, "chat_remote_delivery_latency_seconds", "Read of a command to the writev on another worker.", remote, 1e-9);
+
+    if (cluster) {
+        auto line = [&](const char* name, const char* type, const char* help, int64_t value) {
+            write_metric_header(os, name, type, help);
+            os << name << ' ' << value << '\n';
+        };
+        line("chat_cluster_links_up", "gauge", "Outbound links to other nodes that are connected.", cluster->links_up.get());
+        line("chat_cluster_records_sent_total", "counter", "Records sent to other nodes.", cluster->records_sent.get());
+        line("chat_cluster_batches_sent_total", "counter", "Batch frames sent to other nodes.", cluster->batches_sent.get());
+        line("chat_cluster_bytes_sent_total", "counter", "Bytes written to other nodes.", cluster->bytes_sent.get());
+        line("chat_cluster_records_received_total", "counter", "Records received from other nodes.", cluster->records_received.get());
+        line("chat_cluster_records_held_total", "counter", "Messages held for a node whose link was down.", cluster->records_held.get());
+        line("chat_cluster_records_dropped_total", "counter", "Records superseded by a snapshot or past a link's backlog.", cluster->records_dropped.get());
+        line("chat_cluster_remote_users", "gauge", "Users logged in on other nodes.", remote_users.size());
+    }
+    return os.str();
+}
 
-    // Send this to all other connected clients
-    for (auto& [sock, uname] : clients) {
-        if (sock != joining_socket) {
-            send(sock, msg.c_str(), msg.size(), 0);
+// Each connection to the metrics socket gets one scrape and is closed.
+void serve_metrics() {
+    while (true) {
+        int fd = accept4(metrics_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        std::string text = render_metrics();
+        size_t off = 0;
+        while (off < text.size()) {
+            ssize_t n = write(fd, text.data() + off, text.size() - off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            off += n;
         }
+        close(fd);
     }
 }
 
-void announce_user_leave(const std::string& username) {
-    // e.g., "frank has left the chat ."
-    std::lock_guard<std::mutex> lock(clients_mutex);
-    std::string msg = username + " has left the chat .\n";
-    for (auto& [sock, uname] : clients) {
-        send(sock, msg.c_str(), msg.size(), 0);
+int create_unix_listener(const std::string& path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        close(fd);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return -1;
     }
+    return fd;
 }
 
-// ----------------- Broadcast -------------------------
-void broadcast_message(const std::string& message, int sender_socket) {
-    std::lock_guard<std::mutex> lock(clients_mutex);
-    for (const auto& [client_socket, user] : clients) {
-        if (client_socket != sender_socket) {
-            send(client_socket, message.c_str(), message.size(), 0);
+// ----------------- Credential Reload -----------------
+// SIGHUP re-maps the credential index and, in cluster mode, re-reads the
+// cluster file. The signal is blocked in every thread and read from a
+// signalfd on worker 0, so the reload runs on an event loop like any other
+// event; mapping a new index takes no parse, so that worker stalls only for
+// an open and an mmap. The link thread applies a new cluster file itself.
+int reload_fd = -1;
+
+void reload_credentials() {
+    signalfd_siginfo info;
+    while (read(reload_fd, &info, sizeof(info)) == sizeof(info)) {
+    }
+    load_credentials(config.credentials);
+    if (cluster) {
+        std::string error;
+        if (!cluster->reload(error)) {
+            std::cerr << "Failed to reload cluster: " << error << std::endl;
         }
     }
 }
 
-// ----------------- Private Messaging -----------------
-void private_message(const std::string& sender, const std::string& recipient, const std::string& message) {
-    // Example target: "[ bob ]: alice great , I will join"
-    // but from the perspective of the receiving user, it should be: "[ alice ]: <message>"
-    std::lock_guard<std::mutex> lock(clients_mutex);
+// Call before any worker thread starts so they all inherit the mask.
+int create_reload_signal() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
 
-    if (usernames.find(recipient) != usernames.end()) {
-        int recipient_socket = usernames[recipient];
-        std::string full_message = "[ " + sender + " ]: " + message + "\n";
-        send(recipient_socket, full_message.c_str(), full_message.size(), 0);
-    } else {
-        int sender_socket = usernames[sender];
-        std::string error_msg = "User " + recipient + " is not connected.\n";
-        send(sender_socket, error_msg.c_str(), error_msg.size(), 0);
+// ----------------- Hot Upgrade ------------------------
+// A new server_grp started with the same --upgrade-socket takes over from
+// the running one without any client reconnecting. The successor connects
+// to the socket; worker 0 of the running server accepts, and every worker
+// stops taking input at the end of its batch (quiesce()). Once mailboxes
+// are drained and output flushed, main sends a snapshot of the sessions and
+// groups along with each worker's listening socket and epoll instance and
+// every client's socket (handoff.h). The successor's worker i adopts the
+// old worker i's fds and sessions, ids included, so the sockets stay
+// registered under the tokens they had and nothing is re-added: the pause
+// does not grow with an epoll_ctl per client. Whatever clients send
+// meanwhile waits in the kernel. The successor acknowledges before it reads
+// from any client; if the handoff fails on either side, the old workers
+// start again and the successor exits. The old workers' other fds close when the
+// old process exits, which also takes them out of the adopted epoll sets;
+// until then, an event from one of them only looks like a spurious wakeup
+// of the successor's fd with the same token.
+// Only an epoll server can hand over: io_uring's multishot receives would
+// take data off the sockets, so a server on io_uring turns successors away
+// and they exit.
+int upgrade_fd = -1;                  // listening for a successor
+int successor_fd = -1;                // the successor, once one connected
+std::atomic<bool> upgrading{false};
+std::unique_ptr<std::barrier<>> upgrade_barrier;
+uint64_t paused_at = 0;               // now_ns() when input stopped; in a successor, the predecessor's
+
+void arm_recv(Session& s);
+
+// What a successor received; workers == 0 when there was no predecessor.
+struct Handoff {
+    int sock = -1;                    // to the predecessor, until it commits
+    std::string snapshot;
+    std::vector<int> fds;             // listener and epoll per worker, then one per session
+    uint32_t workers = 0;
+    uint64_t sessions = 0;
+};
+
+// Worker 0: a successor connected. Every worker is woken so it stops.
+void begin_upgrade() {
+    int fd = accept4(upgrade_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (config.io_backend == IoBackend::Uring) {
+        std::cerr << "Hot upgrade needs the epoll backend; successor turned away" << std::endl;
+        close(fd);
+        return;
+    }
+    if (successor_fd >= 0) {
+        close(fd);   // one successor at a time
+        return;
+    }
+    paused_at = now_ns();
+    successor_fd = fd;
+    upgrading.store(true, std::memory_order_release);
+    for (auto& w : workers) {
+        uint64_t one = 1;
+        ssize_t rc = write(w->wake_fd, &one, sizeof(one));
+        (void)rc;
     }
 }
 
-// ----------------- Group Management ------------------
-void create_group(const std::string& raw_group, int client_socket, const std::string& user) {
-    
-	(void)user;
-	// Example output: "Group CS425 created ."
-    std::string group_name = trim(raw_group);
-    std::lock_guard<std::mutex> lock(clients_mutex);
-
-    if (groups.find(group_name) != groups.end()) {
-        // If group exists
-        std::string err = "Group " + group_name + " already exists.\n";
-        send(client_socket, err.c_str(), err.size(), 0);
-    } else {
-        groups[group_name].insert(client_socket);
-        std::string msg = "Group " + group_name + " created .\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
+// At the end of every batch; true once w has stopped for a handoff. After
+// the first barrier nobody reads, so all that is left to deliver is what
+// the last batches produced: pending presence events and mail from other
+// workers. Worker 0 sends the digest, then every worker takes its mail and
+// flushes. A session that closes now is left out of the snapshot.
+bool quiesce(Worker& w) {
+    if (!upgrading.load(std::memory_order_acquire)) {
+        return false;
     }
+    upgrade_barrier->arrive_and_wait();
+    if (w.index == 0 && presence_fd >= 0) {
+        send_presence_digest();
+    }
+    upgrade_barrier->arrive_and_wait();
+    drain_mailbox(w);
+    flush_dirty_sessions();
+    return true;
 }
 
-void join_group(const std::string& raw_group, int client_socket, const std::string& user) {
-    
-	(void)user;
-	// Example output: "You joined the group CS425 ."
-    std::string group_name = trim(raw_group);
-    std::lock_guard<std::mutex> lock(clients_mutex);
+void save_session(SnapshotWriter& out, const Session& s) {
+    // A password still with the verifier is asked for again by the successor
+    bool verifying = s.state == SessionState::Verifying;
+    out.u64(s.id);
+    out.u8(static_cast<uint8_t>(verifying ? SessionState::AwaitPassword : s.state));
+    out.str(s.username);
+    out.u8(s.presence);
+    out.u8(s.compress);
+    out.u32(static_cast<uint32_t>(s.joined.size()));
+    for (GroupId g : s.joined) {
+        out.u32(g);
+    }
+    std::string scratch;
+    out.str(s.inbuf.view(0, s.inbuf.size(), scratch));   // an unfinished frame
+    std::vector<struct iovec> iov(s.outq.chunks());
+    int n = s.outq.gather(iov.data(), static_cast<int>(iov.size()));
+    std::string unsent;
+    unsent.reserve(s.outq.bytes());
+    for (int i = 0; i < n; ++i) {
+        unsent.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    if (verifying) {
+        unsent += "Enter password : ";
+    }
+    out.str(unsent);
+    out.u64(s.dropped);
+}
 
-    if (groups.find(group_name) == groups.end()) {
-        std::string err = "Group " + group_name + " does not exist.\n";
-        send(client_socket, err.c_str(), err.size(), 0);
-    } else {
-        if (groups[group_name].count(client_socket)) {
-            // Already in group
-            std::string info = "You joined the group " + group_name + " .\n";
-            send(client_socket, info.c_str(), info.size(), 0);
-        } else {
-            groups[group_name].insert(client_socket);
-            std::string msg = "You joined the group " + group_name + " .\n";
-            send(client_socket, msg.c_str(), msg.size(), 0);
+// Main thread, once every worker has quiesced. On success this process
+// exits and its sockets live on in the successor; on failure nothing has
+// been given up and resume_after_handoff() restarts the workers.
+bool hand_over() {
+    std::vector<const Session*> sessions;
+    for (auto& w : workers) {
+        for (auto& [id, s] : w->sessions) {
+            if (!s->closing) {
+                sessions.push_back(s.get());
+            }
         }
     }
+    SnapshotWriter out;
+    std::vector<int> fds;
+    out.u64(paused_at);
+    out.u32(static_cast<uint32_t>(workers.size()));
+    out.u64(sessions.size());
+    for (auto& w : workers) {
+        out.u64(w->next_seq);
+        fds.push_back(w->listen_fd);
+        fds.push_back(w->epoll_fd);
+    }
+    // In id order, so the successor interns them under the same ids
+    std::vector<std::string> names;
+    groups.for_each([&](const std::string& name, const auto&) { names.push_back(name); });
+    out.u32(static_cast<uint32_t>(names.size()));
+    for (const std::string& name : names) {
+        out.str(name);
+    }
+    for (const Session* s : sessions) {
+        save_session(out, *s);
+        fds.push_back(s->fd);
+    }
+    std::string error;
+    if (!send_handoff(successor_fd, out.data(), fds, error)) {
+        std::cerr << "Handoff failed: " << error << std::endl;
+        return false;
+    }
+    if (!handoff_await(successor_fd, HANDOFF_ACK)) {
+        std::cerr << "Handoff failed: the successor did not take over" << std::endl;
+        return false;
+    }
+    message_log.reset();   // synced and closed before the successor opens it
+    if (!handoff_reply(successor_fd, HANDOFF_COMMIT)) {
+        std::cerr << "Handoff failed: commit: " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::cout << "Handed over " << sessions.size() << " sessions (" << out.data().size()
+              << " bytes of state) " << (now_ns() - paused_at) / 1000 << " us after pausing.\n";
+    return true;
 }
 
-void leave_group(const std::string& raw_group, int client_socket, const std::string& user) {
-    
-	(void)user;
-	// "You left the group CS425 ."
-    std::string group_name = trim(raw_group);
-    std::lock_guard<std::mutex> lock(clients_mutex);
+// Main thread, after a failed handoff: the log is reopened if it was closed,
+// and the workers take input again. The next successor may try anew.
+void resume_after_handoff() {
+    close(successor_fd);
+    successor_fd = -1;
+    if (!message_log && !config.log.dir.empty()) {
+        message_log = std::make_unique<MessageLog>();
+        std::string error;
+        if (!message_log->open(config.log, error)) {
+            std::cerr << "Failed to reopen message log, history is off: " << error << std::endl;
+            message_log.reset();
+        }
+    }
+    upgrading.store(false, std::memory_order_release);
+    std::cout << "Serving on after " << (now_ns() - paused_at) / 1000 << " us paused.\n";
+}
 
-    if (groups.find(group_name) == groups.end() ||
-        groups[group_name].count(client_socket) == 0) {
-        std::string err = "You are not a member of the group " + group_name + ".\n";
-        send(client_socket, err.c_str(), err.size(), 0);
-    } else {
-        groups[group_name].erase(client_socket);
-        std::string msg = "You left the group " + group_name + " .\n";
-        send(client_socket, msg.c_str(), msg.size(), 0);
+// Successor, before its workers exist: connects to a running server and
+// receives its state. False if one answered but the handoff failed; the
+// predecessor is told, and serves on.
+bool take_over(const std::string& path, Handoff& h) {
+    int sock = handoff_connect(path);
+    if (sock < 0) {
+        return true;   // nobody to take over from
+    }
+    std::string error;
+    bool ok = receive_handoff(sock, h.snapshot, h.fds, error);
+    SnapshotReader in(h.snapshot);
+    paused_at = in.u64();
+    h.workers = in.u32();
+    h.sessions = in.u64();
+    if (ok && (!in.ok() || h.workers == 0 || h.fds.size() != 2ull * h.workers + h.sessions)) {
+        ok = false;
+        error = "bad snapshot";
     }
+    if (!ok) {
+        handoff_reply(sock, HANDOFF_NAK);
+        close(sock);
+        for (int fd : h.fds) {
+            close(fd);
+        }
+        h.workers = 0;
+        std::cerr << "Handoff failed: " << error << std::endl;
+        return false;
+    }
+    h.sock = sock;
+    return true;
 }
 
-void group_message(const std::string& raw_group, const std::string& raw_message,
-                   int sender_socket, const std::string& sender_name)
-{
-	(void)sender_name;
-    // Example output: "[ Group CS425 ]: Hi , Welcome to CS425"
-    std::string group_name = trim(raw_group);
-    std::string message = trim(raw_message);
+// Successor, once its workers have adopted everything and before any of
+// them reads: acknowledges, and waits for the predecessor to let go.
+bool confirm_takeover(Handoff& h) {
+    bool ok = handoff_reply(h.sock, HANDOFF_ACK) && handoff_await(h.sock, HANDOFF_COMMIT);
+    close(h.sock);
+    h.sock = -1;
+    if (!ok) {
+        std::cerr << "Handoff failed: the predecessor did not commit; it serves on" << std::endl;
+    }
+    return ok;
+}
 
-    std::lock_guard<std::mutex> lock(clients_mutex);
-    if (groups.find(group_name) == groups.end() ||
-        groups[group_name].find(sender_socket) == groups[group_name].end()) {
-        std::string err = "You are not a member of the group " + group_name + ".\n";
-        send(sender_socket, err.c_str(), err.size(), 0);
+// Adopts one session under the id it had; its socket is already in the
+// owning worker's epoll set.
+void restore_session(int fd, SnapshotReader& in) {
+    auto s = std::make_unique<Session>();
+    s->id = in.u64();
+    s->fd = fd;
+    s->deadline.id = s->stall.id = s->id;
+    uint8_t state = in.u8();
+    s->username = in.str();
+    s->presence = in.u8();
+    s->compress = in.u8();
+    uint32_t count = in.u32();
+    std::vector<GroupId> joined;
+    for (uint32_t i = 0; i < count && in.ok(); ++i) {
+        joined.push_back(in.u32());
+    }
+    std::string_view unframed = in.str();
+    std::string_view unsent = in.str();
+    s->dropped = in.u64();
+    if (!in.ok() || worker_of(s->id) >= workers.size() || state > static_cast<uint8_t>(SessionState::Active) ||
+        !s->inbuf.reserve(unframed.size(), RX_MAX_CAPACITY)) {
+        close(fd);
         return;
     }
-    std::string formatted_msg = "[ Group " + group_name + " ]: " + message + "\n";
-    for (int member_socket : groups[group_name]) {
-        if (member_socket != sender_socket) {
-            send(member_socket, formatted_msg.c_str(), formatted_msg.size(), 0);
+    Worker& w = *workers[worker_of(s->id)];
+    self = &w;
+    s->state = static_cast<SessionState>(state);
+    if (!unframed.empty()) {
+        // A fresh ring is contiguous
+        struct iovec iov[2];
+        s->inbuf.writable_iov(iov);
+        memcpy(iov[0].iov_base, unframed.data(), unframed.size());
+        s->inbuf.commit(unframed.size());
+    }
+    if (!unsent.empty()) {
+        s->outq.push(make_payload(std::string(unsent)), SIZE_MAX);
+        w.metrics.queued_bytes.add(unsent.size());
+        s->dirty = true;
+        w.dirty_sessions.push_back(s->id);
+    }
+    for (GroupId g : joined) {
+        auto group = groups.find(g);
+        if (group && GroupTable<SessionId>::join(*group, s->id)) {
+            GroupTable<SessionId>::insert(s->joined, g);
+            w.metrics.memberships.add(1);
         }
     }
+    s->last_input = to_tick(now_ns());
+    if (s->state == SessionState::Active) {
+        registry.insert(s->username, s->id);
+        arm_activity(*s);
+    } else {
+        arm_login_deadline(*s);   // the login starts over its time
+    }
+    w.metrics.sessions.add(1);
+    w.sessions[s->id] = std::move(s);
 }
 
-// ----------------- Client Handler ---------------------
-void handle_client(int client_socket) {
-    char buffer[BUFFER_SIZE] = {0};
+// Successor, once its workers exist: recreates the groups and the sessions.
+// Nobody is told: to the other users nothing has changed.
+void restore_state(const Handoff& h) {
+    SnapshotReader in(h.snapshot);
+    in.u64();
+    in.u32();
+    in.u64();
+    for (uint32_t i = 0; i < h.workers; ++i) {
+        workers[i]->next_seq = in.u64();   // ids are never reused
+        workers[i]->sessions.reserve(h.sessions / h.workers);
+    }
+    uint32_t group_count = in.u32();
+    for (uint32_t i = 0; i < group_count && in.ok(); ++i) {
+        groups.ensure(in.str());
+    }
+    for (uint64_t i = 0; i < h.sessions; ++i) {
+        restore_session(h.fds[2 * h.workers + i], in);
+    }
+    self = nullptr;
+    if (!in.done()) {
+        std::cerr << "Handoff: snapshot damaged; some sessions were dropped" << std::endl;
+    }
+}
 
-    // 1) Authenticate
-    std::string username;
-    if (!authenticate_client(client_socket, username)) {
-        close(client_socket);
-        return; // invalid or disconnected
+// At the top of each loop: sessions taken over from a predecessor start
+// receiving and get the output it left queued.
+void resume_sessions(Worker& w) {
+    if (config.io_backend == IoBackend::Uring) {
+        for (auto& [id, s] : w.sessions) {
+            arm_recv(*s);
+        }
+    }
+    flush_dirty_sessions();
+}
+
+// ----------------- Event Loop ------------------------
+// Takes ownership of an accepted socket and prompts for a username.
+void open_session(Worker& w, int fd) {
+    auto s = std::make_unique<Session>();
+    s->id = (static_cast<SessionId>(w.index) << WORKER_SHIFT) | ++w.next_seq;
+    s->fd = fd;
+    s->deadline.id = s->stall.id = s->id;
+
+    if (config.io_backend == IoBackend::Epoll) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = s->id;
+        if (epoll_ctl(w.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            return;
+        }
     }
+    SessionId id = s->id;
+    Session& session = *s;
+    w.sessions[id] = std::move(s);
+    w.metrics.accepted.add();
+    w.metrics.sessions.add(1);
+    if (config.io_backend == IoBackend::Uring) {
+        arm_recv(session);
+    }
+    arm_login_deadline(session);
 
-    // 2) Add to global maps
     {
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        clients[client_socket] = username;
-        usernames[username] = client_socket;
+        std::lock_guard<std::mutex> lock(cout_mutex);
+        std::cout << "Client connected successfully!\n";
     }
 
-    // 3) Announce to others that <username> has joined the chat
-    announce_user_join(username, client_socket);
+    // Prompt for username
+    send_to(id, "Connected to the server .\nEnter username : ");
+}
 
-    // 4) Communication loop
+void accept_clients(Worker& w) {
     while (true) {
-        memset(buffer, 0, BUFFER_SIZE);
-        int bytes_read = recv(client_socket, buffer, BUFFER_SIZE, 0);
-        if (bytes_read <= 0) {
-            // user disconnected
-            {
-                std::lock_guard<std::mutex> lock(clients_mutex);
-                usernames.erase(clients[client_socket]);
-                clients.erase(client_socket);
+        int new_socket = accept4(w.listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Failed to accept connection: " << strerror(errno) << std::endl;
             }
-            close(client_socket);
+            return;
+        }
+        open_session(w, new_socket);
+    }
+}
 
-            // announce user left
-            announce_user_leave(username);
-            {
-                std::lock_guard<std::mutex> lock(cout_mutex);
-                std::cout << "Client disconnected: " << username << std::endl;
-            }
-            break;
+void run_event_loop(Worker& w) {
+    epoll_event events[MAX_EVENTS];
+
+    resume_sessions(w);
+    while (true) {
+        int n = epoll_wait(w.epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+            return;
         }
 
-        std::string msg = trim(buffer);
+        for (int i = 0; i < n; ++i) {
+            uint64_t token = events[i].data.u64;
+            if (token == LISTEN_TOKEN) {
+                accept_clients(w);
+                continue;
+            }
+            if (token == WAKE_TOKEN) {
+                drain_mailbox(w);
+                continue;
+            }
+            if (token == METRICS_TOKEN) {
+                serve_metrics();
+                continue;
+            }
+            if (token == RELOAD_TOKEN) {
+                reload_credentials();
+                continue;
+            }
+            if (token == PRESENCE_TOKEN) {
+                send_presence_digest();
+                continue;
+            }
+            if (token == TIMER_TOKEN) {
+                run_timers(w);
+                continue;
+            }
+            if (token == UPGRADE_TOKEN) {
+                begin_upgrade();
+                continue;
+            }
 
-        // ------------------- Broadcast ------------------
-        if (msg.rfind("/broadcast ", 0) == 0) {
-            std::string broadcast_msg = trim(msg.substr(11));
-            // e.g. "Broadcast: Hello, everyone!"
-            // But the example doesn't strictly show broadcast usage, so we'll keep it:
-            std::string ack_msg = "You broadcasted: " + broadcast_msg + "\n";
-            send(client_socket, ack_msg.c_str(), ack_msg.size(), 0);
+            auto it = w.sessions.find(token);
+            if (it == w.sessions.end()) {
+                continue;
+            }
+            Session& s = *it->second;
+            uint32_t ev = events[i].events;
 
-            std::string formatted = "Broadcast: " + broadcast_msg + "\n";
-            broadcast_message(formatted, client_socket);
-            continue;
+            if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                handle_client(s);
+            }
+            if ((ev & EPOLLOUT) && !s.closing) {
+                flush_session(s);
+            }
         }
 
-        // ------------------- Private Msg ----------------
-        if (msg.rfind("/msg ", 0) == 0) {
-            size_t spacePos = msg.find(' ', 5);
-            if (spacePos != std::string::npos) {
-                std::string recipient = trim(msg.substr(5, spacePos - 5));
-                std::string pm = trim(msg.substr(spacePos + 1));
-                // e.g. "[ bob ]: hey!"
-                private_message(username, recipient, pm);
+        // Reap first: closing sessions get a last flush of their own
+        // queue, and leave announcements they trigger go out below.
+        reap_sessions();
+        flush_dirty_sessions();
+        record_latencies();
+        schedule_timers(w);
+        if (quiesce(w)) {
+            return;
+        }
+    }
+}
+
+// ----------------- io_uring Loop ----------------------
+// The same worker, driven by completions instead of readiness: multishot
+// accept and recv keep delivering without being re-armed, received bytes land
+// in the worker's provided buffers and are copied into the session's ring,
+// and flush_session() queues linked sendmsgs instead of calling writev. All
+// of it reaches the kernel in the one io_uring_enter at the top of the loop.
+void arm_recv(Session& s) {
+    io_uring_sqe* sqe = self->ring.get_sqe();
+    if (!sqe) {
+        close_session(s);
+        return;
+    }
+    prep_multishot_recv(sqe, s.fd, self->recv_buffers.group(), s.id);
+    s.recv_armed = true;
+}
+
+// Multishot requests on the worker's own fds, keyed by their epoll tokens.
+void arm_token(Worker& w, uint64_t token) {
+    io_uring_sqe* sqe = w.ring.get_sqe();
+    if (!sqe) {
+        std::cerr << "Worker " << w.index << ": io_uring submission queue full" << std::endl;
+        return;
+    }
+    if (token == LISTEN_TOKEN) {
+        prep_multishot_accept(sqe, w.listen_fd, token);
+    } else if (token == WAKE_TOKEN) {
+        prep_multishot_poll(sqe, w.wake_fd, token);
+    } else if (token == METRICS_TOKEN) {
+        prep_multishot_poll(sqe, metrics_fd, token);
+    } else if (token == PRESENCE_TOKEN) {
+        prep_multishot_poll(sqe, presence_fd, token);
+    } else if (token == TIMER_TOKEN) {
+        prep_multishot_poll(sqe, w.timer_fd, token);
+    } else if (token == UPGRADE_TOKEN) {
+        prep_multishot_poll(sqe, upgrade_fd, token);
+    } else {
+        prep_multishot_poll(sqe, reload_fd, token);
+    }
+}
+
+void complete_recv(Worker& w, Session& s, const io_uring_cqe& cqe, bool live) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        s.recv_armed = false;
+    }
+    bool active = live && !s.closing;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (active && cqe.res > 0) {
+            size_t n = cqe.res;
+            if (!s.inbuf.reserve(n, RX_MAX_CAPACITY) || s.inbuf.free_space() < n) {
+                close_session(s);  // see handle_client()
             } else {
-                std::string err = "Invalid format. Use /msg <username> <message>\n";
-                send(client_socket, err.c_str(), err.size(), 0);
+                const char* data = w.recv_buffers.data(bid);
+                struct iovec iov[2] = {};
+                s.inbuf.writable_iov(iov);
+                size_t first = std::min(n, iov[0].iov_len);
+                memcpy(iov[0].iov_base, data, first);
+                if (n > first) {
+                    memcpy(iov[1].iov_base, data + first, n - first);
+                }
+                s.inbuf.commit(n);
+                w.metrics.bytes_in.add(n);
+                w.batch_recv_ns = now_ns();
+                s.last_input = to_tick(w.batch_recv_ns);
+                process_frames(s);
+                s.inbuf.shrink();
             }
-            continue;
         }
+        w.recv_buffers.recycle(bid);
+    }
+    if (!active || s.closing) {
+        return;
+    }
+    if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+        close_session(s);  // user disconnected
+    } else if (!s.recv_armed) {
+        // Ended for want of buffers; those just recycled are free again
+        arm_recv(s);
+    }
+}
 
-        // ------------------- Create Group ---------------
-        if (msg.rfind("/create_group ", 0) == 0) {
-            std::string g = msg.substr(14);
-            create_group(g, client_socket, username);
-            continue;
-        }
+void complete_send(Session& s, int res, bool live) {
+    --s.sends_inflight;
+    if (!live) {
+        return;
+    }
+    if (res < 0) {
+        close_session(s);
+        return;
+    }
+    s.outq.advance(res);
+    self->metrics.bytes_out.add(res);
+    self->metrics.queued_bytes.add(-static_cast<int64_t>(res));
+    if (s.sends_inflight == 0 && !s.closing) {
+        submit_sends(s);
+        watch_output(s, res > 0);
+    }
+}
 
-        // ------------------- Join Group -----------------
-        if (msg.rfind("/join_group ", 0) == 0) {
-            std::string g = msg.substr(12);
-            join_group(g, client_socket, username);
-            continue;
+void handle_completion(Worker& w, const io_uring_cqe& cqe) {
+    uint64_t token = cqe.user_data;
+    if (token == LISTEN_TOKEN) {
+        if (cqe.res >= 0) {
+            open_session(w, cqe.res);
+        } else if (cqe.res != -ECONNABORTED && cqe.res != -EINTR) {
+            std::cerr << "Failed to accept connection: " << strerror(-cqe.res) << std::endl;
         }
-
-        // ------------------- Leave Group ----------------
-        if (msg.rfind("/leave_group ", 0) == 0) {
-            std::string g = msg.substr(13);
-            leave_group(g, client_socket, username);
-            continue;
+    } else if (token == WAKE_TOKEN) {
+        drain_mailbox(w);
+    } else if (token == METRICS_TOKEN) {
+        serve_metrics();
+    } else if (token == RELOAD_TOKEN) {
+        reload_credentials();
+    } else if (token == PRESENCE_TOKEN) {
+        send_presence_digest();
+    } else if (token == TIMER_TOKEN) {
+        run_timers(w);
+    } else if (token == UPGRADE_TOKEN) {
+        begin_upgrade();
+    } else {
+        SessionId id = token & ~SEND_TAG;
+        bool live = true;
+        auto it = w.sessions.find(id);
+        if (it == w.sessions.end()) {
+            it = w.retired.find(id);
+            live = false;
+            if (it == w.retired.end()) {
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    w.recv_buffers.recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                }
+                return;
+            }
+        }
+        Session& s = *it->second;
+        if (token & SEND_TAG) {
+            complete_send(s, cqe.res, live);
+        } else {
+            complete_recv(w, s, cqe, live);
+        }
+        if (!live && !s.recv_armed && s.sends_inflight == 0) {
+            w.retired.erase(it);
         }
+        return;
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        arm_token(w, token);
+    }
+}
 
-        // ------------------- Group Msg ------------------
-        if (msg.rfind("/group_msg ", 0) == 0) {
-            size_t spacePos = msg.find(' ', 11);
-            if (spacePos != std::string::npos) {
-                std::string group_name = msg.substr(11, spacePos - 11);
-                std::string group_msg = msg.substr(spacePos + 1);
-                group_message(group_name, group_msg, client_socket, username);
-            } else {
-                std::string err = "Invalid format. Use /group_msg <group_name> <message>\n";
-                send(client_socket, err.c_str(), err.size(), 0);
-            }
-            continue;
+void run_uring_loop(Worker& w) {
+    if (!w.ring.enable()) {
+        std::cerr << "Worker " << w.index << ": io_uring enable failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    arm_token(w, LISTEN_TOKEN);
+    arm_token(w, WAKE_TOKEN);
+    arm_token(w, TIMER_TOKEN);
+    if (w.index == 0 && metrics_fd >= 0) {
+        arm_token(w, METRICS_TOKEN);
+    }
+    if (w.index == 0 && reload_fd >= 0) {
+        arm_token(w, RELOAD_TOKEN);
+    }
+    if (w.index == 0 && presence_fd >= 0) {
+        arm_token(w, PRESENCE_TOKEN);
+    }
+    if (w.index == 0 && upgrade_fd >= 0) {
+        arm_token(w, UPGRADE_TOKEN);
+    }
+    resume_sessions(w);
+
+    while (true) {
+        int rc = w.ring.submit_and_wait(1);
+        if (rc < 0 && rc != -EINTR && rc != -EAGAIN && rc != -EBUSY) {
+            std::cerr << "io_uring_enter failed: " << strerror(-rc) << std::endl;
+            return;
         }
+        w.ring.for_each_completion([&w](const io_uring_cqe& cqe) { handle_completion(w, cqe); });
 
-        // ------------------- Unknown Command ------------
-        std::string error_msg = "Unknown command.\n";
-        send(client_socket, error_msg.c_str(), error_msg.size(), 0);
+        reap_sessions();
+        flush_dirty_sessions();
+        record_latencies();
+        schedule_timers(w);
     }
 }
 
-// ----------------- Main -------------------------------
-int main() {
-    // 1) Load users from file
-    load_users("users.txt");
+void run_worker(Worker& w) {
+    self = &w;
+    if (w.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w.cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            std::lock_guard<std::mutex> lock(cout_mutex);
+            std::cerr << "Worker " << w.index << ": could not pin to CPU " << w.cpu << std::endl;
+        }
+    }
+    if (config.io_backend == IoBackend::Uring) {
+        run_uring_loop(w);
+    } else {
+        run_event_loop(w);
+    }
+}
 
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+// Every worker binds its own socket to the same port; with SO_REUSEPORT the
+// kernel spreads incoming connections across them.
+int create_listener() {
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_fd < 0) {
         std::cerr << "Socket creation failed.\n";
         return -1;
     }
-    std::cout << "Socket created successfully.\n";
 
     int opt = 1;
     setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
 
     sockaddr_in address;
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    address.sin_port = htons(config.port);
 
-    // 2) Bind
     if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
         std::cerr << "Bind failed: " << strerror(errno) << std::endl;
         close(server_fd);
         return -1;
     }
-    std::cout << "Bind successful on port " << PORT << ".\n";
-
-    // 3) Listen
     if (listen(server_fd, BACKLOG) < 0) {
         std::cerr << "Listen failed: " << strerror(errno) << std::endl;
         close(server_fd);
         return -1;
     }
-    std::cout << "Server is listening for connections...\n";
+    return server_fd;
+}
 
-    // 4) Accept in a loop
-    while (true) {
-        socklen_t addrlen = sizeof(address);
-        int new_socket = accept(server_fd, (struct sockaddr*)&address, &addrlen);
-        if (new_socket < 0) {
-            std::cerr << "Failed to accept connection.\n";
-            continue;
+// listen_fd and epoll_fd are inherited from a predecessor's worker, or -1.
+// An inherited epoll set already has the listener and the clients in it.
+bool init_worker(Worker& w, int listen_fd, int epoll_fd) {
+    w.listen_fd = listen_fd >= 0 ? listen_fd : create_listener();
+    w.epoll_fd = epoll_fd >= 0 ? epoll_fd : epoll_create1(EPOLL_CLOEXEC);
+    w.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    w.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    w.timer_origin = now_ns();
+    if (w.listen_fd < 0 || w.epoll_fd < 0 || w.wake_fd < 0 || w.timer_fd < 0) {
+        return false;
+    }
+
+    // EEXIST for an inherited listener, which is registered already
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = LISTEN_TOKEN;
+    epoll_ctl(w.epoll_fd, EPOLL_CTL_ADD, w.listen_fd, &ev);
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = WAKE_TOKEN;
+    epoll_ctl(w.epoll_fd, EPOLL_CTL_ADD, w.wake_fd, &ev);
+
+    ev.data.u64 = TIMER_TOKEN;
+    epoll_ctl(w.epoll_fd, EPOLL_CTL_ADD, w.timer_fd, &ev);
+    return true;
+}
+
+bool init_uring(Worker& w, std::string& error) {
+    return w.ring.init(URING_ENTRIES, 8 * URING_ENTRIES, error) &&
+           w.recv_buffers.init(w.ring, 0, URING_BUF_COUNT, URING_BUF_SIZE, error);
+}
+
+// ----------------- Main -------------------------------
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--out-budget BYTES] [--slow-policy drop|disconnect]\n"
+              << "       [--workers N] [--pin-cpus CPU[,CPU...]] [--metrics-socket PATH]\n"
+              << "       [--credentials INDEX] [--log-dir DIR] [--log-fsync-ms MS]\n"
+              << "       [--log-segment-mb MB] [--log-segments N] [--io-backend epoll|uring]\n"
+              << "       [--presence-window-ms MS] [--cluster FILE --node NAME]\n"
+              << "       [--auth-timeout-ms MS] [--verify-threads N] [--idle-timeout-ms MS]\n"
+              << "       [--heartbeat-ms MS] [--stall-timeout-ms MS] [--user-rate N]\n"
+              << "       [--user-burst N] [--server-rate N] [--compress-min BYTES]\n"
+              << "       [--upgrade-socket PATH]\n";
+    exit(1);
+}
+
+void parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        std::string value = argv[++i];
+        if (arg == "--out-budget") {
+            config.out_budget = std::stoul(value);
+        } else if (arg == "--slow-policy") {
+            if (value == "drop") {
+                config.slow_policy = SlowConsumerPolicy::Drop;
+            } else if (value == "disconnect") {
+                config.slow_policy = SlowConsumerPolicy::Disconnect;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (arg == "--workers") {
+            config.workers = std::stoul(value);
+        } else if (arg == "--metrics-socket") {
+            config.metrics_socket = value;
+        } else if (arg == "--credentials") {
+            config.credentials = value;
+        } else if (arg == "--log-dir") {
+            config.log.dir = value;
+        } else if (arg == "--log-fsync-ms") {
+            config.log.fsync_ms = std::stoul(value);
+        } else if (arg == "--log-segment-mb") {
+            config.log.segment_size = std::stoul(value) << 20;
+        } else if (arg == "--log-segments") {
+            config.log.max_segments = std::stoul(value);
+        } else if (arg == "--io-backend") {
+            if (value == "epoll") {
+                config.io_backend = IoBackend::Epoll;
+            } else if (value == "uring") {
+                config.io_backend = IoBackend::Uring;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (arg == "--presence-window-ms") {
+            config.presence_window_ms = std::stoul(value);
+        } else if (arg == "--auth-timeout-ms") {
+            config.auth_timeout_ms = std::stoul(value);
+        } else if (arg == "--verify-threads") {
+            config.verify_threads = std::stoul(value);
+        } else if (arg == "--idle-timeout-ms") {
+            config.idle_timeout_ms = std::stoul(value);
+        } else if (arg == "--heartbeat-ms") {
+            config.heartbeat_ms = std::stoul(value);
+        } else if (arg == "--stall-timeout-ms") {
+            config.stall_timeout_ms = std::stoul(value);
+        } else if (arg == "--user-rate") {
+            config.user_rate = std::stod(value);
+        } else if (arg == "--user-burst") {
+            config.user_burst = std::stod(value);
+        } else if (arg == "--server-rate") {
+            config.server_rate = std::stod(value);
+        } else if (arg == "--compress-min") {
+            config.compress_min = std::stoul(value);
+        } else if (arg == "--upgrade-socket") {
+            config.upgrade_socket = value;
+        } else if (arg == "--cluster") {
+            config.cluster_file = value;
+        } else if (arg == "--node") {
+            config.node = value;
+        } else if (arg == "--pin-cpus") {
+            std::stringstream ss(value);
+            std::string cpu;
+            while (std::getline(ss, cpu, ',')) {
+                config.cpus.push_back(std::stoi(cpu));
+            }
+        } else {
+            usage(argv[0]);
         }
+    }
+    if (config.workers == 0) {
+        config.workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (config.workers > (1u << 15)) {
+        usage(argv[0]);
+    }
+    if (config.cluster_file.empty() != config.node.empty()) {
+        usage(argv[0]);
+    }
+    // Cluster links are not handed over
+    if (!config.upgrade_socket.empty() && !config.cluster_file.empty()) {
+        usage(argv[0]);
+    }
+    // Record offsets are 32-bit
+    if (config.log.segment_size == 0 || config.log.segment_size > (1ul << 31)) {
+        usage(argv[0]);
+    }
+}
 
-        {
-            std::lock_guard<std::mutex> lock(cout_mutex);
-            std::cout << "Client connected successfully!\n";
+int main(int argc, char* argv[]) {
+    parse_args(argc, argv);
+
+    // 1) Map the credential index
+    if (!load_credentials(config.credentials)) {
+        return 1;
+    }
+    verifier.start(config.verify_threads);
+    if (!config.cluster_file.empty()) {
+        cluster = std::make_unique<Cluster>();
+        Cluster::Callbacks callbacks;
+        callbacks.on_start = [] { self = &link_context; };
+        callbacks.on_link_up = send_snapshot;
+        callbacks.on_peer_lost = [](size_t peer) { forget_peers(1ull << peer); };
+        callbacks.on_record = receive_record;
+        callbacks.on_topology = change_topology;
+        std::string error;
+        if (!cluster->open(config.cluster_file, config.node, std::move(callbacks), error)) {
+            std::cerr << "Failed to join cluster: " << error << std::endl;
+            return 1;
         }
+        auto topo = cluster->topology();
+        config.port = topo->nodes[topo->self].chat_port;
+        link_context.index = config.workers;
+    }
+    raise_fd_limit();
+    // writev() has no MSG_NOSIGNAL; a peer that vanished must not kill us
+    signal(SIGPIPE, SIG_IGN);
 
-        client_threads.emplace_back(std::thread(handle_client, new_socket));
+    // 2) Take over from a running server, if there is one; each of its
+    // workers needs one here
+    Handoff handoff;
+    if (!config.upgrade_socket.empty() && !take_over(config.upgrade_socket, handoff)) {
+        return 1;
+    }
+    config.workers = std::max(config.workers, handoff.workers);
+
+    // 3) One listening socket and event loop per worker
+    for (unsigned i = 0; i < config.workers; ++i) {
+        auto w = std::make_unique<Worker>();
+        w->index = i;
+        if (!config.cpus.empty()) {
+            w->cpu = config.cpus[i % config.cpus.size()];
+        }
+        bool inherited = i < handoff.workers;
+        if (!init_worker(*w, inherited ? handoff.fds[2 * i] : -1, inherited ? handoff.fds[2 * i + 1] : -1)) {
+            std::cerr << "Worker " << i << " setup failed: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        workers.push_back(std::move(w));
+    }
+    if (config.io_backend == IoBackend::Uring) {
+        std::string error;
+        for (auto& w : workers) {
+            if (!init_uring(*w, error)) {
+                std::cerr << "io_uring unavailable (" << error << "), using epoll" << std::endl;
+                config.io_backend = IoBackend::Epoll;
+                break;
+            }
+        }
+    }
+    if (handoff.workers > 0) {
+        restore_state(handoff);
+        if (!confirm_takeover(handoff)) {
+            return 1;
+        }
+    }
+    // Opened only now: a predecessor closes it just before handing over
+    if (!config.log.dir.empty()) {
+        message_log = std::make_unique<MessageLog>();
+        std::string error;
+        if (!message_log->open(config.log, error)) {
+            std::cerr << "Failed to open message log: " << error << std::endl;
+            return 1;
+        }
+    }
+    // Scrapes are served by worker 0
+    if (!config.metrics_socket.empty()) {
+        metrics_fd = create_unix_listener(config.metrics_socket);
+        if (metrics_fd < 0) {
+            std::cerr << "Metrics socket failed: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = METRICS_TOKEN;
+        epoll_ctl(workers[0]->epoll_fd, EPOLL_CTL_ADD, metrics_fd, &ev);
+    }
+    reload_fd = create_reload_signal();
+    if (reload_fd >= 0) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = RELOAD_TOKEN;
+        epoll_ctl(workers[0]->epoll_fd, EPOLL_CTL_ADD, reload_fd, &ev);
+    }
+    // Presence digests are sent by worker 0
+    if (config.presence_window_ms > 0) {
+        presence_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (presence_fd < 0) {
+            std::cerr << "Presence timer failed: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = PRESENCE_TOKEN;
+        epoll_ctl(workers[0]->epoll_fd, EPOLL_CTL_ADD, presence_fd, &ev);
+    }
+    // Successors connect to worker 0
+    if (!config.upgrade_socket.empty()) {
+        upgrade_fd = create_unix_listener(config.upgrade_socket);
+        if (upgrade_fd < 0) {
+            std::cerr << "Upgrade socket failed: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        upgrade_barrier = std::make_unique<std::barrier<>>(workers.size());
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = UPGRADE_TOKEN;
+        epoll_ctl(workers[0]->epoll_fd, EPOLL_CTL_ADD, upgrade_fd, &ev);
+    }
+    std::cout << "Socket created successfully.\n";
+    std::cout << "Bind successful on port " << config.port << ".\n";
+    if (cluster) {
+        auto topo = cluster->topology();
+        std::cout << "Node " << config.node << " of " << topo->nodes.size() << ", cluster links on port "
+                  << topo->nodes[topo->self].cluster_port << ".\n";
+    }
+    std::cout << "Server is listening for connections with " << config.workers << " worker(s)"
+              << (config.io_backend == IoBackend::Uring ? " on io_uring" : "") << "...\n";
+    if (handoff.workers > 0) {
+        std::cout << "Took over " << handoff.sessions << " sessions (" << handoff.snapshot.size()
+                  << " bytes of state); clients were paused for " << (now_ns() - paused_at) / 1000 << " us.\n";
     }
 
-    // Optional: if you do a graceful shutdown approach
-    for (auto &th : client_threads) {
-        if (th.joinable()) {
+    // 4) Worker 0 runs on the main thread. The workers stop for a
+    // successor, and start again if the handoff fails.
+    std::vector<std::thread> threads;
+    if (cluster) {
+        threads.emplace_back([] { cluster->run(); });
+    }
+    while (true) {
+        std::vector<std::thread> loops;
+        for (unsigned i = 1; i < workers.size(); ++i) {
+            loops.emplace_back(run_worker, std::ref(*workers[i]));
+        }
+        run_worker(*workers[0]);
+        for (auto& th : loops) {
             th.join();
         }
+        if (successor_fd < 0 || hand_over()) {
+            break;
+        }
+        resume_after_handoff();
     }
 
-    close(server_fd);
+    for (auto& th : threads) {
+        th.join();
+    }
+    for (auto& w : workers) {
+        close(w->wake_fd);
+        close(w->timer_fd);
+        close(w->epoll_fd);
+        close(w->listen_fd);
+    }
     return 0;
 }
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#define TIMER_LEVELS 6
+#define TIMER_SLOT_BITS 6                        // 64 slots per level
+#define TIMER_MAX_TICKS (uint64_t(1) << 30)      // longest delay; later deadlines are clamped
+
+class TimerWheel;
+
+// ----------------- Timers ---------------------------
+// An intrusive timer: it lives inside whatever it times (a session), so
+// arming and cancelling never allocate. id and kind tell the owner what
+// fired. Destroying an armed timer cancels it.
+struct TimerLink {
+    TimerLink* prev = nullptr;
+    TimerLink* next = nullptr;
+};
+
+struct Timer : TimerLink {
+    uint64_t id = 0;
+    int kind = 0;
+    uint64_t expires = 0;   // tick
+
+    Timer() = default;
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+    ~Timer() { cancel(); }
+
+    bool armed() const { return next != nullptr; }
+    inline void cancel();
+
+private:
+    friend class TimerWheel;
+    void unlink() {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = nullptr;
+    }
+
+    TimerWheel* wheel_ = nullptr;
+};
+
+// ----------------- Timer Wheel ----------------------
+// Hierarchical timing wheel (Varghese & Lauck): TIMER_LEVELS levels of 64
+// slots, each slot 64 times as wide as one on the level below. A timer is
+// filed on the level of the highest 6-bit digit where its expiry differs
+// from the current tick, so arm() and cancel() are O(1) whatever the delay.
+// When the lower digits roll over, the level's next slot is refiled into
+// the levels below. One wheel per worker holds every connection's
+// deadlines without a thread or an allocation per timer.
+class TimerWheel {
+public:
+    static constexpr size_t SLOTS = size_t(1) << TIMER_SLOT_BITS;
+
+    TimerWheel() {
+        for (auto& level : slots_) {
+            for (TimerLink& s : level) {
+                s.prev = s.next = &s;
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    uint64_t now() const { return current_; }
+    size_t size() const { return count_; }
+
+    // (Re)arms t to fire at tick expires; a deadline already due fires on
+    // the next tick.
+    void arm(Timer& t, uint64_t expires) {
+        t.cancel();
+        if (expires <= current_) {
+            expires = current_ + 1;
+        } else if (expires - current_ > TIMER_MAX_TICKS) {
+            expires = current_ + TIMER_MAX_TICKS;
+        }
+        t.expires = expires;
+        t.wheel_ = this;
+        place(t);
+        ++count_;
+    }
+
+    // Runs the wheel up to tick now, calling fire(t) for every timer that
+    // expired, in tick order. t is disarmed first, so fire may re-arm it.
+    template <typename F>
+    void advance(uint64_t now, F&& fire) {
+        while (current_ < now) {
+            if (count_ == 0) {
+                current_ = now;
+                return;
+            }
+            ++current_;
+            for (int level = TIMER_LEVELS - 1; level > 0; --level) {
+                if ((current_ & digit_mask(level)) == 0) {
+                    cascade(level);
+                }
+            }
+            TimerLink& slot = slots_[0][current_ & (SLOTS - 1)];
+            while (slot.next != &slot) {
+                Timer& t = static_cast<Timer&>(*slot.next);
+                t.cancel();
+                fire(t);
+            }
+        }
+    }
+
+    // Ticks until the wheel next has work: the next busy slot on the lowest
+    // level, or the next rollover that refiles a higher one. 0 when empty.
+    uint64_t next_due() const {
+        if (count_ == 0) {
+            return 0;
+        }
+        for (uint64_t d = 1; d < SLOTS; ++d) {
+            uint64_t tick = current_ + d;
+            const TimerLink& slot = slots_[0][tick & (SLOTS - 1)];
+            if (slot.next != &slot || (tick & (SLOTS - 1)) == 0) {
+                return d;
+            }
+        }
+        return SLOTS;
+    }
+
+private:
+    friend struct Timer;
+
+    static constexpr uint64_t digit_mask(int level) {
+        return (uint64_t(1) << (TIMER_SLOT_BITS * level)) - 1;
+    }
+
+    // Files t by its expiry; one equal to current_ (refiled by a rollover)
+    // goes in the lowest level's current slot, which runs next.
+    void place(Timer& t) {
+        uint64_t diff = t.expires ^ current_;
+        int level = diff ? (std::bit_width(diff) - 1) / TIMER_SLOT_BITS : 0;
+        if (level >= TIMER_LEVELS) {
+            level = TIMER_LEVELS - 1;
+        }
+        TimerLink& slot = slots_[level][(t.expires >> (TIMER_SLOT_BITS * level)) & (SLOTS - 1)];
+        t.prev = slot.prev;
+        t.next = &slot;
+        slot.prev->next = &t;
+        slot.prev = &t;
+    }
+
+    void cascade(int level) {
+        TimerLink& slot = slots_[level][(current_ >> (TIMER_SLOT_BITS * level)) & (SLOTS - 1)];
+        while (slot.next != &slot) {
+            Timer& t = static_cast<Timer&>(*slot.next);
+            t.unlink();
+            place(t);
+        }
+    }
+
+    TimerLink slots_[TIMER_LEVELS][SLOTS];
+    uint64_t current_ = 0;   // last tick run
+    size_t count_ = 0;
+};
+
+inline void Timer::cancel() {
+    if (next) {
+        unlink();
+        --wheel_->count_;
+    }
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// ----------------- io_uring -------------------------
+// Just enough of io_uring for a socket server, on the raw syscalls (no
+// liburing). SQEs are queued in shared memory and handed to the kernel by
+// the next submit_and_wait(), so a busy loop makes one syscall per batch
+// however many receives, sends and accepts it covers.
+//
+// The ring is created disabled so buffers can be registered from the thread
+// that builds it; enable() must then be called by the one thread that uses
+// it (IORING_SETUP_SINGLE_ISSUER).
+class Uring {
+public:
+    Uring() = default;
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    ~Uring() {
+        if (map_ != MAP_FAILED) munmap(map_, map_size_);
+        if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    int fd() const { return fd_; }
+
+    bool init(unsigned entries, unsigned cq_entries, std::string& error) {
+        io_uring_params p{};
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_R_DISABLED | IORING_SETUP_SUBMIT_ALL |
+                  IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+        p.cq_entries = cq_entries;
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd_ < 0 && errno == EINVAL) {
+            // Kernels before 6.1 lack the single-issuer task-work mode
+            p = io_uring_params{};
+            p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_R_DISABLED | IORING_SETUP_SUBMIT_ALL;
+            p.cq_entries = cq_entries;
+            fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        }
+        if (fd_ < 0) {
+            error = std::string("io_uring_setup: ") + strerror(errno);
+            return false;
+        }
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+            error = "io_uring: kernel too old";
+            return false;
+        }
+
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        map_size_ = std::max(sq_size, cq_size);
+        map_ = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (map_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            error = std::string("io_uring mmap: ") + strerror(errno);
+            return false;
+        }
+
+        char* base = static_cast<char*>(map_);
+        sq_head_ = reinterpret_cast<unsigned*>(base + p.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(base + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(base + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        cq_head_ = reinterpret_cast<unsigned*>(base + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(base + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(base + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(base + p.cq_off.cqes);
+        // SQ slot i always holds SQE i, so the indirection array is fixed
+        unsigned* array = reinterpret_cast<unsigned*>(base + p.sq_off.array);
+        for (unsigned i = 0; i < p.sq_entries; ++i) {
+            array[i] = i;
+        }
+        sq_local_tail_ = *sq_tail_;
+        return true;
+    }
+
+    // Binds the ring to the calling thread and lets it accept submissions.
+    bool enable() {
+        return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) == 0;
+    }
+
+    // Free SQ slots, after submitting what is queued if fewer than n are
+    // left; the next that many get_sqe() calls cannot fail.
+    unsigned reserve(unsigned n) {
+        if (sq_space() < n) {
+            submit_and_wait(0);
+        }
+        return sq_space();
+    }
+
+    // A zeroed SQE, or nullptr when the queue is full and the kernel would
+    // not take its contents. The SQE is submitted by the next submit call.
+    io_uring_sqe* get_sqe() {
+        if (reserve(1) == 0) {
+            return nullptr;
+        }
+        io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes_) + (sq_local_tail_ & sq_mask_);
+        memset(sqe, 0, sizeof(*sqe));
+        ++sq_local_tail_;
+        return sqe;
+    }
+
+    // Submits everything queued and, with wait_nr > 0, blocks until that
+    // many completions are ready. Returns 0 or -errno.
+    int submit_and_wait(unsigned wait_nr) {
+        store_release(sq_tail_, sq_local_tail_);
+        unsigned pending = sq_local_tail_ - load_acquire(sq_head_);
+        // Always ask for events: with DEFER_TASKRUN that is what runs the
+        // completion work the kernel queued for this thread.
+        long rc = syscall(__NR_io_uring_enter, fd_, pending, wait_nr, IORING_ENTER_GETEVENTS, nullptr, 0);
+        return rc < 0 ? -errno : 0;
+    }
+
+    // Calls handle(cqe) for every completion ready now. Each slot is copied
+    // out and released first, so handlers may queue new SQEs freely.
+    template <typename F>
+    void for_each_completion(F&& handle) {
+        unsigned head = *cq_head_;
+        while (head != load_acquire(cq_tail_)) {
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            store_release(cq_head_, ++head);
+            handle(cqe);
+        }
+    }
+
+private:
+    unsigned sq_space() const { return sq_entries_ - (sq_local_tail_ - load_acquire(sq_head_)); }
+
+    static unsigned load_acquire(unsigned* p) {
+        return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+    }
+    static void store_release(unsigned* p, unsigned v) {
+        std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release);
+    }
+
+    int fd_ = -1;
+    void* map_ = MAP_FAILED;
+    size_t map_size_ = 0;
+    void* sqes_ = MAP_FAILED;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_local_tail_ = 0;   // SQEs handed out, published on submit
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
+
+// ----------------- Provided Buffers -----------------
+// A ring of fixed-size receive buffers registered with the kernel. A
+// multishot recv picks a free one itself when data arrives, so idle
+// connections hold no receive memory; the CQE names the buffer it filled,
+// which goes back with recycle() once the bytes are copied out.
+class BufferRing {
+public:
+    BufferRing() = default;
+    BufferRing(const BufferRing&) = delete;
+    BufferRing& operator=(const BufferRing&) = delete;
+
+    ~BufferRing() {
+        if (ring_ != MAP_FAILED) munmap(ring_, ring_size_);
+        if (data_ != MAP_FAILED) munmap(data_, count_ * size_);
+    }
+
+    // count must be a power of two, at most 32768.
+    bool init(Uring& uring, uint16_t group, unsigned count, unsigned size, std::string& error) {
+        group_ = group;
+        count_ = count;
+        size_ = size;
+        ring_size_ = count * sizeof(io_uring_buf);
+        ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        data_ = mmap(nullptr, count_ * size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring_ == MAP_FAILED || data_ == MAP_FAILED) {
+            error = std::string("buffer ring mmap: ") + strerror(errno);
+            return false;
+        }
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring_);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, uring.fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            error = std::string("IORING_REGISTER_PBUF_RING: ") + strerror(errno);
+            return false;
+        }
+        for (unsigned bid = 0; bid < count; ++bid) {
+            recycle(static_cast<uint16_t>(bid));
+        }
+        return true;
+    }
+
+    uint16_t group() const { return group_; }
+    unsigned buffer_size() const { return size_; }
+    const char* data(uint16_t bid) const { return static_cast<const char*>(data_) + static_cast<size_t>(bid) * size_; }
+
+    void recycle(uint16_t bid) {
+        // Not br->bufs: compiled as C++, the uapi header's flexible-array
+        // wrapper puts it 8 bytes into the ring
+        auto* br = static_cast<io_uring_buf_ring*>(ring_);
+        io_uring_buf& b = static_cast<io_uring_buf*>(ring_)[tail_ & (count_ - 1)];
+        b.addr = reinterpret_cast<uint64_t>(data(bid));
+        b.len = size_;
+        b.bid = bid;
+        std::atomic_ref<uint16_t>(br->tail).store(++tail_, std::memory_order_release);
+    }
+
+private:
+    void* ring_ = MAP_FAILED;
+    size_t ring_size_ = 0;
+    void* data_ = MAP_FAILED;
+    uint16_t group_ = 0;
+    unsigned count_ = 0;
+    unsigned size_ = 0;
+    uint16_t tail_ = 0;
+};
+
+// ----------------- Requests -------------------------
+inline void prep_multishot_accept(io_uring_sqe* sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+}
+
+// Receives into buffers from the group until the request ends (no
+// IORING_CQE_F_MORE), e.g. on EOF, an error or ENOBUFS.
+inline void prep_multishot_recv(io_uring_sqe* sqe, int fd, uint16_t group, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = user_data;
+}
+
+// One CQE each time fd becomes readable.
+inline void prep_multishot_poll(io_uring_sqe* sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = user_data;
+}
+
+// msg and its iovecs must stay valid until the request completes.
+inline void prep_sendmsg(io_uring_sqe* sqe, int fd, const msghdr* msg, int flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->user_data = user_data;
+}
@@ -0,0 +1,270 @@
+// Microbenchmarks and a fuzz check for checksum.h.
+//
+//   ./bench_csum [sum|copy|header|fuzz]
+//
+// Each benchmark prints one line per size so runs can be diffed. fuzz
+// compares every checksum routine with the 16-bit scalar loop on random
+// data, lengths and alignments and exits non-zero on the first mismatch.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <arpa/inet.h>
+
+#include "checksum.h"
+
+using Clock = std::chrono::steady_clock;
+
+#define BENCH_SECONDS 0.5
+#define FUZZ_ROUNDS 200000
+
+// Results fold in here so the optimizer cannot drop the measured work.
+std::atomic<size_t> sink_total{0};
+
+template <typename F>
+double time_per_op(F&& op) {
+    size_t rounds = 0;
+    auto start = Clock::now();
+    double secs = 0;
+    do {
+        for (int k = 0; k < 64; ++k, ++rounds) op();
+        secs = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (secs < BENCH_SECONDS);
+    return secs * 1e9 / rounds;
+}
+
+std::vector<uint8_t> random_bytes(std::mt19937& rng, size_t n) {
+    std::vector<uint8_t> v(n);
+    for (uint8_t& b : v) b = static_cast<uint8_t>(rng());
+    return v;
+}
+
+// ----------------- Legacy Path ----------------------
+// What client_final.cpp did per packet: copy a pseudo-header and the TCP
+// header into a temporary and sum it 16 bits at a time.
+struct PseudoHeader {
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint8_t zero;
+    uint8_t proto;
+    uint16_t tcp_len;
+};
+
+unsigned short compute_checksum(unsigned short* data, int len) {
+    unsigned long sum = 0;
+    while (len > 1) {
+        sum += *data++;
+        len -= 2;
+    }
+    if (len == 1) {
+        sum += *(uint8_t*)data;
+    }
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return static_cast<unsigned short>(~sum);
+}
+
+uint16_t legacy_tcp_checksum(const struct iphdr* ip, const struct tcphdr* tcp, size_t tcp_len) {
+    char temp[sizeof(PseudoHeader) + 65536];
+    PseudoHeader pseudo;
+    pseudo.src_ip = ip->saddr;
+    pseudo.dst_ip = ip->daddr;
+    pseudo.zero = 0;
+    pseudo.proto = IPPROTO_TCP;
+    pseudo.tcp_len = htons(tcp_len);
+    memcpy(temp, &pseudo, sizeof(pseudo));
+    memcpy(temp + sizeof(pseudo), tcp, tcp_len);
+    return compute_checksum(reinterpret_cast<unsigned short*>(temp), sizeof(pseudo) + tcp_len);
+}
+
+// ----------------- Benchmarks -----------------------
+const size_t SIZES[] = {20, 40, 64, 576, 1500, 9000, 65536};
+
+void bench_sum() {
+    std::mt19937 rng(42);
+    std::cout << "one's-complement sum (ns per buffer; GB/s for the dispatched version)\n";
+    std::cout << std::setw(8) << "bytes" << std::setw(10) << "scalar" << std::setw(10) << "wide"
+              << std::setw(10) << "sse2" << std::setw(10) << "avx2" << std::setw(10) << "partial"
+              << std::setw(8) << "GB/s" << "\n";
+    time_per_op([] { sink_total += 1; });   // let the clock ramp up
+    for (size_t n : SIZES) {
+        std::vector<uint8_t> buf = random_bytes(rng, n);
+        const uint8_t* p = buf.data();
+        double scalar = time_per_op([&] { sink_total += csum_partial_scalar(p, n); });
+        double wide = time_per_op([&] { sink_total += csum_partial_wide(p, n); });
+        double sse2 = 0, avx2 = 0;
+#if defined(__x86_64__)
+        sse2 = time_per_op([&] { sink_total += csum_partial_sse2(p, n); });
+        if (csum_detail::has_avx2()) {
+            avx2 = time_per_op([&] { sink_total += csum_partial_avx2(p, n); });
+        }
+#endif
+        double partial = time_per_op([&] { sink_total += csum_partial(p, n); });
+        std::cout << std::setw(8) << n << std::fixed << std::setprecision(1) << std::setw(10) << scalar
+                  << std::setw(10) << wide << std::setw(10) << sse2 << std::setw(10) << avx2 << std::setw(10)
+                  << partial << std::setw(8) << std::setprecision(2) << n / partial << "\n";
+    }
+}
+
+void bench_copy() {
+    std::mt19937 rng(43);
+    std::cout << "copy then sum vs checksum on copy (ns per buffer)\n";
+    std::cout << std::setw(8) << "bytes" << std::setw(14) << "memcpy+sum" << std::setw(14) << "csum_and_copy"
+              << "\n";
+    for (size_t n : SIZES) {
+        std::vector<uint8_t> src = random_bytes(rng, n), dst(n);
+        double two_pass = time_per_op([&] {
+            memcpy(dst.data(), src.data(), n);
+            sink_total += csum_partial(dst.data(), n);
+        });
+        double one_pass = time_per_op([&] { sink_total += csum_and_copy(dst.data(), src.data(), n); });
+        std::cout << std::setw(8) << n << std::fixed << std::setprecision(1) << std::setw(14) << two_pass
+                  << std::setw(14) << one_pass << "\n";
+    }
+}
+
+// A handshake segment: the old pseudo-header copy, the new direct sum, and
+// patching seq and ack into an already checksummed header.
+void bench_header() {
+    char frame[sizeof(struct iphdr) + sizeof(struct tcphdr)] = {};
+    auto* ip = reinterpret_cast<struct iphdr*>(frame);
+    auto* tcp = reinterpret_cast<struct tcphdr*>(frame + sizeof(struct iphdr));
+    ip->saddr = inet_addr("127.0.0.1");
+    ip->daddr = inet_addr("127.0.0.1");
+    tcp->source = htons(54321);
+    tcp->dest = htons(12345);
+    tcp->seq = htonl(200);
+    tcp->doff = 5;
+    tcp->syn = 1;
+    tcp->window = htons(8192);
+
+    uint32_t seq = 0;
+    double legacy = time_per_op([&] {
+        tcp->seq = htonl(++seq);
+        tcp->check = 0;
+        sink_total += legacy_tcp_checksum(ip, tcp, sizeof(*tcp));
+    });
+    double direct = time_per_op([&] {
+        tcp->seq = htonl(++seq);
+        tcp->check = 0;
+        sink_total += tcp_checksum(ip, tcp, sizeof(*tcp));
+    });
+    tcp->check = 0;
+    tcp->check = tcp_checksum(ip, tcp, sizeof(*tcp));
+    double incremental = time_per_op([&] {
+        uint32_t old_seq = tcp->seq, old_ack = tcp->ack_seq;
+        tcp->seq = htonl(++seq);
+        tcp->ack_seq = htonl(seq + 1);
+        csum_replace4(&tcp->check, old_seq, tcp->seq);
+        csum_replace4(&tcp->check, old_ack, tcp->ack_seq);
+        sink_total += tcp->check;
+    });
+    std::cout << "TCP header checksum (ns per segment)\n";
+    std::cout << std::setw(22) << "pseudo-header copy" << std::setw(14) << "tcp_checksum" << std::setw(14)
+              << "seq+ack patch" << "\n";
+    std::cout << std::fixed << std::setprecision(1) << std::setw(22) << legacy << std::setw(14) << direct
+              << std::setw(14) << incremental << "\n";
+}
+
+// ----------------- Fuzzing --------------------------
+bool fuzz() {
+    std::mt19937 rng(12345);
+    std::vector<uint8_t> pool = random_bytes(rng, 70000), copy(70000);
+    // Runs of 0xff push every accumulator towards its carries
+    std::fill(pool.begin() + 66000, pool.end(), 0xff);
+
+    auto fail = [](const char* what, size_t off, size_t len, uint32_t seed) {
+        std::cout << "fuzz: " << what << " differs (offset " << off << ", length " << len << ", seed sum "
+                  << seed << ")\n";
+        return false;
+    };
+
+    for (int round = 0; round < FUZZ_ROUNDS; ++round) {
+        // Mostly short buffers, where the tails and dispatch edges are
+        size_t len = round % 4 == 0 ? rng() % 65537 : rng() % 300;
+        size_t off = rng() % (pool.size() - len + 1);
+        if (round % 8 == 1) off = pool.size() - len;   // ends in the 0xff run
+        uint32_t seed = round % 3 == 0 ? 0 : static_cast<uint32_t>(rng());
+        const uint8_t* p = pool.data() + off;
+
+        uint16_t want = csum_fold(csum_partial_scalar(p, len, seed));
+        if (csum_fold(csum_partial_wide(p, len, seed)) != want) return fail("wide", off, len, seed);
+#if defined(__x86_64__)
+        if (csum_fold(csum_partial_sse2(p, len, seed)) != want) return fail("sse2", off, len, seed);
+        if (csum_detail::has_avx2() && csum_fold(csum_partial_avx2(p, len, seed)) != want) {
+            return fail("avx2", off, len, seed);
+        }
+#endif
+        if (csum_fold(csum_partial(p, len, seed)) != want) return fail("csum_partial", off, len, seed);
+
+        size_t dst_off = rng() % 64;
+        if (csum_fold(csum_and_copy(copy.data() + dst_off, p, len, seed)) != want ||
+            memcmp(copy.data() + dst_off, p, len) != 0) {
+            return fail("csum_and_copy", off, len, seed);
+        }
+
+        // Split sums: a checksum can be built up piece by piece
+        size_t cut = len ? rng() % len & ~size_t(1) : 0;
+        uint32_t split = csum_partial(p + cut, len - cut, csum_partial(p, cut, seed));
+        if (csum_fold(split) != want) return fail("split sum", off, len, seed);
+    }
+
+    // Incremental updates against a full recompute of a random segment
+    for (int round = 0; round < FUZZ_ROUNDS; ++round) {
+        size_t len = 20 + rng() % 1480;
+        std::vector<uint8_t> seg(pool.begin(), pool.begin() + len);
+        std::shuffle(seg.begin(), seg.end(), rng);
+        if (round % 5 == 0) std::fill(seg.begin(), seg.begin() + 8, 0xff);
+        auto* tcp = reinterpret_cast<struct tcphdr*>(seg.data());
+        uint32_t saddr = rng(), daddr = rng();
+        auto full = [&] {
+            uint16_t keep = tcp->check;
+            tcp->check = 0;
+            uint16_t c = csum_fold(csum_partial_scalar(tcp, len, tcp_pseudo_sum(saddr, daddr, len)));
+            tcp->check = keep;
+            return c;
+        };
+        tcp->check = full();
+        for (int step = 0; step < 4; ++step) {
+            uint32_t v = round % 7 == 0 ? (step % 2 ? 0 : 0xffffffff) : static_cast<uint32_t>(rng());
+            switch (rng() % 3) {
+            case 0:
+                csum_replace4(&tcp->check, tcp->seq, v);
+                tcp->seq = v;
+                break;
+            case 1:
+                csum_replace4(&tcp->check, tcp->ack_seq, v);
+                tcp->ack_seq = v;
+                break;
+            default:
+                csum_replace2(&tcp->check, tcp->source, static_cast<uint16_t>(v));
+                tcp->source = static_cast<uint16_t>(v);
+                break;
+            }
+            // 0x0000 and 0xffff are the same one's-complement value
+            uint16_t want = full();
+            if (tcp->check != want && !((tcp->check == 0xffff && want == 0) || (tcp->check == 0 && want == 0xffff))) {
+                return fail("incremental update", 0, len, 0);
+            }
+        }
+    }
+    std::cout << "fuzz: " << FUZZ_ROUNDS << " buffers and " << FUZZ_ROUNDS
+              << " incremental updates match the scalar checksum\n";
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    std::string which = argc > 1 ? argv[1] : "all";
+    bool all = which == "all";
+
+    if (all || which == "sum") bench_sum();
+    if (all || which == "copy") bench_copy();
+    if (all || which == "header") bench_header();
+    if ((all || which == "fuzz") && !fuzz()) return 1;
+    return 0;
+}
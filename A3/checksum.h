@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define CSUM_SIMD_MIN 64   // shorter buffers are summed without vectors
+
+// ----------------- Internet Checksum -----------------
+// The one's-complement sum of RFC 1071. Partial sums are 32-bit values
+// that can be added to each other (csum_add) and are only folded to the
+// final 16-bit checksum at the end (csum_fold). Words are loaded in host
+// order: the one's-complement sum is the same whichever way the bytes of
+// every word are swapped, so the folded result can be stored as it is.
+
+inline uint32_t csum_add(uint32_t a, uint32_t b) {
+    a += b;
+    return a + (a < b);   // end-around carry
+}
+
+// 64-bit sums fold into 32 bits the same way, since 2^32 - 1 divides 2^64 - 1.
+inline uint32_t csum_from64(uint64_t sum) {
+    return csum_add(static_cast<uint32_t>(sum), static_cast<uint32_t>(sum >> 32));
+}
+
+// The checksum field for a partial sum.
+inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return static_cast<uint16_t>(~sum);
+}
+
+// Sixteen bits at a time: how the handshake code first did it. The
+// reference the faster versions are tested against.
+inline uint32_t csum_partial_scalar(const void* data, size_t len, uint32_t sum = 0) {
+    const auto* p = static_cast<const uint8_t*>(data);
+    uint64_t acc = sum;
+    for (; len > 1; len -= 2, p += 2) {
+        uint16_t w;
+        memcpy(&w, p, 2);
+        acc += w;
+    }
+    if (len == 1) {
+        uint16_t w = 0;
+        memcpy(&w, p, 1);   // the odd byte is the high half in network order
+        acc += w;
+    }
+    return csum_from64(acc);
+}
+
+namespace csum_detail {
+
+// The last len < 8 bytes. Only whether a byte sits at an even or an odd
+// offset matters to the sum, so the pieces can be added at any even shift.
+inline uint64_t tail(const uint8_t* p, size_t len) {
+    uint64_t w = 0;
+    if (len & 4) {
+        uint32_t x;
+        memcpy(&x, p, 4);
+        w += x;
+        p += 4;
+    }
+    if (len & 2) {
+        uint16_t x;
+        memcpy(&x, p, 2);
+        w += x;
+        p += 2;
+    }
+    if (len & 1) {
+        w += *p;   // an odd byte is the high half in network order
+    }
+    return w;
+}
+
+}  // namespace csum_detail
+
+// Eight bytes at a time into a 64-bit accumulator, split into 32-bit
+// halves so nothing carries out before 2^32 words.
+inline uint32_t csum_partial_wide(const void* data, size_t len, uint32_t sum = 0) {
+    const auto* p = static_cast<const uint8_t*>(data);
+    uint64_t a = sum, b = 0;
+    for (; len >= 16; len -= 16, p += 16) {
+        uint64_t x, y;
+        memcpy(&x, p, 8);
+        memcpy(&y, p + 8, 8);
+        a += (x & 0xffffffff) + (x >> 32);
+        b += (y & 0xffffffff) + (y >> 32);
+    }
+    if (len >= 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        a += (x & 0xffffffff) + (x >> 32);
+        p += 8;
+        len -= 8;
+    }
+    uint64_t t = csum_detail::tail(p, len);
+    b += (t & 0xffffffff) + (t >> 32);
+    return csum_add(csum_from64(a), csum_from64(b));
+}
+
+// Copies len bytes to dst and returns their sum, in one pass over the data.
+inline uint32_t csum_and_copy_wide(void* dst, const void* src, size_t len, uint32_t sum = 0) {
+    const auto* s = static_cast<const uint8_t*>(src);
+    auto* d = static_cast<uint8_t*>(dst);
+    uint64_t a = sum;
+    for (; len >= 8; len -= 8, s += 8, d += 8) {
+        uint64_t x;
+        memcpy(&x, s, 8);
+        memcpy(d, &x, 8);
+        a += (x & 0xffffffff) + (x >> 32);
+    }
+    memcpy(d, s, len);
+    uint64_t t = csum_detail::tail(s, len);
+    a += (t & 0xffffffff) + (t >> 32);
+    return csum_from64(a);
+}
+
+#if defined(__x86_64__)
+// SSE2 (every x86-64) and AVX2 (picked at run time): 32-bit lanes are
+// zero-extended into 64-bit accumulators, so nothing carries out either.
+namespace csum_detail {
+
+inline uint64_t hsum(__m128i v) {
+    return static_cast<uint64_t>(_mm_cvtsi128_si64(v)) +
+           static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(v, v)));
+}
+
+inline __m128i widen_add(__m128i acc, __m128i v) {
+    const __m128i low = _mm_set1_epi64x(0xffffffff);
+    acc = _mm_add_epi64(acc, _mm_and_si128(v, low));
+    return _mm_add_epi64(acc, _mm_srli_epi64(v, 32));
+}
+
+__attribute__((target("avx2"))) inline __m256i widen_add(__m256i acc, __m256i v) {
+    const __m256i low = _mm256_set1_epi64x(0xffffffff);
+    acc = _mm256_add_epi64(acc, _mm256_and_si256(v, low));
+    return _mm256_add_epi64(acc, _mm256_srli_epi64(v, 32));
+}
+
+__attribute__((target("avx2"))) inline uint64_t hsum(__m256i v) {
+    return hsum(_mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+inline bool has_avx2() {
+    static const bool yes = __builtin_cpu_supports("avx2");
+    return yes;
+}
+
+}  // namespace csum_detail
+
+inline uint32_t csum_partial_sse2(const void* data, size_t len, uint32_t sum = 0) {
+    using namespace csum_detail;
+    const auto* p = static_cast<const uint8_t*>(data);
+    __m128i a = _mm_setzero_si128(), b = _mm_setzero_si128();
+    for (; len >= 32; len -= 32, p += 32) {
+        a = widen_add(a, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        b = widen_add(b, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)));
+    }
+    uint32_t head = csum_from64(hsum(_mm_add_epi64(a, b)));
+    return csum_add(head, csum_partial_wide(p, len, sum));
+}
+
+__attribute__((target("avx2"))) inline uint32_t csum_partial_avx2(const void* data, size_t len, uint32_t sum = 0) {
+    using namespace csum_detail;
+    const auto* p = static_cast<const uint8_t*>(data);
+    __m256i a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+    for (; len >= 64; len -= 64, p += 64) {
+        a = widen_add(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+        b = widen_add(b, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32)));
+    }
+    uint32_t head = csum_from64(hsum(_mm256_add_epi64(a, b)));
+    return csum_add(head, csum_partial_wide(p, len, sum));
+}
+
+__attribute__((target("avx2"))) inline uint32_t csum_and_copy_avx2(void* dst, const void* src, size_t len,
+                                                                  uint32_t sum = 0) {
+    using namespace csum_detail;
+    const auto* s = static_cast<const uint8_t*>(src);
+    auto* d = static_cast<uint8_t*>(dst);
+    __m256i a = _mm256_setzero_si256(), b = _mm256_setzero_si256();
+    for (; len >= 64; len -= 64, s += 64, d += 64) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(d), x);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 32), y);
+        a = widen_add(a, x);
+        b = widen_add(b, y);
+    }
+    uint32_t head = csum_from64(hsum(_mm256_add_epi64(a, b)));
+    return csum_add(head, csum_and_copy_wide(d, s, len, sum));
+}
+#endif
+
+// The fastest version for this CPU; headers and other short buffers stay
+// on the scalar wide loop, where vector setup would cost more than it saves.
+inline uint32_t csum_partial(const void* data, size_t len, uint32_t sum = 0) {
+#if defined(__x86_64__)
+    if (len >= CSUM_SIMD_MIN) {
+        return csum_detail::has_avx2() ? csum_partial_avx2(data, len, sum) : csum_partial_sse2(data, len, sum);
+    }
+#endif
+    return csum_partial_wide(data, len, sum);
+}
+
+inline uint32_t csum_and_copy(void* dst, const void* src, size_t len, uint32_t sum = 0) {
+#if defined(__x86_64__)
+    if (len >= CSUM_SIMD_MIN && csum_detail::has_avx2()) {
+        return csum_and_copy_avx2(dst, src, len, sum);
+    }
+#endif
+    return csum_and_copy_wide(dst, src, len, sum);
+}
+
+// ----------------- Incremental Updates ---------------
+// RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m'). Rewriting a field and patching
+// the checksum costs a few adds instead of summing the segment again. from
+// and to are the fields as stored (network order), like the checksum.
+inline void csum_replace2(uint16_t* check, uint16_t from, uint16_t to) {
+    uint32_t sum = static_cast<uint16_t>(~*check);
+    sum += static_cast<uint16_t>(~from);
+    sum += to;
+    *check = csum_fold(sum);
+}
+
+inline void csum_replace4(uint16_t* check, uint32_t from, uint32_t to) {
+    uint32_t sum = static_cast<uint16_t>(~*check);
+    sum += static_cast<uint16_t>(~from) + static_cast<uint16_t>(~(from >> 16));
+    sum += (to & 0xffff) + (to >> 16);
+    *check = csum_fold(sum);
+}
+
+// ----------------- TCP ------------------------------
+// The pseudo-header's share of the sum, straight from the addresses: no
+// PseudoHeader struct and no copy of the segment behind it.
+inline uint32_t tcp_pseudo_sum(uint32_t saddr, uint32_t daddr, uint16_t tcp_len) {
+    uint64_t sum = uint64_t(saddr & 0xffff) + (saddr >> 16) + (daddr & 0xffff) + (daddr >> 16) +
+                   htons(IPPROTO_TCP) + htons(tcp_len);
+    return csum_from64(sum);
+}
+
+// The checksum of a TCP segment of tcp_len bytes (header and payload)
+// carried in ip. The segment's check field must be 0.
+inline uint16_t tcp_checksum(const struct iphdr* ip, const struct tcphdr* tcp, size_t tcp_len) {
+    return csum_fold(csum_partial(tcp, tcp_len, tcp_pseudo_sum(ip->saddr, ip->daddr, static_cast<uint16_t>(tcp_len))));
+}
@@ -10,37 +10,17 @@
 #include <ctime>
 #include <errno.h>  // Added for errno, EAGAIN, EWOULDBLOCK
 
+#include "checksum.h"
+#include "tcp_filter.h"
+
 #define DEST_PORT 12345
 #define SRC_PORT 54321
 
-// Used to construct pseudo-header for TCP checksum calculation
-struct PseudoHeader {
-    uint32_t src_ip;
-    uint32_t dst_ip;
-    uint8_t zero;
-    uint8_t proto;
-    uint16_t tcp_len;
-};
-
-// Function to compute checksum for pseudo-header + TCP header
-unsigned short compute_checksum(unsigned short* data, int len) {
-    unsigned long sum = 0;
-    while (len > 1) {
-        sum += *data++;
-        len -= 2;
-    }
-    if (len == 1) {
-        sum += *(uint8_t*)data;
-    }
-    sum = (sum >> 16) + (sum & 0xffff);
-    sum += (sum >> 16);
-    return static_cast<unsigned short>(~sum);
-}
+#define FRAME_SIZE (sizeof(struct iphdr) + sizeof(struct tcphdr))
 
-// Constructs and dispatches the SYN segment
-void dispatch_syn(int socket_fd, struct sockaddr_in& server) {
-    char frame[sizeof(struct iphdr) + sizeof(struct tcphdr)];
-    memset(frame, 0, sizeof(frame));
+// Constructs and dispatches the SYN segment; frame keeps it for the final ACK
+void dispatch_syn(int socket_fd, struct sockaddr_in& server, char* frame) {
+    memset(frame, 0, FRAME_SIZE);
 
     struct iphdr* ip_header = reinterpret_cast<struct iphdr*>(frame);
     struct tcphdr* tcp_header = reinterpret_cast<struct tcphdr*>(frame + sizeof(struct iphdr));
@@ -48,7 +28,7 @@ void dispatch_syn(int socket_fd, struct sockaddr_in& server) {
     ip_header->ihl = 5;
     ip_header->version = 4;
     ip_header->tos = 0;
-    ip_header->tot_len = htons(sizeof(frame));
+    ip_header->tot_len = htons(FRAME_SIZE);
     ip_header->id = htons(45678);
     ip_header->frag_off = 0;
     ip_header->ttl = 64;
@@ -67,27 +47,18 @@ void dispatch_syn(int socket_fd, struct sockaddr_in& server) {
     tcp_header->check = 0;
 
     // Calculate and set TCP checksum
-    char temp[sizeof(PseudoHeader) + sizeof(struct tcphdr)];
-    PseudoHeader pseudo;
-    pseudo.src_ip = ip_header->saddr;
-    pseudo.dst_ip = ip_header->daddr;
-    pseudo.zero = 0;
-    pseudo.proto = IPPROTO_TCP;
-    pseudo.tcp_len = htons(sizeof(struct tcphdr));
-
-    memcpy(temp, &pseudo, sizeof(pseudo));
-    memcpy(temp + sizeof(pseudo), tcp_header, sizeof(struct tcphdr));
-    tcp_header->check = compute_checksum(reinterpret_cast<unsigned short*>(temp), sizeof(temp));
-
-    if (sendto(socket_fd, frame, sizeof(frame), 0, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+    tcp_header->check = tcp_checksum(ip_header, tcp_header, sizeof(struct tcphdr));
+
+    if (sendto(socket_fd, frame, FRAME_SIZE, 0, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
         perror("SYN send error");
         exit(EXIT_FAILURE);
     }
     std::cout << "[+] SYN segment dispatched (seq=200)" << std::endl;
 }
 
-// Handles incoming packet and verifies SYN-ACK
-bool await_syn_ack(int socket_fd) {
+// Handles incoming packet and verifies SYN-ACK. The server picks a random
+// initial sequence number, returned in server_isn.
+bool await_syn_ack(int socket_fd, uint32_t& server_isn) {
     char incoming_data[65536];
     struct sockaddr_in origin;
     socklen_t origin_len = sizeof(origin);
@@ -131,9 +102,9 @@ bool await_syn_ack(int socket_fd) {
                   << ", SEQ: " << ntohl(tcp_hdr->seq)
                   << ", ACK_SEQ: " << ntohl(tcp_hdr->ack_seq) << std::endl;
 
-        if (tcp_hdr->syn == 1 && tcp_hdr->ack == 1 &&
-            ntohl(tcp_hdr->seq) == 400 && ntohl(tcp_hdr->ack_seq) == 201) {
-            std::cout << "[+] Valid SYN-ACK received (seq=400, ack=201)" << std::endl;
+        if (tcp_hdr->syn == 1 && tcp_hdr->ack == 1 && ntohl(tcp_hdr->ack_seq) == 201) {
+            server_isn = ntohl(tcp_hdr->seq);
+            std::cout << "[+] Valid SYN-ACK received (seq=" << server_isn << ", ack=201)" << std::endl;
             return true;
         } else {
             std::cout << "[-] Invalid SYN-ACK content or sequence mismatch" << std::endl;
@@ -143,51 +114,40 @@ bool await_syn_ack(int socket_fd) {
     return false;
 }
 
-// Sends the last ACK packet to complete the handshake
-void send_final_ack(int socket_fd, struct sockaddr_in& server) {
-    char ack_packet[sizeof(struct iphdr) + sizeof(struct tcphdr)];
-    memset(ack_packet, 0, sizeof(ack_packet));
+// Sends the last ACK packet to complete the handshake. It differs from the
+// SYN only in the IP id, seq, ack and flags, so it is a copy of the SYN with
+// those fields patched and the checksum updated for just them (RFC 1624).
+void send_final_ack(int socket_fd, struct sockaddr_in& server, const char* syn_frame, uint32_t server_isn) {
+    char ack_packet[FRAME_SIZE];
+    memcpy(ack_packet, syn_frame, sizeof(ack_packet));
 
     struct iphdr* ip_hdr = reinterpret_cast<struct iphdr*>(ack_packet);
     struct tcphdr* tcp_hdr = reinterpret_cast<struct tcphdr*>(ack_packet + sizeof(struct iphdr));
 
-    ip_hdr->ihl = 5;
-    ip_hdr->version = 4;
-    ip_hdr->tos = 0;
-    ip_hdr->tot_len = htons(sizeof(ack_packet));
-    ip_hdr->id = htons(45679);
-    ip_hdr->frag_off = 0;
-    ip_hdr->ttl = 64;
-    ip_hdr->protocol = IPPROTO_TCP;
-    ip_hdr->saddr = inet_addr("127.0.0.1");
-    ip_hdr->daddr = server.sin_addr.s_addr;
-
-    tcp_hdr->source = htons(SRC_PORT);
-    tcp_hdr->dest = server.sin_port;
-    tcp_hdr->seq = htonl(600);
-    tcp_hdr->ack_seq = htonl(401);
-    tcp_hdr->doff = 5;
+    ip_hdr->id = htons(45679);  // The kernel fills in the IP checksum
+
+    // Our SYN took sequence number 200, so the ACK carries 201. A server in
+    // SYN-cookie mode reads our ISN back from it.
+    uint32_t seq = htonl(201), ack_seq = htonl(server_isn + 1);
+    csum_replace4(&tcp_hdr->check, tcp_hdr->seq, seq);
+    csum_replace4(&tcp_hdr->check, tcp_hdr->ack_seq, ack_seq);
+    tcp_hdr->seq = seq;
+    tcp_hdr->ack_seq = ack_seq;
+
+    // The flags share a 16-bit word with the data offset, right after ack_seq
+    uint16_t old_flags, new_flags;
+    memcpy(&old_flags, reinterpret_cast<char*>(tcp_hdr) + 12, 2);
+    tcp_hdr->syn = 0;
     tcp_hdr->ack = 1;
-    tcp_hdr->window = htons(8192);
-    tcp_hdr->check = 0;
-
-    char temp[sizeof(PseudoHeader) + sizeof(struct tcphdr)];
-    PseudoHeader pseudo;
-    pseudo.src_ip = ip_hdr->saddr;
-    pseudo.dst_ip = ip_hdr->daddr;
-    pseudo.zero = 0;
-    pseudo.proto = IPPROTO_TCP;
-    pseudo.tcp_len = htons(sizeof(struct tcphdr));
-    memcpy(temp, &pseudo, sizeof(pseudo));
-    memcpy(temp + sizeof(pseudo), tcp_hdr, sizeof(struct tcphdr));
-    tcp_hdr->check = compute_checksum(reinterpret_cast<unsigned short*>(temp), sizeof(temp));
+    memcpy(&new_flags, reinterpret_cast<char*>(tcp_hdr) + 12, 2);
+    csum_replace2(&tcp_hdr->check, old_flags, new_flags);
 
     if (sendto(socket_fd, ack_packet, sizeof(ack_packet), 0,
                reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
         perror("ACK send error");
         exit(EXIT_FAILURE);
     }
-    std::cout << "[+] Final ACK sent (seq=600, ack=401). TCP handshake done." << std::endl;
+    std::cout << "[+] Final ACK sent (seq=201, ack=" << server_isn + 1 << "). TCP handshake done." << std::endl;
 }
 
 int main() {
@@ -214,10 +174,22 @@ int main() {
     server_info.sin_port = htons(DEST_PORT);
     server_info.sin_addr.s_addr = inet_addr("127.0.0.1");
 
-    dispatch_syn(raw_socket, server_info);
+    // Let the kernel drop everything but the server's replies to us
+    TcpFilter filter;
+    filter.dest_port = SRC_PORT;
+    filter.source_port = DEST_PORT;
+    filter.source_addr = server_info.sin_addr.s_addr;
+    if (attach_tcp_filter(raw_socket, filter) < 0) {
+        perror("SO_ATTACH_FILTER failed");
+        exit(EXIT_FAILURE);
+    }
+
+    char syn_frame[FRAME_SIZE];
+    dispatch_syn(raw_socket, server_info, syn_frame);
 
-    if (await_syn_ack(raw_socket)) {
-        send_final_ack(raw_socket, server_info);
+    uint32_t server_isn;
+    if (await_syn_ack(raw_socket, server_isn)) {
+        send_final_ack(raw_socket, server_info, syn_frame, server_isn);
     } else {
         std::cerr << "[-] Valid SYN-ACK not received. Handshake failed." << std::endl;
     }
@@ -0,0 +1,291 @@
+// Loopback SYN generator for measuring the server's receive path.
+//
+//   sudo ./flood [--port 12345] [--seconds 5] [--rate PPS] [--batch 64]
+//                [--sources N] [--probe PPS]
+//
+// Sends SYNs from 127.0.0.1 to 127.0.0.1:port as fast as it can (or at
+// --rate packets per second), each from a different source port and with
+// a random sequence number, and prints how many it sent. The server's
+// --stats line shows how many of them reached it.
+//
+// --sources N moves on to the next of 127.0.0.1 .. 127.0.0.N each time the
+// source ports run out, for more distinct flows than one address has ports.
+// --probe PPS also starts that many real handshakes per second from
+// PROBE_ADDR, answering each SYN-ACK with the final ACK, and prints how many
+// got their SYN-ACK. Whether the server then accepted the ACK only it can
+// tell: its "handshakes completed" total is the share of genuine clients it
+// still serves.
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <random>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include "checksum.h"
+#include "tcp_filter.h"
+
+#define DEST_PORT 12345
+#define FLOOD_BATCH 64          // packets per sendmmsg call
+#define FRAME_SIZE (sizeof(struct iphdr) + sizeof(struct tcphdr))
+
+#define PROBE_ADDR "127.0.1.1"  // --probe handshakes come from here...
+#define PROBE_PORT_BASE 30000   // ...and from these ports, in turn
+#define PROBE_PORTS 8192
+#define PROBE_WAIT 2.0          // seconds to wait for late SYN-ACKs at the end
+
+// An outstanding --probe handshake, by source port
+struct Probe {
+    double sent_at = 0;  // 0: none outstanding
+    uint32_t seq = 0;
+};
+
+Probe probes[PROBE_PORTS];
+uint64_t probes_sent = 0, probes_done = 0;
+double probe_latency_sum = 0, probe_latency_max = 0;
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The SYN every packet starts from, checksum included
+void build_syn(char* frame, uint16_t dest_port) {
+    memset(frame, 0, FRAME_SIZE);
+    struct iphdr* ip = reinterpret_cast<struct iphdr*>(frame);
+    struct tcphdr* tcp = reinterpret_cast<struct tcphdr*>(frame + sizeof(struct iphdr));
+
+    ip->ihl = 5;
+    ip->version = 4;
+    ip->tot_len = htons(FRAME_SIZE);
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_TCP;
+    ip->saddr = inet_addr("127.0.0.1");
+    ip->daddr = inet_addr("127.0.0.1");
+
+    tcp->source = htons(1024);
+    tcp->dest = htons(dest_port);
+    tcp->seq = htonl(1);
+    tcp->doff = 5;
+    tcp->syn = 1;
+    tcp->window = htons(8192);
+    tcp->check = tcp_checksum(ip, tcp, sizeof(struct tcphdr));
+}
+
+// A probe segment from PROBE_ADDR: the SYN, or the final ACK
+void send_probe(int sock, const struct sockaddr_in& dest, uint16_t source, bool syn, uint32_t seq, uint32_t ack_seq) {
+    char frame[FRAME_SIZE];
+    memset(frame, 0, FRAME_SIZE);
+    struct iphdr* ip = reinterpret_cast<struct iphdr*>(frame);
+    struct tcphdr* tcp = reinterpret_cast<struct tcphdr*>(frame + sizeof(struct iphdr));
+
+    ip->ihl = 5;
+    ip->version = 4;
+    ip->tot_len = htons(FRAME_SIZE);
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_TCP;
+    ip->saddr = inet_addr(PROBE_ADDR);
+    ip->daddr = dest.sin_addr.s_addr;
+
+    tcp->source = htons(source);
+    tcp->dest = dest.sin_port;
+    tcp->seq = htonl(seq);
+    tcp->ack_seq = htonl(ack_seq);
+    tcp->doff = 5;
+    tcp->syn = syn;
+    tcp->ack = !syn;
+    tcp->window = htons(8192);
+    tcp->check = tcp_checksum(ip, tcp, sizeof(struct tcphdr));
+
+    if (sendto(sock, frame, FRAME_SIZE, 0, reinterpret_cast<const struct sockaddr*>(&dest), sizeof(dest)) < 0) {
+        perror("Probe send error");
+    }
+}
+
+// Answers every SYN-ACK queued for a probe with the final ACK
+void drain_probes(int rx_sock, int tx_sock, const struct sockaddr_in& dest) {
+    char buffer[256];
+    ssize_t len;
+    while ((len = recv(rx_sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        struct iphdr* ip = reinterpret_cast<struct iphdr*>(buffer);
+        size_t ip_len = ip->ihl * 4;
+        if (static_cast<size_t>(len) < ip_len + sizeof(struct tcphdr)) continue;
+        struct tcphdr* tcp = reinterpret_cast<struct tcphdr*>(buffer + ip_len);
+        unsigned port = ntohs(tcp->dest);
+        if (!tcp->syn || !tcp->ack || port < PROBE_PORT_BASE || port >= PROBE_PORT_BASE + PROBE_PORTS) continue;
+
+        Probe& probe = probes[port - PROBE_PORT_BASE];
+        if (probe.sent_at == 0 || ntohl(tcp->ack_seq) != probe.seq + 1) continue;  // late or stray
+        send_probe(tx_sock, dest, port, false, probe.seq + 1, ntohl(tcp->seq) + 1);
+        double latency = now_seconds() - probe.sent_at;
+        probe_latency_sum += latency;
+        if (latency > probe_latency_max) probe_latency_max = latency;
+        ++probes_done;
+        probe.sent_at = 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int port = DEST_PORT;
+    double seconds = 5;
+    double rate = 0;  // packets per second; 0 means no limit
+    int batch = FLOOD_BATCH;
+    int sources = 1;
+    double probe_rate = 0;  // handshakes per second; 0 means none
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (arg == "--rate" && i + 1 < argc) {
+            rate = atof(argv[++i]);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch = atoi(argv[++i]);
+        } else if (arg == "--sources" && i + 1 < argc) {
+            sources = atoi(argv[++i]);
+        } else if (arg == "--probe" && i + 1 < argc) {
+            probe_rate = atof(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--port P] [--seconds S] [--rate PPS] [--batch N] [--sources N]"
+                      << " [--probe PPS]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (batch < 1 || batch > FLOOD_BATCH) batch = FLOOD_BATCH;
+    if (sources < 1 || sources > 254) sources = 1;
+
+    if (geteuid() != 0) {
+        std::cerr << "[-] Please run with sudo (root privileges required)." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // IPPROTO_RAW: send-only, IP header included
+    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+    if (sock < 0) {
+        perror("Raw socket creation failed");
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_in dest;
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(port);
+    dest.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    // SYN-ACKs for the probes, and nothing else: the flood's own SYN-ACKs
+    // go to the other source addresses
+    int probe_sock = -1;
+    if (probe_rate > 0) {
+        probe_sock = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+        TcpFilter filter;
+        filter.source_port = port;
+        filter.source_addr = dest.sin_addr.s_addr;
+        filter.dest_addr = inet_addr(PROBE_ADDR);
+        if (probe_sock < 0 || attach_tcp_filter(probe_sock, filter) < 0) {
+            perror("Probe socket setup failed");
+            return EXIT_FAILURE;
+        }
+    }
+
+    char syn[FRAME_SIZE];
+    build_syn(syn, port);
+    uint32_t template_saddr = reinterpret_cast<struct iphdr*>(syn)->saddr;
+    uint32_t saddr = template_saddr;
+
+    static char frames[FLOOD_BATCH][FRAME_SIZE];
+    struct iovec iovs[FLOOD_BATCH];
+    struct mmsghdr msgs[FLOOD_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < FLOOD_BATCH; ++i) {
+        iovs[i].iov_base = frames[i];
+        iovs[i].iov_len = FRAME_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &dest;
+        msgs[i].msg_hdr.msg_namelen = sizeof(dest);
+    }
+
+    std::mt19937 rng(std::random_device{}());
+    uint64_t sent = 0, failed = 0;
+    uint16_t next_port = 1024;
+    double start = now_seconds(), end = start + seconds;
+    std::cout << "[+] Flooding 127.0.0.1:" << port << " for " << seconds << " s" << std::endl;
+
+    for (double t = start; t < end; t = now_seconds()) {
+        if (probe_sock >= 0) {
+            drain_probes(probe_sock, sock, dest);
+            while (probes_sent < (t - start) * probe_rate) {
+                Probe& probe = probes[probes_sent % PROBE_PORTS];
+                probe.seq = rng();
+                probe.sent_at = now_seconds();
+                send_probe(sock, dest, PROBE_PORT_BASE + probes_sent % PROBE_PORTS, true, probe.seq, 0);
+                ++probes_sent;
+            }
+        }
+        if (rate > 0 && sent >= (t - start) * rate) {
+            usleep(100);
+            continue;
+        }
+        // Every packet is the template SYN with a new source port and
+        // sequence number; the checksum follows incrementally
+        for (int i = 0; i < batch; ++i) {
+            memcpy(frames[i], syn, FRAME_SIZE);
+            struct iphdr* ip = reinterpret_cast<struct iphdr*>(frames[i]);
+            struct tcphdr* tcp = reinterpret_cast<struct tcphdr*>(frames[i] + sizeof(struct iphdr));
+            if (saddr != template_saddr) {
+                csum_replace4(&tcp->check, ip->saddr, saddr);  // part of the pseudo-header
+                ip->saddr = saddr;
+            }
+            uint16_t source = htons(next_port);
+            uint32_t seq = rng();
+            csum_replace2(&tcp->check, tcp->source, source);
+            csum_replace4(&tcp->check, tcp->seq, seq);
+            tcp->source = source;
+            tcp->seq = seq;
+            if (next_port == 65535) {
+                next_port = 1024;
+                saddr = htonl(ntohl(template_saddr) + (ntohl(saddr) - ntohl(template_saddr) + 1) % sources);
+            } else {
+                ++next_port;
+            }
+        }
+        int n = sendmmsg(sock, msgs, batch, 0);
+        if (n < 0) {
+            ++failed;  // ENOBUFS under pressure: try again
+            continue;
+        }
+        sent += n;
+    }
+
+    double elapsed = now_seconds() - start;
+    std::cout << "[+] Sent " << sent << " SYNs in " << elapsed << " s ("
+              << static_cast<uint64_t>(sent / elapsed) << " pkts/s";
+    if (failed) std::cout << ", " << failed << " failed batches";
+    std::cout << ")" << std::endl;
+
+    if (probe_sock >= 0) {
+        for (double wait_end = now_seconds() + PROBE_WAIT; now_seconds() < wait_end;) {
+            drain_probes(probe_sock, sock, dest);
+            usleep(1000);
+        }
+        std::cout << "[+] SYN-ACKs received: " << probes_done << " of " << probes_sent << " probes ("
+                  << (probes_sent ? 100.0 * probes_done / probes_sent : 0) << "%)";
+        if (probes_done) {
+            std::cout << ", after avg " << probe_latency_sum / probes_done * 1000 << " ms, max "
+                      << probe_latency_max * 1000 << " ms";
+        }
+        std::cout << std::endl;
+        close(probe_sock);
+    }
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "siphash.h"
+
+#define FLOW_NONE UINT32_MAX
+#define FLOW_NO_QUEUE 0xff
+
+// ----------------- Flow Table ------------------------
+// Every handshake the server is part of, keyed by its 4-tuple. All memory
+// is allocated up front for max_flows flows: records live in a fixed array
+// and never move, and an open-addressing index (linear probing, at most
+// half full, backward-shift deletion so no tombstones pile up) maps keys to
+// them. Buckets come from a keyed hash, so a sender cannot aim its packets
+// at one probe chain.
+//
+// Each flow can also sit on one of a few timer queues, doubly linked
+// through the records. A queue only ever holds deadlines of now plus the
+// same timeout, so appending keeps it sorted and the expired flows are
+// always at its head: arming, disarming and expiring are all O(1).
+
+struct FlowKey {
+    uint32_t saddr = 0, daddr = 0;   // network order: the peer, then us
+    uint16_t sport = 0, dport = 0;   // network order
+
+    bool operator==(const FlowKey& o) const {
+        return saddr == o.saddr && daddr == o.daddr && sport == o.sport && dport == o.dport;
+    }
+};
+
+enum FlowState : uint8_t { FLOW_FREE, FLOW_SYN_RECEIVED, FLOW_ESTABLISHED };
+
+struct Flow {
+    FlowKey key;
+    uint32_t hash = 0;
+    uint32_t irs = 0;                 // the peer's initial sequence number
+    uint32_t iss = 0;                 // ours
+    uint64_t deadline = 0;            // ms, on the caller's clock
+    uint32_t prev = FLOW_NONE, next = FLOW_NONE;   // timer queue links
+    FlowState state = FLOW_FREE;
+    uint8_t queue = FLOW_NO_QUEUE;
+    uint8_t retries = 0;              // SYN-ACKs sent again so far
+    uint16_t mss = 0;                 // the peer's, from its SYN
+};
+
+class FlowTable {
+public:
+    FlowTable(uint32_t max_flows, const SipKey& key, unsigned queues)
+        : flows_(max_flows), queues_(queues), key_(key) {
+        size_t slots = 2;
+        while (slots < 2 * static_cast<size_t>(max_flows)) slots *= 2;
+        slots_.assign(slots, FLOW_NONE);
+        mask_ = slots - 1;
+        free_.reserve(max_flows);
+        for (uint32_t i = max_flows; i-- > 0;) free_.push_back(i);
+    }
+
+    Flow* find(const FlowKey& k) {
+        uint32_t h = hash(k);
+        for (size_t s = h & mask_;; s = (s + 1) & mask_) {
+            uint32_t i = slots_[s];
+            if (i == FLOW_NONE) return nullptr;
+            if (flows_[i].hash == h && flows_[i].key == k) return &flows_[i];
+        }
+    }
+
+    // A new flow for k, which must not be in the table, in state
+    // FLOW_FREE for the caller to set up; nullptr when the table is full.
+    Flow* insert(const FlowKey& k) {
+        if (free_.empty()) return nullptr;
+        uint32_t i = free_.back();
+        free_.pop_back();
+        Flow& f = flows_[i];
+        f = Flow();
+        f.key = k;
+        f.hash = hash(k);
+        size_t s = f.hash & mask_;
+        while (slots_[s] != FLOW_NONE) s = (s + 1) & mask_;
+        slots_[s] = i;
+        return &f;
+    }
+
+    void erase(Flow* f) {
+        disarm(f);
+        uint32_t i = index(f);
+        size_t hole = f->hash & mask_;
+        while (slots_[hole] != i) hole = (hole + 1) & mask_;
+        // Pull back every later entry of the chain that may sit in the hole
+        for (size_t s = (hole + 1) & mask_; slots_[s] != FLOW_NONE; s = (s + 1) & mask_) {
+            size_t home = flows_[slots_[s]].hash & mask_;
+            if (((s - home) & mask_) >= ((s - hole) & mask_)) {
+                slots_[hole] = slots_[s];
+                hole = s;
+            }
+        }
+        slots_[hole] = FLOW_NONE;
+        f->state = FLOW_FREE;
+        free_.push_back(i);
+    }
+
+    // Moves f to the tail of queue q, due at deadline.
+    void arm(Flow* f, unsigned q, uint64_t deadline) {
+        disarm(f);
+        uint32_t i = index(f);
+        Queue& queue = queues_[q];
+        f->queue = static_cast<uint8_t>(q);
+        f->deadline = deadline;
+        f->prev = queue.tail;
+        f->next = FLOW_NONE;
+        if (queue.tail != FLOW_NONE) {
+            flows_[queue.tail].next = i;
+        } else {
+            queue.head = i;
+        }
+        queue.tail = i;
+    }
+
+    void disarm(Flow* f) {
+        if (f->queue == FLOW_NO_QUEUE) return;
+        Queue& queue = queues_[f->queue];
+        if (f->prev != FLOW_NONE) flows_[f->prev].next = f->next; else queue.head = f->next;
+        if (f->next != FLOW_NONE) flows_[f->next].prev = f->prev; else queue.tail = f->prev;
+        f->prev = f->next = FLOW_NONE;
+        f->queue = FLOW_NO_QUEUE;
+    }
+
+    // The head of queue q if its deadline has passed; the caller re-arms
+    // or erases it before asking again.
+    Flow* due(unsigned q, uint64_t now) {
+        uint32_t i = queues_[q].head;
+        if (i == FLOW_NONE || flows_[i].deadline > now) return nullptr;
+        return &flows_[i];
+    }
+
+    size_t size() const { return flows_.size() - free_.size(); }
+    size_t max_flows() const { return flows_.size(); }
+
+    // Bytes held, all of it allocated by the constructor.
+    size_t memory() const {
+        return flows_.capacity() * sizeof(Flow) + slots_.capacity() * sizeof(uint32_t) +
+               free_.capacity() * sizeof(uint32_t) + queues_.capacity() * sizeof(Queue);
+    }
+
+private:
+    struct Queue {
+        uint32_t head = FLOW_NONE, tail = FLOW_NONE;
+    };
+
+    uint32_t hash(const FlowKey& k) const {
+        uint32_t words[3] = {k.saddr, k.daddr, static_cast<uint32_t>(k.sport) << 16 | k.dport};
+        return static_cast<uint32_t>(siphash24(key_, words, sizeof(words)));
+    }
+
+    uint32_t index(const Flow* f) const { return static_cast<uint32_t>(f - flows_.data()); }
+
+    std::vector<Flow> flows_;
+    std::vector<uint32_t> slots_;   // flow index per bucket, FLOW_NONE if empty
+    std::vector<uint32_t> free_;    // unused flow records, as a stack
+    std::vector<Queue> queues_;
+    size_t mask_ = 0;
+    SipKey key_;
+};
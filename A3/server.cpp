@@ -1,13 +1,75 @@
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <string>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <signal.h>
+#include <net/if.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+#include "checksum.h"
+#include "tcp_filter.h"
+#include "flow_table.h"
+#include "siphash.h"
+#include "syn_cookie.h"
+
 #define SERVER_PORT 12345  // Listening port
+#define SERVER_WINDOW 8192 // Receive window we advertise
+#define DEFAULT_MSS 536    // a peer's MSS when its SYN names none (RFC 1122)
+
+// Handshake state (flow_table.h). A SYN-ACK nobody answers is sent again
+// after 1, 2 and 4 s; 8 s after the last one the flow is dropped.
+#define DEFAULT_MAX_FLOWS 65536
+#define SYNACK_RTO_MS 1000
+#define SYNACK_RETRIES 3
+#define ESTABLISHED_IDLE_MS 60000    // an established flow with no traffic is forgotten
+#define TIMER_TICK_MS 100            // longest a receive call blocks before timers run
+#define IDLE_QUEUE (SYNACK_RETRIES + 1)  // timer queues 0..SYNACK_RETRIES: SYN-RECEIVED by retries
+
+// Batched receive (--rx mmsg)
+#define RX_BATCH 64           // packets per recvmmsg call
+#define RX_SNAPLEN 2048       // bytes kept per packet; headers always fit
+
+// Memory-mapped TPACKET_V3 ring (--rx ring): 64 blocks of 1 MB, each
+// handed to user space when full or after RING_BLOCK_TIMEOUT_MS
+#define RING_BLOCK_SIZE (1 << 20)
+#define RING_BLOCKS 64
+#define RING_FRAME_SIZE 2048
+#define RING_BLOCK_TIMEOUT_MS 10
+
+enum RxMode { RX_RECVFROM, RX_MMSG, RX_RING };
+
+// With --stats, per-packet logging is off and a rate line is printed
+// every second instead
+bool stats_mode = false;
+bool kernel_filter = true;    // --no-filter: see every TCP segment, as before
+uint64_t rx_packets = 0;      // TCP segments that reached user space
+uint64_t rx_matched = 0;      // ... of which were for SERVER_PORT
+uint64_t stats_packets = 0, stats_matched = 0;
+struct timespec stats_start;
+volatile sig_atomic_t stopping = 0;  // SIGINT/SIGTERM
+
+FlowTable *flows = nullptr;
+SipKey isn_key;               // secret for initial sequence numbers
+bool syn_cookies = false;     // --syncookies: no state until the final ACK
+SipKey cookie_key;
+uint64_t cookies_sent = 0, bad_cookies = 0;
+uint64_t half_open = 0, established = 0;
+uint64_t handshakes = 0, synack_retransmits = 0, flow_timeouts = 0, table_full = 0;
+uint64_t stats_handshakes = 0;
+
+void on_stop_signal(int) {
+    stopping = 1;
+}
 
 void print_tcp_flags(struct tcphdr *tcp) {
     std::cout << "[+] TCP Flags: "
@@ -19,7 +81,55 @@ void print_tcp_flags(struct tcphdr *tcp) {
               << " SEQ: " << ntohl(tcp->seq) << std::endl;
 }
 
-void send_syn_ack(int sock, struct sockaddr_in *client_addr, struct tcphdr *tcp) {
+// Prints the receive rate once a second has passed. ring_fd, if not -1,
+// also reports the ring's drops since the last line.
+void report_stats(int ring_fd) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    double secs = (now.tv_sec - stats_start.tv_sec) + (now.tv_nsec - stats_start.tv_nsec) / 1e9;
+    if (secs < 1.0) return;
+
+    std::cout << "[+] rx " << static_cast<uint64_t>((rx_packets - stats_packets) / secs) << " pkts/s, "
+              << static_cast<uint64_t>((rx_matched - stats_matched) / secs) << " for port " << SERVER_PORT << ", "
+              << static_cast<uint64_t>((handshakes - stats_handshakes) / secs) << " handshakes/s; flows "
+              << half_open << " half-open, " << established << " established";
+    if (ring_fd >= 0) {
+        struct tpacket_stats_v3 st;
+        socklen_t len = sizeof(st);
+        if (getsockopt(ring_fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {  // resets the counters
+            std::cout << ", ring dropped " << st.tp_drops;
+        }
+    }
+    std::cout << std::endl;
+    stats_packets = rx_packets;
+    stats_matched = rx_matched;
+    stats_handshakes = handshakes;
+    stats_start = now;
+}
+
+uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// RFC 6528: a clock ticking every 4 us plus a keyed hash of the 4-tuple,
+// so sequence numbers cannot be guessed from outside but a reused 4-tuple
+// still starts above its last incarnation
+uint32_t choose_isn(const FlowKey &key) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ticks = ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec) / 4000;
+    return (uint32_t)(ticks + siphash24(isn_key, &key, sizeof(key)));
+}
+
+std::string peer_name(const FlowKey &key) {
+    struct in_addr addr;
+    addr.s_addr = key.saddr;
+    return std::string(inet_ntoa(addr)) + ":" + std::to_string(ntohs(key.sport));
+}
+
+void send_syn_ack(int sock, const Flow &flow) {
     char packet[sizeof(struct iphdr) + sizeof(struct tcphdr)];
     memset(packet, 0, sizeof(packet));
 
@@ -35,29 +145,242 @@ void send_syn_ack(int sock, struct sockaddr_in *client_addr, struct tcphdr *tcp)
     ip->frag_off = 0;
     ip->ttl = 64;
     ip->protocol = IPPROTO_TCP;
-    ip->saddr = client_addr->sin_addr.s_addr;
-    ip->daddr = inet_addr("127.0.0.1");  // Server address
+    ip->saddr = flow.key.daddr;  // Server address
+    ip->daddr = flow.key.saddr;
 
     // Fill TCP header
-    tcp_response->source = tcp->dest;
-    tcp_response->dest = tcp->source;
-    tcp_response->seq = htonl(400);
-    tcp_response->ack_seq = htonl(ntohl(tcp->seq) + 1);
+    tcp_response->source = flow.key.dport;
+    tcp_response->dest = flow.key.sport;
+    tcp_response->seq = htonl(flow.iss);
+    tcp_response->ack_seq = htonl(flow.irs + 1);
     tcp_response->doff = 5;
     tcp_response->syn = 1;
     tcp_response->ack = 1;
-    tcp_response->window = htons(8192);
-    tcp_response->check = 0;  // Kernel will compute the checksum
+    tcp_response->window = htons(SERVER_WINDOW);
+    tcp_response->check = 0;
+    // The kernel fills in the IP checksum only; TCP's is ours to compute
+    tcp_response->check = tcp_checksum(ip, tcp_response, sizeof(struct tcphdr));
+
+    struct sockaddr_in client_addr;
+    memset(&client_addr, 0, sizeof(client_addr));
+    client_addr.sin_family = AF_INET;
+    client_addr.sin_addr.s_addr = flow.key.saddr;
 
     // Send packet
-    if (sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *)client_addr, sizeof(*client_addr)) < 0) {
+    if (sendto(sock, packet, sizeof(packet), 0, (struct sockaddr *)&client_addr, sizeof(client_addr)) < 0) {
         perror("sendto() failed");
-    } else {
-        std::cout << "[+] Sent SYN-ACK" << std::endl;
+    } else if (!stats_mode) {
+        std::cout << "[+] Sent SYN-ACK to " << peer_name(flow.key) << " (seq=" << flow.iss
+                  << ", ack=" << flow.irs + 1 << ")" << std::endl;
     }
 }
 
-void receive_syn() {
+void close_flow(Flow *flow) {
+    if (flow->state == FLOW_SYN_RECEIVED) --half_open;
+    if (flow->state == FLOW_ESTABLISHED) --established;
+    flows->erase(flow);
+}
+
+// The MSS option of a SYN whose header (options included) is tcp_len
+// bytes, or DEFAULT_MSS if it has none
+uint16_t syn_mss(const struct tcphdr *tcp, size_t tcp_len) {
+    const uint8_t *opt = (const uint8_t *)tcp + sizeof(struct tcphdr);
+    const uint8_t *end = (const uint8_t *)tcp + tcp_len;
+    while (opt < end && *opt != TCPOPT_EOL) {
+        if (*opt == TCPOPT_NOP) {
+            ++opt;
+            continue;
+        }
+        if (end - opt < 2 || opt[1] < 2 || opt[1] > end - opt) break;
+        if (*opt == TCPOPT_MAXSEG && opt[1] == TCPOLEN_MAXSEG) return (uint16_t)(opt[2] << 8 | opt[3]);
+        opt += opt[1];
+    }
+    return DEFAULT_MSS;
+}
+
+// Cookie mode: the SYN-ACK's ISN carries everything needed to check the
+// final ACK (syn_cookie.h), so a SYN costs a reply and no memory
+void on_syn_cookie(int send_sock, const FlowKey &key, Flow *flow, uint32_t seq, uint16_t mss) {
+    if (flow) close_flow(flow);  // The peer started over; the old flow is stale
+    Flow reply;
+    reply.key = key;
+    reply.irs = seq;
+    reply.iss = syn_cookie_make(cookie_key, key, seq, mss, now_ms());
+    ++cookies_sent;
+    if (!stats_mode) std::cout << "[+] Received SYN from " << peer_name(key) << " (seq=" << seq << ")" << std::endl;
+    send_syn_ack(send_sock, reply);
+}
+
+// Cookie mode: an ACK for no flow completes a handshake if it returns one
+// of our cookies. Only then does the flow get a table entry.
+void on_cookie_ack(const FlowKey &key, struct tcphdr *tcp) {
+    uint32_t irs = ntohl(tcp->seq) - 1, iss = ntohl(tcp->ack_seq) - 1;
+    uint16_t mss;
+    if (!syn_cookie_check(cookie_key, key, irs, iss, now_ms(), mss)) {
+        ++bad_cookies;
+        if (!stats_mode) std::cout << "[-] ACK from " << peer_name(key) << " without a valid cookie" << std::endl;
+        return;
+    }
+    if (tcp->fin) return;  // Opened and closed at once: nothing to keep
+    Flow *flow = flows->insert(key);
+    if (!flow) {
+        ++table_full;
+        return;
+    }
+    flow->state = FLOW_ESTABLISHED;
+    flow->irs = irs;
+    flow->iss = iss;
+    flow->mss = mss;
+    ++established;
+    ++handshakes;
+    if (!stats_mode) {
+        std::cout << "[+] Handshake complete with " << peer_name(key) << " (mss " << mss << ")" << std::endl;
+    }
+    flows->arm(flow, IDLE_QUEUE, now_ms() + ESTABLISHED_IDLE_MS);
+}
+
+void on_syn(int send_sock, const FlowKey &key, Flow *flow, uint32_t seq, uint16_t mss) {
+    if (flow && flow->state == FLOW_SYN_RECEIVED && flow->irs == seq) {
+        send_syn_ack(send_sock, *flow);  // Our SYN-ACK was lost: answer again
+        return;
+    }
+    if (!flow) {
+        flow = flows->insert(key);
+        if (!flow) {
+            ++table_full;  // Bounded memory: no room means no new handshake
+            return;
+        }
+        flow->state = FLOW_SYN_RECEIVED;
+        ++half_open;
+    } else if (flow->state == FLOW_ESTABLISHED) {
+        // The peer forgot the connection (a client run again from the same
+        // port); our flows carry no data, so simply start over
+        flow->state = FLOW_SYN_RECEIVED;
+        --established;
+        ++half_open;
+    }
+    // A new flow, or the peer restarted with a new ISN
+    flow->irs = seq;
+    flow->iss = choose_isn(key);
+    flow->mss = mss;
+    flow->retries = 0;
+    if (!stats_mode) std::cout << "[+] Received SYN from " << peer_name(key) << " (seq=" << seq << ")" << std::endl;
+    send_syn_ack(send_sock, *flow);
+    flows->arm(flow, 0, now_ms() + SYNACK_RTO_MS);
+}
+
+void on_ack(Flow *flow, struct tcphdr *tcp) {
+    uint32_t seq = ntohl(tcp->seq);
+    if (flow->state == FLOW_SYN_RECEIVED) {
+        // Acceptable: it acknowledges our SYN and its seq is inside our window
+        if (ntohl(tcp->ack_seq) != flow->iss + 1 || seq - (flow->irs + 1) >= SERVER_WINDOW) {
+            if (!stats_mode) std::cout << "[-] Unacceptable ACK from " << peer_name(flow->key) << std::endl;
+            return;
+        }
+        flow->state = FLOW_ESTABLISHED;
+        --half_open;
+        ++established;
+        ++handshakes;
+        if (!stats_mode) {
+            std::cout << "[+] Handshake complete with " << peer_name(flow->key) << " (mss " << flow->mss << ")"
+                      << std::endl;
+        }
+    }
+    if (tcp->fin) {
+        close_flow(flow);  // No data transfer here, so no orderly close either
+        return;
+    }
+    flows->arm(flow, IDLE_QUEUE, now_ms() + ESTABLISHED_IDLE_MS);
+}
+
+// Handles one IPv4 packet of len bytes, wherever it was received into.
+// One table lookup and a constant amount of work per packet.
+void handle_packet(int send_sock, const char *data, size_t len) {
+    if (len < sizeof(struct iphdr)) return;
+    struct iphdr *ip = (struct iphdr *)data;
+    size_t ip_len = ip->ihl * 4;
+    if (ip->protocol != IPPROTO_TCP || ip_len < sizeof(struct iphdr) || len < ip_len + sizeof(struct tcphdr)) {
+        return;
+    }
+    struct tcphdr *tcp = (struct tcphdr *)(data + ip_len);
+    ++rx_packets;
+
+    // Only process packets for the correct destination port
+    if (ntohs(tcp->dest) != SERVER_PORT) return;
+    ++rx_matched;
+
+    if (!stats_mode) print_tcp_flags(tcp);
+
+    FlowKey key;
+    key.saddr = ip->saddr;
+    key.daddr = ip->daddr;
+    key.sport = tcp->source;
+    key.dport = tcp->dest;
+    Flow *flow = flows->find(key);
+
+    if (tcp->rst) {
+        // A raw-socket client's own kernel knows nothing of the connection
+        // and resets every SYN-ACK we send it, so a RST only ends a flow
+        // once it is established (and then only at exactly the next seq)
+        if (flow && flow->state == FLOW_ESTABLISHED && ntohl(tcp->seq) == flow->irs + 1) {
+            close_flow(flow);
+        }
+        return;
+    }
+    if (tcp->syn && !tcp->ack) {
+        // Options only if the whole header arrived
+        size_t tcp_len = tcp->doff * 4;
+        uint16_t mss = len >= ip_len + tcp_len ? syn_mss(tcp, tcp_len) : DEFAULT_MSS;
+        if (syn_cookies) {
+            on_syn_cookie(send_sock, key, flow, ntohl(tcp->seq), mss);
+        } else {
+            on_syn(send_sock, key, flow, ntohl(tcp->seq), mss);
+        }
+    } else if (tcp->ack && !tcp->syn) {
+        if (flow) {
+            on_ack(flow, tcp);
+        } else if (syn_cookies) {
+            on_cookie_ack(key, tcp);
+        }
+    }
+}
+
+// Resends SYN-ACKs that are due and drops flows that ran out of retries or
+// went idle. Each queue's expired flows sit at its head, so this costs
+// O(1) per flow handled.
+void run_timers(int send_sock) {
+    uint64_t now = now_ms();
+    for (unsigned q = 0; q <= SYNACK_RETRIES; ++q) {
+        while (Flow *flow = flows->due(q, now)) {
+            if (flow->retries == SYNACK_RETRIES) {
+                ++flow_timeouts;
+                if (!stats_mode) std::cout << "[-] Handshake with " << peer_name(flow->key) << " timed out" << std::endl;
+                close_flow(flow);
+                continue;
+            }
+            ++flow->retries;
+            ++synack_retransmits;
+            send_syn_ack(send_sock, *flow);
+            flows->arm(flow, flow->retries, now + ((uint64_t)SYNACK_RTO_MS << flow->retries));
+        }
+    }
+    while (Flow *flow = flows->due(IDLE_QUEUE, now)) {
+        close_flow(flow);
+    }
+}
+
+// Called by each receive loop once packets can reach it. Setting up the
+// ring alone can take a second, and SYNs sent before then are lost.
+void announce_listening() {
+    std::cout << "[+] Server listening on port " << SERVER_PORT << " (up to " << flows->max_flows()
+              << " flows, " << flows->memory() / 1024 << " KB" << (syn_cookies ? ", SYN cookies" : "") << ")..."
+              << std::endl;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &stats_start);
+}
+
+// Raw TCP socket that sends with our own IP header and, unless
+// --no-filter, receives only segments for SERVER_PORT
+int open_raw_socket() {
     int sock = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
     if (sock < 0) {
         perror("Socket creation failed");
@@ -71,42 +394,240 @@ void receive_syn() {
         exit(EXIT_FAILURE);
     }
 
+    // Wake up now and then to run timers even when nothing arrives
+    struct timeval tick;
+    tick.tv_sec = 0;
+    tick.tv_usec = TIMER_TICK_MS * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tick, sizeof(tick));
+
+    // Only segments for our port get past the kernel
+    TcpFilter filter;
+    filter.dest_port = SERVER_PORT;
+    if (kernel_filter && attach_tcp_filter(sock, filter) < 0) {
+        perror("SO_ATTACH_FILTER failed");
+        exit(EXIT_FAILURE);
+    }
+    announce_listening();
+    return sock;
+}
+
+// One recvfrom per packet into a 64 KB buffer: the original loop
+void receive_syn() {
+    int sock = open_raw_socket();
     char buffer[65536];
     struct sockaddr_in source_addr;
     socklen_t addr_len = sizeof(source_addr);
 
-    while (true) {
+    while (!stopping) {
         int data_size = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_addr, &addr_len);
-        if (data_size < 0) {
+        if (data_size < 0 && errno != EINTR && errno != EAGAIN) {
             perror("Packet reception failed");
-            continue;
         }
+        if (data_size > 0) handle_packet(sock, buffer, data_size);
+        run_timers(sock);
+        if (stats_mode) report_stats(-1);
+    }
 
-        struct iphdr *ip = (struct iphdr *)buffer;
-        struct tcphdr *tcp = (struct tcphdr *)(buffer + (ip->ihl * 4));
+    close(sock);
+}
 
-        // Only process packets for the correct destination port
-        if (ntohs(tcp->dest) != SERVER_PORT) continue;
+// Up to RX_BATCH packets per system call. Blocks for the first packet and
+// takes whatever else is already queued (MSG_WAITFORONE).
+void receive_mmsg() {
+    int sock = open_raw_socket();
+    static char buffers[RX_BATCH][RX_SNAPLEN];
+    struct sockaddr_in addrs[RX_BATCH];
+    struct iovec iovs[RX_BATCH];
+    struct mmsghdr msgs[RX_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < RX_BATCH; ++i) {
+        iovs[i].iov_base = buffers[i];
+        iovs[i].iov_len = RX_SNAPLEN;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+    }
 
-        print_tcp_flags(tcp);
+    while (!stopping) {
+        for (int i = 0; i < RX_BATCH; ++i) {
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+        int n = recvmmsg(sock, msgs, RX_BATCH, MSG_WAITFORONE, NULL);
+        if (n < 0 && errno != EINTR && errno != EAGAIN) {
+            perror("recvmmsg() failed");
+        }
+        for (int i = 0; i < n; ++i) {
+            // Truncated packets keep their headers, which is all we read
+            size_t len = msgs[i].msg_len < RX_SNAPLEN ? msgs[i].msg_len : RX_SNAPLEN;
+            handle_packet(sock, buffers[i], len);
+        }
+        run_timers(sock);
+        if (stats_mode) report_stats(-1);
+    }
 
-        if (tcp->syn == 1 && tcp->ack == 0 && ntohl(tcp->seq) == 200) {
-            std::cout << "[+] Received SYN from " << inet_ntoa(source_addr.sin_addr) << std::endl;
-            send_syn_ack(sock, &source_addr, tcp);
+    close(sock);
+}
+
+// A TPACKET_V3 ring on an AF_PACKET socket bound to ifname. SOCK_DGRAM
+// strips the link-layer header, so packets start at the IP header. The kernel
+// writes packets straight into memory shared with us, a block at a time,
+// and we parse them where they lie: no system call per packet or batch
+// while traffic flows, and no copy out of the kernel.
+void receive_ring(const char *ifname) {
+    int fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+    if (fd < 0) {
+        perror("Packet socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+    TcpFilter filter;
+    filter.dest_port = SERVER_PORT;
+    filter.incoming_only = true;
+    if (kernel_filter && attach_tcp_filter(fd, filter) < 0) {
+        perror("SO_ATTACH_FILTER failed");
+        exit(EXIT_FAILURE);
+    }
+    int version = TPACKET_V3;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("PACKET_VERSION failed");
+        exit(EXIT_FAILURE);
+    }
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = RING_BLOCK_SIZE;
+    req.tp_block_nr = RING_BLOCKS;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCKS;
+    req.tp_retire_blk_tov = RING_BLOCK_TIMEOUT_MS;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        perror("PACKET_RX_RING failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t ring_size = (size_t)RING_BLOCK_SIZE * RING_BLOCKS;
+    char *ring = (char *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap() failed");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_ll ll;
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_IP);
+    ll.sll_ifindex = if_nametoindex(ifname);
+    if (ll.sll_ifindex == 0 || bind(fd, (struct sockaddr *)&ll, sizeof(ll)) < 0) {
+        perror("bind() to interface failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Replies go out through a send-only raw socket; IPPROTO_RAW never
+    // receives, so nothing queues up behind the ring
+    int send_sock = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+    if (send_sock < 0) {
+        perror("Socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    announce_listening();
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN | POLLERR;
+    unsigned block = 0;
+    while (!stopping) {
+        struct tpacket_block_desc *desc = (struct tpacket_block_desc *)(ring + (size_t)block * RING_BLOCK_SIZE);
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            poll(&pfd, 1, TIMER_TICK_MS);
+            run_timers(send_sock);
+            if (stats_mode) report_stats(fd);
+            continue;
         }
 
-        if (tcp->ack == 1 && tcp->syn == 0 && ntohl(tcp->seq) == 600) {
-            std::cout << "[+] Received ACK, handshake complete." << std::endl;
-            break;
+        struct tpacket3_hdr *pkt = (struct tpacket3_hdr *)((char *)desc + desc->hdr.bh1.offset_to_first_pkt);
+        for (uint32_t i = 0; i < desc->hdr.bh1.num_pkts; ++i) {
+            struct sockaddr_ll *from = (struct sockaddr_ll *)((char *)pkt + TPACKET_ALIGN(sizeof(*pkt)));
+            // On lo every packet passes twice, going out and coming in
+            if (from->sll_pkttype != PACKET_OUTGOING) {
+                const char *data = (const char *)pkt + pkt->tp_net;
+                size_t len = pkt->tp_snaplen - (pkt->tp_net - pkt->tp_mac);
+                handle_packet(send_sock, data, len);
+            }
+            pkt = (struct tpacket3_hdr *)((char *)pkt + pkt->tp_next_offset);
         }
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        block = (block + 1) % RING_BLOCKS;
+        run_timers(send_sock);
+        if (stats_mode) report_stats(fd);
     }
 
-    close(sock);
+    munmap(ring, ring_size);
+    close(send_sock);
+    close(fd);
 }
 
-int main() {
-    std::cout << "[+] Server listening on port " << SERVER_PORT << "..." << std::endl;
-    receive_syn();
-    return 0;
+void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [--rx recvfrom|mmsg|ring] [--ifname IF] [--max-flows N] [--syncookies] [--stats]"
+              << " [--no-filter]" << std::endl;
+    exit(EXIT_FAILURE);
 }
 
+int main(int argc, char *argv[]) {
+    RxMode mode = RX_RECVFROM;
+    std::string ifname = "lo";  // ring mode captures on one interface
+    long max_flows = DEFAULT_MAX_FLOWS;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--rx" && i + 1 < argc) {
+            std::string m = argv[++i];
+            if (m == "recvfrom") mode = RX_RECVFROM;
+            else if (m == "mmsg") mode = RX_MMSG;
+            else if (m == "ring") mode = RX_RING;
+            else usage(argv[0]);
+        } else if (arg == "--ifname" && i + 1 < argc) {
+            ifname = argv[++i];
+        } else if (arg == "--max-flows" && i + 1 < argc) {
+            max_flows = atol(argv[++i]);
+            if (max_flows < 1 || max_flows > (1 << 24)) usage(argv[0]);
+        } else if (arg == "--syncookies") {
+            syn_cookies = true;
+        } else if (arg == "--stats") {
+            stats_mode = true;
+        } else if (arg == "--no-filter") {
+            kernel_filter = false;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    SipKey table_key;
+    if (!sip_random_key(isn_key) || !sip_random_key(table_key) || !sip_random_key(cookie_key)) {
+        perror("getrandom() failed");
+        exit(EXIT_FAILURE);
+    }
+    FlowTable table(max_flows, table_key, IDLE_QUEUE + 1);
+    flows = &table;
+
+    // Interrupt the blocking receive (no SA_RESTART) so totals get printed
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (mode == RX_MMSG) {
+        receive_mmsg();
+    } else if (mode == RX_RING) {
+        receive_ring(ifname.c_str());
+    } else {
+        receive_syn();
+    }
+    std::cout << "[+] Received " << rx_packets << " TCP segments, " << rx_matched << " for port "
+              << SERVER_PORT << std::endl;
+    std::cout << "[+] " << handshakes << " handshakes completed, " << synack_retransmits
+              << " SYN-ACKs retransmitted, " << flow_timeouts << " half-open flows timed out, " << table_full
+              << " SYNs dropped with the table full" << std::endl;
+    if (syn_cookies) {
+        std::cout << "[+] " << cookies_sent << " SYN cookies sent, " << bad_cookies << " ACKs with a bad cookie"
+                  << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/random.h>
+
+// ----------------- SipHash-2-4 ----------------------
+// A keyed hash (Aumasson and Bernstein) for values a remote sender must not
+// be able to predict or collide: initial sequence numbers, SYN cookies and
+// the flow table's buckets. The key comes from sip_random_key() at startup.
+struct SipKey {
+    uint64_t k0 = 0, k1 = 0;
+};
+
+namespace siphash_detail {
+
+inline uint64_t rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+inline void sip_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+}
+
+}  // namespace siphash_detail
+
+inline uint64_t siphash24(const SipKey& key, const void* data, size_t len) {
+    using namespace siphash_detail;
+    const auto* p = static_cast<const uint8_t*>(data);
+    uint64_t v0 = key.k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = key.k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = key.k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = key.k1 ^ 0x7465646279746573ull;
+    uint64_t b = static_cast<uint64_t>(len) << 56;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t m;
+        memcpy(&m, p, 8);   // little-endian hosts, as the reference reads it
+        v3 ^= m;
+        sip_round(v0, v1, v2, v3);
+        sip_round(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        b |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    v3 ^= b;
+    sip_round(v0, v1, v2, v3);
+    sip_round(v0, v1, v2, v3);
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i) {
+        sip_round(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// A fresh key from the kernel's random pool; false if none was available.
+inline bool sip_random_key(SipKey& key) {
+    return getrandom(&key, sizeof(key), 0) == static_cast<ssize_t>(sizeof(key));
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+#include "flow_table.h"
+#include "siphash.h"
+
+#define COOKIE_SLOT_MS 64000   // cookies made in one 64 s slot...
+#define COOKIE_MAX_AGE 1       // ...are accepted for this many slots after it
+
+// ----------------- SYN Cookies ----------------------
+// The server's ISN in cookie mode, so a SYN leaves nothing behind and the
+// final ACK alone is enough to set up the flow (Bernstein's layout):
+//
+//   bits 31..27  time slot, mod 32
+//   bits 26..24  index of the peer's MSS in cookie_mss_table
+//   bits 23..0   SipHash of the 4-tuple, the peer's ISN, the slot and the
+//                MSS index, under a secret key
+//
+// The ACK carries the cookie back as ack_seq - 1 and the peer's ISN as
+// seq - 1. Forging one means guessing 24 bits of a keyed hash.
+
+static const uint16_t cookie_mss_table[8] = {536, 1024, 1220, 1300, 1360, 1440, 1460, 8960};
+
+namespace syn_cookie_detail {
+
+inline uint32_t mac(const SipKey& secret, const FlowKey& key, uint32_t irs, uint32_t slot, uint32_t mss_index) {
+    uint32_t words[6] = {key.saddr, key.daddr, static_cast<uint32_t>(key.sport) << 16 | key.dport,
+                         irs, slot, mss_index};
+    return static_cast<uint32_t>(siphash24(secret, words, sizeof(words))) & 0xffffff;
+}
+
+}  // namespace syn_cookie_detail
+
+// The ISN for a SYN from key with sequence number irs, announcing mss
+// (the largest table entry not above it is what gets encoded).
+inline uint32_t syn_cookie_make(const SipKey& secret, const FlowKey& key, uint32_t irs, uint16_t mss,
+                                uint64_t now_ms) {
+    uint32_t slot = static_cast<uint32_t>(now_ms / COOKIE_SLOT_MS);
+    uint32_t index = 0;
+    while (index < 7 && cookie_mss_table[index + 1] <= mss) ++index;
+    return (slot & 31) << 27 | index << 24 | syn_cookie_detail::mac(secret, key, irs, slot, index);
+}
+
+// Whether cookie is one we made for key and irs no more than
+// COOKIE_MAX_AGE slots ago; if so, mss gets the MSS it encodes.
+inline bool syn_cookie_check(const SipKey& secret, const FlowKey& key, uint32_t irs, uint32_t cookie,
+                             uint64_t now_ms, uint16_t& mss) {
+    uint32_t now_slot = static_cast<uint32_t>(now_ms / COOKIE_SLOT_MS);
+    uint32_t index = (cookie >> 24) & 7;
+    for (uint32_t age = 0; age <= COOKIE_MAX_AGE; ++age) {
+        uint32_t slot = now_slot - age;
+        if ((slot & 31) != cookie >> 27) continue;
+        if (syn_cookie_detail::mac(secret, key, irs, slot, index) != (cookie & 0xffffff)) return false;
+        mss = cookie_mss_table[index];
+        return true;
+    }
+    return false;
+}
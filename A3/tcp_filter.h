@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+
+#define FILTER_ACCEPT 0x40000   // bytes of a matching packet to keep: all of it
+
+// ----------------- Kernel Packet Filter --------------
+// A classic BPF program that lets through only the TCP segments one end
+// of the handshake cares about, so the kernel drops the rest before they
+// are copied to user space. The program runs on packets that start at the
+// IP header: raw AF_INET sockets and SOCK_DGRAM packet sockets.
+struct TcpFilter {
+    uint16_t dest_port = 0;       // host order; 0 matches any
+    uint16_t source_port = 0;     // host order; 0 matches any
+    uint32_t source_addr = 0;     // network order, like s_addr; 0 matches any
+    uint32_t dest_addr = 0;       // network order; 0 matches any
+    bool incoming_only = false;   // drop our own packets (packet sockets on lo see both)
+};
+
+namespace tcp_filter_detail {
+
+inline sock_filter stmt(uint16_t code, uint32_t k) {
+    return sock_filter{code, 0, 0, k};
+}
+
+}  // namespace tcp_filter_detail
+
+// The program for spec. Every failed test jumps to the final "ret #0".
+inline std::vector<sock_filter> build_tcp_filter(const TcpFilter& spec) {
+    using namespace tcp_filter_detail;
+    std::vector<sock_filter> prog;
+    std::vector<size_t> to_drop;   // jumps whose false branch is patched below
+    auto require = [&](uint32_t value) {
+        to_drop.push_back(prog.size());
+        prog.push_back(sock_filter{BPF_JMP | BPF_JEQ | BPF_K, 0, 0, value});
+    };
+
+    if (spec.incoming_only) {
+        prog.push_back(stmt(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE));
+        prog.push_back(sock_filter{BPF_JMP | BPF_JEQ | BPF_K, 0, 1, PACKET_OUTGOING});
+        prog.push_back(stmt(BPF_RET | BPF_K, 0));
+    }
+
+    prog.push_back(stmt(BPF_LD | BPF_B | BPF_ABS, 9));   // protocol
+    require(IPPROTO_TCP);
+
+    // Later fragments carry no TCP header to look at
+    prog.push_back(stmt(BPF_LD | BPF_H | BPF_ABS, 6));   // flags and fragment offset
+    size_t frag_jump = prog.size();
+    prog.push_back(sock_filter{BPF_JMP | BPF_JSET | BPF_K, 0, 0, 0x1fff});
+
+    if (spec.source_addr != 0) {
+        prog.push_back(stmt(BPF_LD | BPF_W | BPF_ABS, 12));
+        require(ntohl(spec.source_addr));
+    }
+    if (spec.dest_addr != 0) {
+        prog.push_back(stmt(BPF_LD | BPF_W | BPF_ABS, 16));
+        require(ntohl(spec.dest_addr));
+    }
+
+    // X = IP header length, then the ports relative to it
+    prog.push_back(stmt(BPF_LDX | BPF_B | BPF_MSH, 0));
+    if (spec.source_port != 0) {
+        prog.push_back(stmt(BPF_LD | BPF_H | BPF_IND, 0));
+        require(spec.source_port);
+    }
+    if (spec.dest_port != 0) {
+        prog.push_back(stmt(BPF_LD | BPF_H | BPF_IND, 2));
+        require(spec.dest_port);
+    }
+
+    prog.push_back(stmt(BPF_RET | BPF_K, FILTER_ACCEPT));
+    size_t drop = prog.size();
+    prog.push_back(stmt(BPF_RET | BPF_K, 0));
+
+    for (size_t at : to_drop) {
+        prog[at].jf = static_cast<uint8_t>(drop - at - 1);
+    }
+    prog[frag_jump].jt = static_cast<uint8_t>(drop - frag_jump - 1);
+    return prog;
+}
+
+// Attaches the program for spec to sock. Packets queued before the call
+// were not filtered, so callers keep their own checks as well.
+inline int attach_tcp_filter(int sock, const TcpFilter& spec) {
+    std::vector<sock_filter> prog = build_tcp_filter(spec);
+    sock_fprog fprog;
+    fprog.len = static_cast<unsigned short>(prog.size());
+    fprog.filter = prog.data();
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+}